@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include "procsim_driver.hpp"
+
+// result a worker process hands back to the batch driver
+struct batch_result_t {
+    int status;
+    proc_stats_t stats;
+};
+
+// ../traces/gcc.ptr.gz -> gcc.output
+static std::string default_output(const std::string &trace) {
+    static const char *suffixes[] = { ".gz", ".ptb", ".ptr", ".trace" };
+    if (trace == "-")
+        return "stdin.output";
+
+    std::string name = trace.substr(trace.find_last_of('/') + 1);
+
+    for (auto suffix : suffixes) {
+        size_t len = strlen(suffix);
+        if (name.size() > len && name.compare(name.size() - len, len, suffix) == 0)
+            name.erase(name.size() - len);
+    }
+    return name + ".output";
+}
+
+bool read_manifest(const char *filename, std::vector<batch_job_t> &jobs) {
+    std::ifstream in(filename);
+    if (!in) {
+        fprintf(stderr, "Unable to open manifest %s\n", filename);
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        batch_job_t job;
+
+        if (!(fields >> job.trace) || job.trace[0] == '#')
+            continue;
+
+        std::string field;
+        while (fields >> field) {
+            if (field.find('=') != std::string::npos)
+                job.config += (job.config.empty() ? "" : " ") + field;
+            else
+                job.output = field;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// runs in the forked worker: report into the job's output file, stats into fd
+static void run_job(const batch_job_t &job, int fd) {
+    batch_result_t result;
+    memset(&result, 0, sizeof(result));
+
+    if (freopen(job.output.c_str(), "w", stdout) == NULL) {
+        fprintf(stderr, "Unable to create %s\n", job.output.c_str());
+        result.status = 1;
+    } else if (!apply_config(&sim_opts, job.config)) {
+        fprintf(stderr, "Bad settings for %s: %s\n", job.trace.c_str(), job.config.c_str());
+        result.status = 1;
+    } else {
+        result.status = simulate_trace(job.trace.c_str(), &result.stats);
+        fflush(stdout);
+    }
+
+    if (write(fd, &result, sizeof(result)) != sizeof(result))
+        result.status = 1;
+    _exit(result.status);
+}
+
+int run_batch(std::vector<batch_job_t> &jobs, const std::string &out_dir, unsigned n_workers) {
+    std::set<std::string> used;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (jobs[i].output.empty())
+            jobs[i].output = default_output(jobs[i].trace);
+        if (!out_dir.empty() && jobs[i].output[0] != '/')
+            jobs[i].output = out_dir + "/" + jobs[i].output;
+
+        // two traces with the same name must not share a report
+        if (!used.insert(jobs[i].output).second) {
+            jobs[i].output += "." + std::to_string(i);
+            used.insert(jobs[i].output);
+        }
+    }
+
+    if (n_workers == 0)
+        n_workers = 1;
+
+    std::vector<batch_result_t> results(jobs.size());
+    std::map<pid_t, std::pair<size_t, int> > running;
+    size_t next = 0;
+    int failed = 0;
+
+    // don't let the workers inherit and flush our pending output
+    fflush(stdout);
+
+    while (next < jobs.size() || !running.empty()) {
+        // keep every worker slot busy
+        while (next < jobs.size() && running.size() < n_workers) {
+            int fds[2];
+            if (pipe(fds) != 0) {
+                perror("pipe");
+                return jobs.size();
+            }
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                run_job(jobs[next], fds[1]);
+            }
+            close(fds[1]);
+
+            if (pid < 0) {
+                perror("fork");
+                close(fds[0]);
+                results[next].status = 1;
+                failed++;
+            } else {
+                running[pid] = std::make_pair(next, fds[0]);
+            }
+            next++;
+        }
+
+        if (running.empty())
+            continue;
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            perror("waitpid");
+            return jobs.size();
+        }
+
+        auto it = running.find(pid);
+        if (it == running.end())
+            continue;
+
+        size_t job = it->second.first;
+        int fd = it->second.second;
+        running.erase(it);
+
+        if (read(fd, &results[job], sizeof(batch_result_t)) != sizeof(batch_result_t) ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            results[job].status = 1;
+        }
+        close(fd);
+
+        if (results[job].status)
+            failed++;
+    }
+
+    // combined summary of every trace
+    unsigned long total_inst = 0;
+    unsigned long total_cycles = 0;
+
+    printf("TRACE\tINSTS\tCYCLES\tIPC\tMAX_DISP\tAVG_DISP\tOUTPUT\n");
+    for (size_t i = 0; i < jobs.size(); i++) {
+        proc_stats_t &st = results[i].stats;
+
+        if (results[i].status) {
+            printf("%s\tFAILED\t\t\t\t\t%s\n", jobs[i].trace.c_str(), jobs[i].output.c_str());
+            continue;
+        }
+
+        printf("%s\t%lu\t%lu\t%f\t%lu\t%f\t%s\n", jobs[i].trace.c_str(),
+               st.retired_instruction, st.cycle_count, st.avg_inst_retired,
+               st.max_disp_size, st.avg_disp_size, jobs[i].output.c_str());
+        total_inst += st.retired_instruction;
+        total_cycles += st.cycle_count;
+    }
+    printf("ALL\t%lu\t%lu\t%f\n", total_inst, total_cycles,
+           total_cycles ? total_inst * 1.f / total_cycles : 0.f);
+
+    return failed;
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bpred.hpp"
+
+bool parse_bpred(const char *arg, bpred_kind_t *kind, uint32_t *bits) {
+    static const bpred_kind_t kinds[] = { BPRED_BIMODAL, BPRED_GSHARE, BPRED_TAGE };
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t) (colon - arg) : strlen(arg);
+
+    *bits = DEFAULT_BPRED_BITS;
+    if (colon != NULL) {
+        *bits = atoi(colon + 1);
+        if (*bits < 6 || *bits > 24)
+            return false;
+    }
+
+    for (auto k : kinds) {
+        if (strlen(bpred_name(k)) == len && strncmp(arg, bpred_name(k), len) == 0) {
+            *kind = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *bpred_name(bpred_kind_t kind) {
+    switch (kind) {
+    case BPRED_BIMODAL:
+        return "bimodal";
+    case BPRED_GSHARE:
+        return "gshare";
+    case BPRED_TAGE:
+        return "tage";
+    default:
+        return "none";
+    }
+}
+
+void counter_table_t::init(uint32_t bits) {
+    mask = (1U << bits) - 1;
+    // weakly not taken
+    words.assign(((size_t) 1 << bits) / 32 + 1, 0x5555555555555555ULL);
+}
+
+static inline uint64_t pc_hash(uint64_t pc, uint32_t bits) {
+    return pc ^ (pc >> bits);
+}
+
+/** BIMODAL */
+class bimodal_t : public bpred_t {
+public:
+    bimodal_t(uint32_t bits) : bits(bits) { table.init(bits); }
+
+    bool predict_update(uint64_t pc, bool taken) {
+        uint32_t i = table.index(pc_hash(pc, bits));
+        bool pred = table.taken(i);
+
+        table.update(i, taken);
+        return pred;
+    }
+
+private:
+    uint32_t bits;
+    counter_table_t table;
+};
+
+/** GSHARE */
+class gshare_t : public bpred_t {
+public:
+    gshare_t(uint32_t bits) : bits(bits), history(0) { table.init(bits); }
+
+    bool predict_update(uint64_t pc, bool taken) {
+        uint32_t i = table.index(pc_hash(pc, bits) ^ history);
+        bool pred = table.taken(i);
+
+        table.update(i, taken);
+        history = (history << 1) | taken;
+        return pred;
+    }
+
+private:
+    uint32_t bits;
+    uint64_t history;
+    counter_table_t table;
+};
+
+/** TAGE-LITE */
+// a bimodal base plus four tagged tables over geometric global histories
+// entry: tag [8:0] | 3-bit counter [11:9] | 2-bit useful [13:12]
+#define TAGE_TABLES 4
+#define TAGE_TAG_BITS 9
+#define TAGE_RESET_PERIOD (1 << 18)
+
+static const uint32_t tage_history[TAGE_TABLES] = { 5, 11, 22, 44 };
+
+class tage_t : public bpred_t {
+public:
+    tage_t(uint32_t bits) : bits(bits - 1), history(0), branches(0) {
+        base.init(bits);
+        for (int t = 0; t < TAGE_TABLES; t++)
+            tables[t].assign((size_t) 1 << this->bits, 0);
+    }
+
+    bool predict_update(uint64_t pc, bool taken) {
+        uint32_t idx[TAGE_TABLES];
+        uint16_t tag[TAGE_TABLES];
+        int provider = -1;
+        int alt = -1;
+
+        for (int t = TAGE_TABLES - 1; t >= 0; t--) {
+            idx[t] = (pc_hash(pc, bits) ^ fold(t, bits)) & ((1U << bits) - 1);
+            tag[t] = (pc ^ fold(t, TAGE_TAG_BITS) ^ (fold(t, TAGE_TAG_BITS - 1) << 1)) & ((1U << TAGE_TAG_BITS) - 1);
+
+            if (entry_tag(tables[t][idx[t]]) == tag[t]) {
+                if (provider < 0) {
+                    provider = t;
+                } else {
+                    alt = t;
+                    break;
+                }
+            }
+        }
+
+        uint32_t bi = base.index(pc_hash(pc, bits + 1));
+        bool base_pred = base.taken(bi);
+        bool alt_pred = alt >= 0 ? counter(tables[alt][idx[alt]]) >= 4 : base_pred;
+        bool pred = provider >= 0 ? counter(tables[provider][idx[provider]]) >= 4 : base_pred;
+
+        // train the provider
+        if (provider >= 0) {
+            uint16_t &e = tables[provider][idx[provider]];
+            uint32_t c = counter(e);
+            uint32_t u = useful(e);
+
+            if (taken && c < 7)
+                c++;
+            else if (!taken && c > 0)
+                c--;
+            if (pred != alt_pred) {
+                if (pred == taken && u < 3)
+                    u++;
+                else if (pred != taken && u > 0)
+                    u--;
+            }
+            e = make_entry(entry_tag(e), c, u);
+        } else {
+            base.update(bi, taken);
+        }
+
+        // on a misprediction claim an entry with a longer history
+        if (pred != taken && provider < TAGE_TABLES - 1) {
+            bool allocated = false;
+            for (int t = provider + 1; t < TAGE_TABLES && !allocated; t++) {
+                if (useful(tables[t][idx[t]]) == 0) {
+                    tables[t][idx[t]] = make_entry(tag[t], taken ? 4 : 3, 0);
+                    allocated = true;
+                }
+            }
+            for (int t = provider + 1; t < TAGE_TABLES && !allocated; t++) {
+                uint16_t &e = tables[t][idx[t]];
+                e = make_entry(entry_tag(e), counter(e), useful(e) - 1);
+            }
+        }
+
+        // age the useful bits so stale entries can be replaced
+        if (++branches % TAGE_RESET_PERIOD == 0) {
+            for (int t = 0; t < TAGE_TABLES; t++) {
+                for (auto &e : tables[t])
+                    e = make_entry(entry_tag(e), counter(e), useful(e) >> 1);
+            }
+        }
+
+        history = (history << 1) | taken;
+        return pred;
+    }
+
+private:
+    static uint32_t entry_tag(uint16_t e) { return e & ((1U << TAGE_TAG_BITS) - 1); }
+    static uint32_t counter(uint16_t e) { return (e >> 9) & 7; }
+    static uint32_t useful(uint16_t e) { return (e >> 12) & 3; }
+    static uint16_t make_entry(uint32_t tag, uint32_t c, uint32_t u) {
+        return tag | (c << 9) | (u << 12);
+    }
+
+    // the history of table t folded down to n bits
+    uint64_t fold(int t, uint32_t n) const {
+        uint64_t h = history;
+        uint64_t r = 0;
+
+        if (tage_history[t] < 64)
+            h &= (1ULL << tage_history[t]) - 1;
+        for (; h; h >>= n)
+            r ^= h & ((1ULL << n) - 1);
+        return r;
+    }
+
+    uint32_t bits;
+    uint64_t history;
+    uint64_t branches;
+    counter_table_t base;
+    std::vector<uint16_t> tables[TAGE_TABLES];
+};
+
+bpred_t *create_bpred(bpred_kind_t kind, uint32_t bits) {
+    switch (kind) {
+    case BPRED_BIMODAL:
+        return new bimodal_t(bits);
+    case BPRED_GSHARE:
+        return new gshare_t(bits);
+    case BPRED_TAGE:
+        return new tage_t(bits);
+    default:
+        return NULL;
+    }
+}
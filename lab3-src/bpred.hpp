@@ -0,0 +1,62 @@
+#ifndef BPRED_H
+#define BPRED_H
+
+#include "procsim.hpp"
+
+/*
+ * Branch direction predictors
+ *
+ * The trace knows every branch outcome at fetch, so a predictor looks up
+ * and trains in the same call. All tables are bit-packed: 2-bit counters
+ * are stored 32 to a word and TAGE entries are 16 bits each.
+ */
+
+#define DEFAULT_BPRED_BITS 12
+
+enum bpred_kind_t { BPRED_NONE, BPRED_BIMODAL, BPRED_GSHARE, BPRED_TAGE };
+
+// parses NAME[:LOG2_ENTRIES]
+bool parse_bpred(const char *arg, bpred_kind_t *kind, uint32_t *bits);
+const char *bpred_name(bpred_kind_t kind);
+
+// 2^bits saturating 2-bit counters, 32 per 64 bit word
+class counter_table_t {
+public:
+    void init(uint32_t bits);
+
+    uint32_t index(uint64_t x) const { return x & mask; }
+
+    bool taken(uint32_t i) const {
+        return (words[i >> 5] >> ((i & 31) * 2)) & 2;
+    }
+
+    void update(uint32_t i, bool taken) {
+        uint64_t &w = words[i >> 5];
+        uint32_t shift = (i & 31) * 2;
+        uint32_t c = (w >> shift) & 3;
+
+        if (taken && c < 3)
+            c++;
+        else if (!taken && c > 0)
+            c--;
+        w = (w & ~(3ULL << shift)) | ((uint64_t) c << shift);
+    }
+
+private:
+    uint32_t mask;
+    std::vector<uint64_t> words;
+};
+
+class bpred_t {
+public:
+    virtual ~bpred_t() { }
+
+    // predict the branch at pc, then train with its outcome
+    // returns the prediction
+    virtual bool predict_update(uint64_t pc, bool taken) = 0;
+};
+
+// creates a predictor with 2^bits entries per table
+bpred_t *create_bpred(bpred_kind_t kind, uint32_t bits);
+
+#endif /* BPRED_H */
@@ -0,0 +1,622 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
+#include <deque>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "daemon.hpp"
+#include "procsim_driver.hpp"
+#include "trace_source.hpp"
+#include "mem_stats.hpp"
+
+// seconds a client gets to send its request
+#define DAEMON_REQUEST_TIMEOUT 5
+// milliseconds between checks for finished workers
+#define DAEMON_POLL_MS 20
+
+struct cached_trace_t {
+    std::string path;       // absolute
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    mem_vector_t<Trace_Rec, MEM_TRACE> recs;
+};
+
+// most recently used first
+static std::list<cached_trace_t> trace_cache;
+static uint64_t trace_cache_bytes;
+// set in the workers, which only read the cache
+static bool daemon_worker = false;
+
+struct daemon_job_t {
+    uint64_t id;
+    int conn;
+    std::string cwd;
+    std::vector<std::string> args;
+    std::vector<std::string> traces;        // absolute paths
+    std::vector<std::string> missing;       // of those, not cached or changed since
+    std::list<cached_trace_t> loaded;       // by the loader, not in the cache yet
+    int out;                // files the worker's standard output and error go to
+    int err;
+    struct timespec start;
+};
+
+// a connection whose request is still coming in
+struct daemon_conn_t {
+    std::string request;
+    struct timespec start;
+};
+
+// decompresses the traces of the jobs that aren't cached while the main
+// loop keeps accepting and starting jobs; only the main loop touches the
+// cache, a job hands the traces over when it comes back done
+struct trace_loader_t {
+    std::thread thread;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<daemon_job_t *> todo;
+    std::deque<daemon_job_t *> done;
+    bool stop;
+    int notify[2];          // a byte per job done, for poll
+};
+
+// the descriptors of the daemon, which a worker closes all but its own of
+static std::set<int> daemon_fds;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void stop_daemon(int) {
+    daemon_stop = 1;
+}
+
+static double elapsed_ms(const struct timespec &start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static void close_fd(int fd) {
+    daemon_fds.erase(fd);
+    close(fd);
+}
+
+static std::list<cached_trace_t>::iterator find_trace(const std::string &path) {
+    for (auto it = trace_cache.begin(); it != trace_cache.end(); ++it) {
+        if (it->path == path)
+            return it;
+    }
+    return trace_cache.end();
+}
+
+bool in_daemon_worker() {
+    return daemon_worker;
+}
+
+trace_source_t *daemon_trace(const char *filename) {
+    if (!daemon_worker)
+        return NULL;
+
+    char path[PATH_MAX];
+    if (realpath(filename, path) == NULL)
+        return NULL;
+
+    auto it = find_trace(path);
+    if (it == trace_cache.end())
+        return NULL;
+    print_trace_opened(filename);
+    return new memory_trace_source_t(it->recs.data(), it->recs.size());
+}
+
+static bool same_file(const cached_trace_t &t, const struct stat &st) {
+    return t.dev == st.st_dev && t.ino == st.st_ino && t.size == st.st_size &&
+           t.mtime.tv_sec == st.st_mtim.tv_sec && t.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+// true if the trace at path (absolute) is cached and hasn't changed since
+static bool trace_cached(const std::string &path) {
+    struct stat st;
+    auto it = find_trace(path);
+    return it != trace_cache.end() && stat(path.c_str(), &st) == 0 && same_file(*it, st);
+}
+
+// decode the trace at path into t, in the loader thread
+static bool read_trace(const std::string &path, cached_trace_t &t) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    trace_source_t *src = open_trace_source(path.c_str());
+    if (src == NULL)
+        return false;
+
+    t.path = path;
+    t.dev = st.st_dev;
+    t.ino = st.st_ino;
+    t.size = st.st_size;
+    t.mtime = st.st_mtim;
+
+    size_t n = 0;
+    do {
+        t.recs.resize(n + (1 << 16));
+        n += src->read_batch(t.recs.data() + n, t.recs.size() - n);
+    } while (n == t.recs.size());
+    t.recs.resize(n);
+    t.recs.shrink_to_fit();
+    bool failed = src->failed() || n == 0;
+    delete src;
+
+    // the worker reads a bad trace itself and fails the job
+    return !failed;
+}
+
+// move the traces of job to the front of the cache, adding those it
+// loaded, and evict the least recently used traces past the budget but
+// none of the job's
+static void cache_job_traces(daemon_job_t &job, uint64_t budget) {
+    size_t keep = 0;
+
+    for (auto &path : job.traces) {
+        auto it = find_trace(path);
+        auto loaded = job.loaded.begin();
+        while (loaded != job.loaded.end() && loaded->path != path)
+            ++loaded;
+
+        if (loaded != job.loaded.end()) {
+            // changed since it was cached
+            if (it != trace_cache.end()) {
+                trace_cache_bytes -= it->recs.size() * sizeof(Trace_Rec);
+                trace_cache.erase(it);
+            }
+            trace_cache_bytes += loaded->recs.size() * sizeof(Trace_Rec);
+            trace_cache.splice(trace_cache.begin(), job.loaded, loaded);
+            keep++;
+        } else if (it != trace_cache.end()) {
+            trace_cache.splice(trace_cache.begin(), trace_cache, it);
+            keep++;
+        }
+    }
+    job.loaded.clear();
+
+    while (trace_cache_bytes > budget && trace_cache.size() > keep) {
+        cached_trace_t &old = trace_cache.back();
+        printf("Evicted %s (%zu records)\n", old.path.c_str(), old.recs.size());
+        trace_cache_bytes -= old.recs.size() * sizeof(Trace_Rec);
+        trace_cache.pop_back();
+    }
+}
+
+static void run_loader(trace_loader_t *loader) {
+    std::unique_lock<std::mutex> lock(loader->m);
+
+    while (true) {
+        loader->cv.wait(lock, [&]() { return loader->stop || !loader->todo.empty(); });
+        if (loader->todo.empty())
+            return;
+
+        daemon_job_t *job = loader->todo.front();
+        loader->todo.pop_front();
+        lock.unlock();
+
+        for (auto &path : job->missing) {
+            job->loaded.push_back(cached_trace_t());
+            if (!read_trace(path, job->loaded.back()))
+                job->loaded.pop_back();
+        }
+
+        lock.lock();
+        loader->done.push_back(job);
+        char c = 0;
+        if (write(loader->notify[1], &c, 1) < 0)
+            perror("write");
+    }
+}
+
+static void send_response(int conn, int status, int out, int err) {
+    daemon_response_t response;
+    memset(&response, 0, sizeof(response));
+    memcpy(response.magic, DAEMON_RESPONSE_MAGIC, sizeof(response.magic));
+    response.status = status;
+
+    struct stat st;
+    response.out_size = (out >= 0 && fstat(out, &st) == 0) ? st.st_size : 0;
+    response.err_size = (err >= 0 && fstat(err, &st) == 0) ? st.st_size : 0;
+
+    bool ok = daemon_write(conn, &response, sizeof(response));
+    std::vector<char> buf(1 << 16);
+    int fds[2] = { out, err };
+    uint64_t sizes[2] = { response.out_size, response.err_size };
+    for (int i = 0; i < 2 && ok; i++) {
+        if (lseek(fds[i], 0, SEEK_SET) != 0 && sizes[i] != 0)
+            ok = false;
+        for (uint64_t left = sizes[i]; ok && left > 0;) {
+            size_t n = std::min<uint64_t>(left, buf.size());
+            ok = daemon_read(fds[i], buf.data(), n) && daemon_write(conn, buf.data(), n);
+            left -= n;
+        }
+    }
+}
+
+// answer a job that never got to a worker
+static void reject_job(daemon_job_t &job, const std::string &message) {
+    FILE *err = tmpfile();
+    if (err != NULL) {
+        fprintf(err, "%s\n", message.c_str());
+        fflush(err);
+    }
+    send_response(job.conn, 1, -1, err != NULL ? fileno(err) : -1);
+    if (err != NULL)
+        fclose(err);
+    close_fd(job.conn);
+    printf("Job %" PRIu64 ": %s\n", job.id, message.c_str());
+}
+
+// read what the client sent so far without blocking; 1 once the request
+// is complete and parsed into job, 0 while more is to come, -1 if the
+// client sent something else or went away
+static int read_job(int conn, daemon_conn_t &pending, daemon_job_t &job) {
+    char buf[4096];
+    ssize_t n = read(conn, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return 0;
+    if (n <= 0)
+        return -1;
+    pending.request.append(buf, n);
+
+    daemon_request_t request;
+    if (pending.request.size() < sizeof(request))
+        return 0;
+    memcpy(&request, pending.request.data(), sizeof(request));
+    if (memcmp(request.magic, DAEMON_REQUEST_MAGIC, sizeof(request.magic)) != 0 ||
+        request.size == 0 || request.size > (1 << 20) || pending.request.size() > sizeof(request) + request.size)
+        return -1;
+    if (pending.request.size() < sizeof(request) + request.size)
+        return 0;
+
+    std::string payload = pending.request.substr(sizeof(request));
+    if (payload.back() != '\0')
+        return -1;
+
+    size_t at = 0;
+    job.cwd = payload.c_str();
+    at = job.cwd.size() + 1;
+    while (at < payload.size()) {
+        job.args.push_back(payload.c_str() + at);
+        at += job.args.back().size() + 1;
+    }
+    return job.args.empty() ? -1 : 1;
+}
+
+// the absolute paths of the traces of job, in the client's directory
+// (manifests included); false if the job was answered already
+static bool resolve_traces(daemon_job_t &job, int daemon_dir) {
+    // relative paths in the job are the client's
+    if (chdir(job.cwd.c_str()) != 0) {
+        reject_job(job, "Unable to enter " + job.cwd);
+        return false;
+    }
+
+    std::vector<std::string> args(job.args);
+    std::vector<char *> argv;
+    for (auto &a : args)
+        argv.push_back(&a[0]);
+    argv.push_back(NULL);
+
+    std::vector<std::string> traces;
+    job_traces(argv.size() - 1, argv.data(), traces);
+
+    std::string stream;
+    for (auto &trace : traces) {
+        char path[PATH_MAX];
+        if (is_stream_trace(trace.c_str()) && stream.empty())
+            stream = trace;
+        // a trace that can't be found is reported by the worker
+        else if (realpath(trace.c_str(), path) != NULL &&
+                 std::find(job.traces.begin(), job.traces.end(), path) == job.traces.end())
+            job.traces.push_back(path);
+    }
+
+    if (fchdir(daemon_dir) != 0)
+        perror("fchdir");
+    if (!stream.empty()) {
+        reject_job(job, stream + " is a stream, which the daemon can't read for its client");
+        return false;
+    }
+    return true;
+}
+
+// cache the traces the loader brought and fork the worker of job, -1 if
+// the job was answered already
+static pid_t start_job(daemon_job_t &job, uint64_t budget) {
+    cache_job_traces(job, budget);
+
+    FILE *out = tmpfile();
+    FILE *err = tmpfile();
+    if (out == NULL || err == NULL) {
+        if (out != NULL)
+            fclose(out);
+        if (err != NULL)
+            fclose(err);
+        reject_job(job, "Unable to create the output files of the job");
+        return -1;
+    }
+    job.out = fcntl(fileno(out), F_DUPFD_CLOEXEC, 0);
+    job.err = fcntl(fileno(err), F_DUPFD_CLOEXEC, 0);
+    fclose(out);
+    fclose(err);
+    daemon_fds.insert(job.out);
+    daemon_fds.insert(job.err);
+
+    std::vector<char *> argv;
+    for (auto &a : job.args)
+        argv.push_back(&a[0]);
+    argv.push_back(NULL);
+
+    // don't let the worker inherit and flush our pending output
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        dup2(job.out, STDOUT_FILENO);
+        dup2(job.err, STDERR_FILENO);
+        // the listener, the loader's pipe and the other jobs' connections and files
+        for (int fd : daemon_fds)
+            close(fd);
+
+        daemon_worker = true;
+        if (chdir(job.cwd.c_str()) != 0) {
+            fprintf(stderr, "Unable to enter %s\n", job.cwd.c_str());
+            exit(1);
+        }
+        int status = procsim_main(argv.size() - 1, argv.data());
+        fflush(stdout);
+        exit(status);
+    }
+    if (pid < 0) {
+        perror("fork");
+        close_fd(job.out);
+        close_fd(job.err);
+        reject_job(job, "Unable to start a worker");
+        return -1;
+    }
+    return pid;
+}
+
+static void finish_job(daemon_job_t &job, int wait_status) {
+    int status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+
+    send_response(job.conn, status, job.out, job.err);
+    close_fd(job.conn);
+    close_fd(job.out);
+    close_fd(job.err);
+
+    std::string cmd;
+    for (auto &a : job.args)
+        cmd += (cmd.empty() ? "" : " ") + a;
+    printf("Job %" PRIu64 ": %s: status %d, %.1f ms\n", job.id, cmd.c_str(), status, elapsed_ms(job.start));
+}
+
+static int open_listener(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // a socket left behind by a daemon that died is taken over, a live one isn't
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "A daemon is already listening on %s\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    unlink(socket_path);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int run_daemon(const char *socket_path, unsigned n_workers, uint64_t cache_mb) {
+    int listener = open_listener(socket_path);
+    if (listener < 0)
+        return 1;
+    daemon_fds.insert(listener);
+
+    // the jobs' relative paths are resolved in their directories, then we come back here
+    int daemon_dir = open(".", O_RDONLY | O_CLOEXEC);
+    if (daemon_dir < 0) {
+        perror("open .");
+        return 1;
+    }
+    daemon_fds.insert(daemon_dir);
+
+    trace_loader_t loader;
+    loader.stop = false;
+    if (pipe2(loader.notify, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    daemon_fds.insert(loader.notify[0]);
+    daemon_fds.insert(loader.notify[1]);
+    loader.thread = std::thread(run_loader, &loader);
+
+    if (n_workers == 0)
+        n_workers = 1;
+    uint64_t budget = cache_mb << 20;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_daemon;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    // a client that went away must not take the daemon with it
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Listening on %s, %u workers, %" PRIu64 " MB of traces\n", socket_path, n_workers, cache_mb);
+    fflush(stdout);
+
+    std::map<int, daemon_conn_t> pending;
+    std::deque<daemon_job_t *> waiting;
+    std::map<pid_t, daemon_job_t *> running;
+    // jobs with the loader, they hold a worker slot
+    unsigned loading = 0;
+    uint64_t next_id = 1;
+
+    while (!daemon_stop || !running.empty() || loading > 0) {
+        /* Wait for clients and loaded traces */
+        std::vector<struct pollfd> pfds;
+        pfds.push_back({ loader.notify[0], POLLIN, 0 });
+        if (!daemon_stop) {
+            pfds.push_back({ listener, POLLIN, 0 });
+            for (auto &p : pending)
+                pfds.push_back({ p.first, POLLIN, 0 });
+        }
+        poll(pfds.data(), pfds.size(), DAEMON_POLL_MS);
+
+        /* Accept new connections */
+        if (!daemon_stop && (pfds[1].revents & POLLIN)) {
+            int conn = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (conn >= 0) {
+                daemon_fds.insert(conn);
+                clock_gettime(CLOCK_MONOTONIC, &pending[conn].start);
+            }
+        }
+
+        /* Read the requests coming in, a client that doesn't finish its own is dropped */
+        for (auto it = pending.begin(); !daemon_stop && it != pending.end();) {
+            daemon_job_t *job = new daemon_job_t();
+            int conn = it->first;
+            int ready = read_job(conn, it->second, *job);
+
+            if (ready == 0 && elapsed_ms(it->second.start) > DAEMON_REQUEST_TIMEOUT * 1e3)
+                ready = -1;
+            if (ready == 0) {
+                delete job;
+                ++it;
+                continue;
+            }
+
+            if (ready > 0) {
+                fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) & ~O_NONBLOCK);
+                job->id = next_id++;
+                job->conn = conn;
+                job->out = job->err = -1;
+                job->start = it->second.start;
+                waiting.push_back(job);
+            } else {
+                close_fd(conn);
+                delete job;
+            }
+            it = pending.erase(it);
+        }
+
+        /* Start the jobs the loader is done with */
+        char drain[64];
+        while (read(loader.notify[0], drain, sizeof(drain)) > 0)
+            ;
+        std::deque<daemon_job_t *> loaded;
+        {
+            std::lock_guard<std::mutex> lock(loader.m);
+            loaded.swap(loader.done);
+        }
+        for (auto job : loaded) {
+            loading--;
+            pid_t pid = daemon_stop ? -1 : start_job(*job, budget);
+            if (pid > 0) {
+                running[pid] = job;
+                continue;
+            }
+            if (daemon_stop)
+                reject_job(*job, "The daemon is shutting down");
+            delete job;
+        }
+
+        /* Answer the finished ones, only reaping workers: the loader's gunzip is its own */
+        for (auto it = running.begin(); it != running.end();) {
+            int wait_status;
+            if (waitpid(it->first, &wait_status, WNOHANG) != it->first) {
+                ++it;
+                continue;
+            }
+            finish_job(*it->second, wait_status);
+            delete it->second;
+            it = running.erase(it);
+        }
+
+        /* Start waiting jobs on the free workers, through the loader if a trace isn't cached */
+        while (!daemon_stop && !waiting.empty() && running.size() + loading < n_workers) {
+            daemon_job_t *job = waiting.front();
+            waiting.pop_front();
+            if (!resolve_traces(*job, daemon_dir)) {
+                delete job;
+                continue;
+            }
+
+            for (auto &path : job->traces) {
+                if (!trace_cached(path))
+                    job->missing.push_back(path);
+            }
+            if (!job->missing.empty()) {
+                std::lock_guard<std::mutex> lock(loader.m);
+                loader.todo.push_back(job);
+                loader.cv.notify_one();
+                loading++;
+                continue;
+            }
+
+            pid_t pid = start_job(*job, budget);
+            if (pid > 0)
+                running[pid] = job;
+            else
+                delete job;
+        }
+        fflush(stdout);
+    }
+
+    for (auto job : waiting) {
+        reject_job(*job, "The daemon is shutting down");
+        delete job;
+    }
+    for (auto &p : pending)
+        close_fd(p.first);
+    {
+        std::lock_guard<std::mutex> lock(loader.m);
+        loader.stop = true;
+        loader.cv.notify_one();
+    }
+    loader.thread.join();
+
+    close_fd(listener);
+    unlink(socket_path);
+    printf("Stopped, %zu traces cached (%" PRIu64 " bytes)\n", trace_cache.size(), trace_cache_bytes);
+    return 0;
+}
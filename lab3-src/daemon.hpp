@@ -0,0 +1,101 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string>
+#include "procsim.hpp"
+
+/*
+ * Simulation daemon
+ *
+ * procsim --daemon listens on a Unix domain socket and keeps the traces of
+ * the jobs it ran decoded in memory, evicting the least recently used once
+ * they take more than the trace cache budget. A job is the command line of
+ * a procsim run and the directory it was started in; procsim-client sends
+ * its own arguments, so it takes the same options as procsim. Requests
+ * are read as they come in, a client gets a few seconds to send its own.
+ * A job whose traces aren't all cached (or changed since) goes to a
+ * loader thread that decompresses them while the daemon goes on serving
+ * the others. Then the daemon forks a worker that enters the client's
+ * directory and runs the command line as procsim would, reading the
+ * traces out of the copy of the cache it inherited. At most -p jobs load
+ * or run at once, the others wait their turn. The report and the exit
+ * status go back to the client when the worker exits.
+ *
+ * Request:  daemon_request_t, then size bytes of "cwd\0arg0\0arg1\0..."
+ * Response: daemon_response_t, then out_size bytes of standard output and
+ *           err_size bytes of standard error
+ */
+
+#define DAEMON_REQUEST_MAGIC "PSJOB001"
+#define DAEMON_RESPONSE_MAGIC "PSRES001"
+#define DEFAULT_TRACE_CACHE_MB 1024
+
+struct daemon_request_t {
+    char magic[8];
+    uint64_t size;
+};
+
+struct daemon_response_t {
+    char magic[8];
+    int32_t status;
+    uint32_t pad;
+    uint64_t out_size;
+    uint64_t err_size;
+};
+
+// the socket of the daemon: $PROCSIM_SOCKET, or /tmp/procsim-<uid>.sock
+inline std::string daemon_socket_path() {
+    const char *env = getenv("PROCSIM_SOCKET");
+    if (env != NULL && *env)
+        return env;
+    return "/tmp/procsim-" + std::to_string(getuid()) + ".sock";
+}
+
+// write or read all of size bytes, retrying short transfers
+inline bool daemon_write(int fd, const void *buf, size_t size) {
+    const char *p = (const char *) buf;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool daemon_read(int fd, void *buf, size_t size) {
+    char *p = (char *) buf;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// serve jobs on socket_path until SIGINT or SIGTERM, running at most
+// n_workers at once and caching up to cache_mb MB of decoded traces
+// returns 0 on a clean shutdown
+int run_daemon(const char *socket_path, unsigned n_workers, uint64_t cache_mb);
+
+// true in the workers of a daemon
+bool in_daemon_worker();
+
+struct trace_source_t;
+
+// a reader of the cached copy of filename in a daemon worker, NULL if the
+// process isn't one or the trace isn't cached
+trace_source_t *daemon_trace(const char *filename);
+
+#endif /* DAEMON_H */
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dcache.hpp"
+
+bool parse_cache_level(const char *arg, cache_level_config_t *config) {
+    char *end;
+
+    config->size = strtoull(arg, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        config->size <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        config->size <<= 20;
+        end++;
+    }
+    if (*end != ':')
+        return false;
+
+    config->ways = strtoul(end + 1, &end, 10);
+    if (*end != ':')
+        return false;
+
+    config->latency = strtoul(end + 1, &end, 10);
+    return *end == 0 && config->size && config->ways && config->latency;
+}
+
+bool cache_level_t::init(const cache_level_config_t &config) {
+    uint64_t lines = config.size >> DCACHE_LINE_BITS;
+
+    if (config.ways == 0 || lines % config.ways)
+        return false;
+    sets = lines / config.ways;
+    // the set index is a mask of the line address
+    if (sets == 0 || (sets & (sets - 1))) {
+        sets = 0;
+        return false;
+    }
+
+    ways = config.ways;
+    latency = config.latency;
+    accesses = 0;
+    misses = 0;
+    tags.assign((size_t) sets * ways, 0);
+    return true;
+}
+
+bool cache_level_t::access(uint64_t line) {
+    uint64_t *set = &tags[(size_t) set_of(line) * ways];
+    uint64_t tag = line + 1;
+    uint32_t w;
+
+    accesses++;
+    for (w = 0; w < ways; w++) {
+        if (set[w] == tag)
+            break;
+    }
+
+    bool hit = (w < ways);
+    if (!hit) {
+        // evict the LRU way
+        misses++;
+        w = ways - 1;
+    }
+
+    // move to the MRU position
+    memmove(set + 1, set, w * sizeof(uint64_t));
+    set[0] = tag;
+    return hit;
+}
+
+bool dcache_t::init(const cache_level_config_t &l1_config, const cache_level_config_t *l2_config,
+                    uint32_t mem_latency) {
+    if (!l1.init(l1_config))
+        return false;
+    if (l2_config != NULL && !l2.init(*l2_config))
+        return false;
+
+    this->mem_latency = mem_latency;
+    return true;
+}
+
+uint32_t dcache_t::access(uint64_t addr) {
+    uint64_t line = addr >> DCACHE_LINE_BITS;
+
+    if (l1.access(line))
+        return l1.latency;
+    if (!l2.enabled())
+        return l1.latency + mem_latency;
+    if (l2.access(line))
+        return l1.latency + l2.latency;
+    return l1.latency + l2.latency + mem_latency;
+}
+
+void dcache_t::access_batch(const uint64_t *addr, const uint8_t *is_load, uint32_t *latency, size_t n) {
+    size_t i;
+
+    // pull in the L1 sets of the whole batch before walking them in order
+    for (i = 0; i < n; i++)
+        __builtin_prefetch(l1.set_tags(l1.set_of(addr[i] >> DCACHE_LINE_BITS)));
+
+    for (i = 0; i < n; i++) {
+        uint32_t lat = access(addr[i]);
+        if (is_load[i])
+            latency[i] = lat;
+    }
+}
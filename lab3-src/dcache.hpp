@@ -0,0 +1,68 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <string>
+#include "procsim.hpp"
+
+/*
+ * Optional L1/L2 data cache model
+ *
+ * Loads and stores look up the hierarchy in program order when they are
+ * fetched; the level that hits sets the execution latency of a load.
+ * Both levels are write-allocate with true LRU replacement. Each set is a
+ * packed array of line tags kept in MRU order, so a lookup scans a few
+ * adjacent words and an LRU update is a short memmove.
+ */
+
+#define DCACHE_LINE_BITS 6
+
+struct cache_level_config_t {
+    uint64_t size;
+    uint32_t ways;
+    uint32_t latency;
+};
+
+// parses SIZE:WAYS:LATENCY, SIZE may carry a k or m suffix
+bool parse_cache_level(const char *arg, cache_level_config_t *config);
+
+class cache_level_t {
+public:
+    cache_level_t() : latency(0), accesses(0), misses(0), sets(0), ways(0) { }
+
+    bool init(const cache_level_config_t &config);
+
+    bool enabled() const { return sets != 0; }
+    uint32_t set_of(uint64_t line) const { return line & (sets - 1); }
+    const uint64_t *set_tags(uint32_t set) const { return &tags[(size_t) set * ways]; }
+
+    // looks up a line, filling it on a miss. returns true on a hit
+    bool access(uint64_t line);
+
+    uint32_t latency;
+    uint64_t accesses;
+    uint64_t misses;
+
+private:
+    uint32_t sets;
+    uint32_t ways;
+    // sets * ways tags, line + 1 so 0 marks an empty way, MRU first
+    std::vector<uint64_t> tags;
+};
+
+class dcache_t {
+public:
+    bool init(const cache_level_config_t &l1_config, const cache_level_config_t *l2_config,
+              uint32_t mem_latency);
+
+    // latency of one access, updating the cache state
+    uint32_t access(uint64_t addr);
+
+    // looks up n accesses in order. latency[i] is set for loads only
+    void access_batch(const uint64_t *addr, const uint8_t *is_load, uint32_t *latency, size_t n);
+
+    cache_level_t l1;
+    cache_level_t l2;
+    uint32_t mem_latency;
+};
+
+#endif /* DCACHE_H */
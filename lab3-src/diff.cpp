@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <string.h>
+#include <sstream>
+#include "procsim_driver.hpp"
+#include "trace_source.hpp"
+#include "fused.hpp"
+#include "flight.hpp"
+
+extern trace_source_t* trace_src;
+
+// instructions the fused engine retired in the current cycle
+struct diff_retired_t {
+    std::vector<std::pair<uint32_t, inst_timing_t> > insts;
+};
+
+static void collect_retired(void *arg, uint32_t id, const inst_timing_t &timing) {
+    ((diff_retired_t *) arg)->insts.push_back(std::make_pair(id, timing));
+}
+
+static bool same_timing(const inst_timing_t &a, const inst_timing_t &b) {
+    return a.cycle_fetch_decode == b.cycle_fetch_decode && a.cycle_dispatch == b.cycle_dispatch &&
+           a.cycle_schedule == b.cycle_schedule && a.cycle_execute == b.cycle_execute &&
+           a.cycle_status_update == b.cycle_status_update;
+}
+
+// name of the first proc_stats_t field that differs, NULL if they agree
+static const char *stats_difference(const proc_stats_t &a, const proc_stats_t &b) {
+#define DIFF_FIELD(name) if (a.name != b.name) return #name
+    DIFF_FIELD(retired_instruction);
+    DIFF_FIELD(cycle_count);
+    DIFF_FIELD(avg_inst_retired);
+    DIFF_FIELD(max_disp_size);
+    DIFF_FIELD(sum_disp_size);
+    DIFF_FIELD(avg_disp_size);
+    DIFF_FIELD(l1_accesses);
+    DIFF_FIELD(l1_misses);
+    DIFF_FIELD(l2_accesses);
+    DIFF_FIELD(l2_misses);
+    DIFF_FIELD(branches);
+    DIFF_FIELD(mispredictions);
+    DIFF_FIELD(fetch_stall_cycles);
+#undef DIFF_FIELD
+    return NULL;
+}
+
+static void print_stats_row(const char *engine, const proc_stats_t &st) {
+    printf("%s\t%lu\t%lu\t%lu\t%f\t%lu\t%lu\t%lu\t%lu\t%lu\n", engine,
+           st.retired_instruction, st.cycle_count, st.max_disp_size, st.sum_disp_size,
+           st.l1_misses, st.l2_misses, st.branches, st.mispredictions, st.fetch_stall_cycles);
+}
+
+static void print_divergence(const proc_stats_t &stage_stats, const proc_stats_t &fused_stats,
+                             const fused_core_t &core) {
+    printf("ENGINE\tINSTS\tCYCLES\tMAX_DISP\tSUM_DISP\tL1_MISS\tL2_MISS\tBRANCHES\tMISPRED\tSTALLS\n");
+    print_stats_row("stage", stage_stats);
+    print_stats_row("fused", fused_stats);
+
+    std::ostringstream state;
+    state << "\nStage engine state:\n";
+    dump_proc_state(state);
+    state << "\nFused engine state:\n";
+    core.dump_state(state);
+    fputs(state.str().c_str(), stdout);
+}
+
+static void print_timing_row(const char *engine, uint32_t id, uint64_t fetch, uint64_t disp,
+                             uint64_t sched, uint64_t exec, uint64_t state) {
+    printf("%s\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+           engine, id, fetch, disp, sched, exec, state);
+}
+
+// both recorders go into one trace so the engines line up side by side
+static void dump_flights(const flight_recorder_t &stage_flight, const flight_recorder_t &fused_flight) {
+    const flight_recorder_t *recorders[2] = { &stage_flight, &fused_flight };
+
+    if (flight_write(stage_flight.path().c_str(), recorders, 2))
+        fprintf(stderr, "Flight recorder: %zu + %zu events written to %s\n", stage_flight.size(),
+                fused_flight.size(), stage_flight.path().c_str());
+    else
+        fprintf(stderr, "Flight recorder: unable to write %s\n", stage_flight.path().c_str());
+}
+
+int run_diff(const char *filename, proc_stats_t *p_stats) {
+    trace_src = open_trace(filename);
+    trace_source_t *fused_src = open_trace(filename);
+    if (trace_src == NULL || fused_src == NULL) {
+        delete trace_src;
+        delete fused_src;
+        trace_src = NULL;
+        return 1;
+    }
+    if (sim_opts.skip > 0) {
+        uint64_t skipped = trace_src->skip(sim_opts.skip);
+        fused_src->skip(sim_opts.skip);
+        printf("Skipped %" PRIu64 " instructions\n", skipped);
+    }
+
+    print_settings();
+
+    // each engine gets its own copy of every stateful model
+    dcache_t stage_dcache;
+    dcache_t fused_dcache;
+    if (sim_opts.l1.size) {
+        const cache_level_config_t *l2 = sim_opts.l2.size ? &sim_opts.l2 : NULL;
+        if (!stage_dcache.init(sim_opts.l1, l2, sim_opts.mem_latency) ||
+            !fused_dcache.init(sim_opts.l1, l2, sim_opts.mem_latency)) {
+            fprintf(stderr, "Cache sizes must be a power of two number of sets of 64 byte lines\n");
+            delete trace_src;
+            delete fused_src;
+            trace_src = NULL;
+            return 1;
+        }
+        proc_dcache = &stage_dcache;
+    }
+    proc_bpred = create_bpred(sim_opts.bpred, sim_opts.bpred_bits);
+    bpred_t *fused_bpred = create_bpred(sim_opts.bpred, sim_opts.bpred_bits);
+
+    proc_stats_t fused_stats;
+    memset(p_stats, 0, sizeof(proc_stats_t));
+    memset(&fused_stats, 0, sizeof(proc_stats_t));
+
+    diff_retired_t retired;
+    fused_core_t core(fused_src, sim_opts.l1.size ? &fused_dcache : NULL, fused_bpred);
+    core.on_retire = collect_retired;
+    core.on_retire_arg = &retired;
+
+    flight_recorder_t stage_flight;
+    flight_recorder_t fused_flight;
+    std::string flight_path = sim_opts.flight_path ? sim_opts.flight_path : flight_default_path();
+    bool flight = sim_opts.flight;
+    unsigned flight_seen = flight_requests.load();
+    if (flight) {
+        stage_flight.init(sim_opts.flight_events, flight_path, "stage engine", sim_max_latency(sim_opts));
+        fused_flight.init(sim_opts.flight_events, flight_path, "fused engine", sim_max_latency(sim_opts));
+        proc_flight = &stage_flight;
+        core.flight = &fused_flight;
+    }
+
+    setup_proc(p_stats, sim_opts.r, sim_opts.k0, sim_opts.k1, sim_opts.k2, sim_opts.f,
+               sim_opts.begin_dump, sim_opts.end_dump);
+    core.setup(&fused_stats, sim_opts.r, sim_opts.k0, sim_opts.k1, sim_opts.k2, sim_opts.f,
+               sim_opts.begin_dump, sim_opts.end_dump);
+
+    /* Run both engines one cycle at a time */
+    bool diverged = false;
+    bool stage_running = true;
+    bool fused_running = true;
+
+    while (stage_running && !diverged) {
+        uint64_t cycle = p_stats->cycle_count;
+
+        retired.insts.clear();
+        stage_running = step_proc(p_stats);
+        fused_running = core.step(&fused_stats);
+
+        // every instruction the fused engine retired must have left the
+        // stage engine in the same cycle with the same timestamps
+        for (auto &r : retired.insts) {
+            const inst_timing_t *p = proc_timing(r.first);
+            const inst_timing_t &t = r.second;
+
+            if (p != NULL && same_timing(*p, t))
+                continue;
+
+            printf("Divergence in cycle %" PRIu64 ": instruction %u timing differs\n", cycle, r.first);
+            printf("ENGINE\tINST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
+            if (p != NULL)
+                print_timing_row("stage", r.first, p->cycle_fetch_decode, p->cycle_dispatch,
+                                 p->cycle_schedule, p->cycle_execute, p->cycle_status_update);
+            else
+                printf("stage\t%u\tnot fetched\n", r.first);
+            print_timing_row("fused", r.first, t.cycle_fetch_decode, t.cycle_dispatch,
+                             t.cycle_schedule, t.cycle_execute, t.cycle_status_update);
+            diverged = true;
+            break;
+        }
+
+        const char *field = stats_difference(*p_stats, fused_stats);
+        if (!diverged && (field != NULL || stage_running != fused_running)) {
+            printf("Divergence in cycle %" PRIu64 ": %s differs\n", cycle,
+                   field != NULL ? field : "end of simulation");
+            diverged = true;
+        }
+
+        if (flight && (diverged || flight_requests.load() != flight_seen)) {
+            flight_seen = flight_requests.load();
+            dump_flights(stage_flight, fused_flight);
+        }
+        if (diverged)
+            print_divergence(*p_stats, fused_stats, core);
+    }
+
+    /* Finalize stats, a trace that failed to read agrees on nothing */
+    bool trace_failed = !diverged &&
+        (trace_read_failed(trace_src, p_stats->retired_instruction, filename) ||
+         trace_read_failed(fused_src, fused_stats.retired_instruction, filename));
+    if (!diverged && !trace_failed) {
+        complete_proc(p_stats);
+        core.complete(&fused_stats);
+
+        const char *field = stats_difference(*p_stats, fused_stats);
+        if (field != NULL) {
+            printf("Divergence in final statistics: %s differs\n", field);
+            if (flight)
+                dump_flights(stage_flight, fused_flight);
+            print_divergence(*p_stats, fused_stats, core);
+            diverged = true;
+        } else {
+            printf("Engines agree on %lu instructions over %lu cycles\n\n",
+                   p_stats->retired_instruction, p_stats->cycle_count);
+            print_statistics(p_stats);
+            if (flight && sim_opts.flight_path != NULL)
+                dump_flights(stage_flight, fused_flight);
+        }
+    }
+
+    proc_flight = NULL;
+
+    proc_dcache = NULL;
+    delete proc_bpred;
+    proc_bpred = NULL;
+    delete fused_bpred;
+    delete trace_src;
+    trace_src = NULL;
+    delete fused_src;
+
+    return diverged || trace_failed ? 1 : 0;
+}
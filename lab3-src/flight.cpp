@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <signal.h>
+#include <unistd.h>
+#include "flight.hpp"
+
+std::atomic<unsigned> flight_requests(0);
+flight_recorder_t *proc_flight = NULL;
+
+static const char *flight_kind_names[FLIGHT_KINDS] = { "fetch", "dispatch", "fire", "cdb", "retire" };
+
+static void flight_signal(int) {
+    flight_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+void flight_install_signal() {
+    struct sigaction sa;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = flight_signal;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+std::string flight_default_path() {
+    return "procsim-flight-" + std::to_string((long long) getpid()) + ".json";
+}
+
+void flight_recorder_t::init(size_t events, const std::string &path, const std::string &name,
+                             uint64_t max_latency) {
+    size_t n = 1;
+    while (n < (events ? events : FLIGHT_RETIRE_SLOTS))
+        n <<= 1;
+
+    ring.assign(events ? n : 0, flight_event_t());
+    retired.assign(events ? 0 : n, flight_retire_t());
+    slots = events ? NULL : retired.data();
+    mask = n - 1;
+    head = 0;
+    dump_path = path;
+    dump_name = name;
+    seen_requests = flight_requests.load();
+    last_retired = 0;
+    last_progress = 0;
+    stall_cycles = FLIGHT_STALL_CYCLES + max_latency;
+}
+
+size_t flight_recorder_t::size() const {
+    return ring.empty() ? entries() * FLIGHT_KINDS : entries();
+}
+
+flight_event_t flight_recorder_t::event(size_t i) const {
+    if (!ring.empty())
+        return ring[(head - entries() + i) & mask];
+
+    const flight_retire_t &r = retired[(head - entries() + i / FLIGHT_KINDS) & mask];
+    flight_event_t e;
+    e.kind = i % FLIGHT_KINDS;
+    e.cycle = r.fetch + (e.kind == FLIGHT_FETCH ? 0 : r.after[e.kind - 1]);
+    e.tag = r.tag;
+    e.op_code = r.op_code;
+    e.reserved = 0;
+    return e;
+}
+
+bool flight_recorder_t::dump() const {
+    const flight_recorder_t *self = this;
+    bool ok = flight_write(dump_path.c_str(), &self, 1);
+
+    if (ok)
+        fprintf(stderr, "Flight recorder: %zu events written to %s\n", size(), dump_path.c_str());
+    else
+        fprintf(stderr, "Flight recorder: unable to write %s\n", dump_path.c_str());
+    return ok;
+}
+
+void flight_recorder_t::stalled(const proc_stats_t *p_stats) {
+    fprintf(stderr, "Invariant failed: no instruction retired in cycles %" PRIu64 "-%" PRIu64 " (%s)\n",
+            last_progress, (uint64_t) p_stats->cycle_count, dump_name.c_str());
+    dump();
+    exit(1);
+}
+
+// one track per event kind; a cycle is shown as a microsecond
+bool flight_write(const char *path, const flight_recorder_t *const *recorders, size_t n) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return false;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"time unit\":\"1 us = 1 cycle\"},\"traceEvents\":[\n");
+    for (size_t p = 0; p < n; p++) {
+        const flight_recorder_t &fr = *recorders[p];
+
+        fprintf(fp, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                p ? ",\n" : "", p, fr.name().c_str());
+        for (int k = 0; k < FLIGHT_KINDS; k++) {
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%zu,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    p, k, flight_kind_names[k]);
+            fprintf(fp, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%zu,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+                    p, k, k);
+        }
+
+        for (size_t i = 0; i < fr.size(); i++) {
+            flight_event_t e = fr.event(i);
+            fprintf(fp, ",\n{\"name\":\"%u\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%zu,\"tid\":%u,"
+                        "\"ts\":%" PRIu64 ",\"args\":{\"tag\":%u,\"class\":%u}}",
+                    e.tag, flight_kind_names[e.kind], p, e.kind, e.cycle, e.tag, e.op_code);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    return fclose(fp) == 0;
+}
@@ -0,0 +1,157 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <atomic>
+#include <string>
+#include "procsim.hpp"
+#include "mem_stats.hpp"
+
+/*
+ * Flight recorder
+ *
+ * Every engine keeps its last pipeline events (fetch, dispatch, fire, cdb
+ * broadcast, retire) in a fixed size ring that is always recording, without
+ * locks, overwriting the oldest. By default a retiring instruction fills
+ * one 32 byte slot with all five of its cycles, a store per instruction
+ * instead of one per event; instructions still in flight are not in the
+ * ring. --flight-events=N records every event as it happens, in a ring of
+ * N 16 byte events, for a look at what the pipeline holds. --no-flight
+ * turns the recorder off.
+ * The ring is written out as a Chrome trace (chrome://tracing, Perfetto)
+ * at the end of a run when --flight=FILE asks for it, on SIGUSR1, and
+ * when an invariant fails: the engines of a differential run diverge, or
+ * no instruction retires for FLIGHT_STALL_CYCLES cycles past the longest
+ * memory latency.
+ */
+
+#define FLIGHT_RETIRE_SLOTS 16384
+#define FLIGHT_STALL_CYCLES 1000000
+
+enum flight_kind_t {
+    FLIGHT_FETCH,
+    FLIGHT_DISPATCH,
+    FLIGHT_FIRE,
+    FLIGHT_CDB,
+    FLIGHT_RETIRE,
+    FLIGHT_KINDS
+};
+
+struct flight_event_t {
+    uint64_t cycle;
+    uint32_t tag;
+    uint8_t kind;
+    uint8_t op_code;
+    uint16_t reserved;
+};
+
+// an instruction as it retires, the later cycles relative to the fetch
+struct flight_retire_t {
+    uint64_t fetch;
+    uint32_t tag;
+    uint32_t after[FLIGHT_KINDS - 1];   // dispatch, fire, cdb, retire
+    uint8_t op_code;
+};
+
+// bumped by the SIGUSR1 handler, every recorder dumps once per request
+extern std::atomic<unsigned> flight_requests;
+
+// dump on SIGUSR1
+void flight_install_signal();
+
+class flight_recorder_t {
+public:
+    flight_recorder_t() : slots(NULL), mask(0), head(0) { }
+
+    // keep the last events pipeline events (rounded up to a power of two),
+    // or with events 0 a slot for each of the last FLIGHT_RETIRE_SLOTS
+    // retired instructions; dumping to path under the given name
+    // max_latency is the longest an instruction can take to execute, the
+    // watchdog allows FLIGHT_STALL_CYCLES on top of it
+    void init(size_t events, const std::string &path, const std::string &name, uint64_t max_latency);
+
+    // the engines only call record() when it is true
+    bool every_event() const { return slots == NULL; }
+
+    void record(flight_kind_t kind, uint32_t tag, uint64_t cycle, uint8_t op_code) {
+        flight_event_t &e = ring[head & mask];
+        e.cycle = cycle;
+        e.tag = tag;
+        e.kind = kind;
+        e.op_code = op_code;
+        head++;
+    }
+
+    // an instruction leaves the pipeline in cycle, t holds its earlier
+    // cycles with the dispatch one cycle before the schedule
+    void retire(uint32_t tag, uint8_t op_code, const inst_timing_t &t, uint64_t fire, uint64_t cycle) {
+        if (slots == NULL) {
+            record(FLIGHT_RETIRE, tag, cycle, op_code);
+            return;
+        }
+        flight_retire_t &r = slots[head & mask];
+        r.fetch = t.cycle_fetch_decode;
+        r.tag = tag;
+        r.after[0] = t.cycle_schedule - 1 - t.cycle_fetch_decode;
+        r.after[1] = fire - t.cycle_fetch_decode;
+        r.after[2] = t.cycle_execute - t.cycle_fetch_decode;
+        r.after[3] = cycle - t.cycle_fetch_decode;
+        r.op_code = op_code;
+        head++;
+    }
+
+    // once per cycle from the run loops: serve dump requests and make sure
+    // the pipeline still retires instructions
+    void poll(const proc_stats_t *p_stats) {
+        if (p_stats->retired_instruction != last_retired) {
+            last_retired = p_stats->retired_instruction;
+            last_progress = p_stats->cycle_count;
+        } else if (p_stats->cycle_count - last_progress > stall_cycles) {
+            stalled(p_stats);
+        }
+
+        if (flight_requests.load(std::memory_order_relaxed) != seen_requests) {
+            seen_requests = flight_requests.load(std::memory_order_relaxed);
+            dump();
+        }
+    }
+
+    // write the ring to its file, true on success
+    bool dump() const;
+
+    // events in the ring, oldest first; a retired instruction makes one of
+    // every kind
+    size_t size() const;
+    flight_event_t event(size_t i) const;
+
+    const std::string &path() const { return dump_path; }
+    const std::string &name() const { return dump_name; }
+
+private:
+    void stalled(const proc_stats_t *p_stats);
+
+    size_t entries() const { return head <= mask ? head : mask + 1; }
+
+    mem_vector_t<flight_event_t, MEM_OUTPUT> ring;
+    mem_vector_t<flight_retire_t, MEM_OUTPUT> retired;
+    flight_retire_t *slots;     // retired.data(), NULL when keeping every event
+    uint64_t mask;
+    uint64_t head;
+
+    std::string dump_path;
+    std::string dump_name;
+    unsigned seen_requests;
+    uint64_t last_retired;
+    uint64_t last_progress;
+    uint64_t stall_cycles;
+};
+
+// write several recorders into one Chrome trace file, one process each
+bool flight_write(const char *path, const flight_recorder_t *const *recorders, size_t n);
+
+// file a recorder dumps to when --flight doesn't name one
+std::string flight_default_path();
+
+// recorder of the stage engine, NULL when disabled
+extern flight_recorder_t *proc_flight;
+
+#endif /* FLIGHT_H */
@@ -0,0 +1,403 @@
+#include "fused.hpp"
+#include "dcache.hpp"
+#include "bpred.hpp"
+#include "metrics.hpp"
+#include "flight.hpp"
+
+template <class select_t, class cdb_t>
+policy_core_t<select_t, cdb_t>::policy_core_t(trace_source_t *src, dcache_t *dcache, bpred_t *bpred,
+                                              const policy_config_t &policy)
+    : on_retire(NULL), on_retire_arg(NULL), metrics(NULL), flight(NULL), src(src), dcache(dcache), bpred(bpred),
+      flight_stages(NULL) {
+    select_policy.init(policy);
+    cdb_policy.init(policy);
+}
+
+template <class select_t, class cdb_t>
+void policy_core_t<select_t, cdb_t>::setup(proc_stats_t *p_stats, uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2,
+                                           uint64_t f, uint64_t begin_dump, uint64_t end_dump) {
+    p_stats->retired_instruction = 0;
+    p_stats->cycle_count = 1;
+
+    this->r = r;
+    this->f = f;
+    this->begin_dump = begin_dump;
+    this->end_dump = end_dump;
+    flight_stages = (flight != NULL && flight->every_event()) ? flight : NULL;
+
+    read_cnt = 0;
+    read_finished = (src == NULL);
+    decoder.reset(src);
+    done = false;
+    redirect_id = 0;
+    redirect_resolved = false;
+
+    n_window = 0;
+    window_limit = 2 * (k0 + k1 + k2);
+    window.resize(window_limit);
+    window_timing.resize(window_limit);
+    dispatch_queue.clear();
+
+    cdb_tags.resize(r);
+    cdb_slots.resize(window_limit);
+    fire_slots.resize(window_limit);
+    fu_free[0] = k0;
+    fu_free[1] = k1;
+    fu_free[2] = k2;
+
+    // registers past the first 64 start out busy, as in the stage engine
+    for (int i = 0; i < FUSED_NUM_REGS; i++) {
+        reg_ready[i] = (i < 64);
+        reg_tag[i] = 0;
+    }
+
+    dump.clear();
+}
+
+template <class select_t, class cdb_t>
+void policy_core_t<select_t, cdb_t>::complete(proc_stats_t *p_stats) {
+    if (dcache != NULL) {
+        p_stats->l1_accesses = dcache->l1.accesses;
+        p_stats->l1_misses = dcache->l1.misses;
+        p_stats->l2_accesses = dcache->l2.accesses;
+        p_stats->l2_misses = dcache->l2.misses;
+    }
+    p_stats->avg_disp_size = p_stats->sum_disp_size / p_stats->cycle_count;
+    p_stats->avg_inst_retired = p_stats->retired_instruction * 1.f / p_stats->cycle_count; 
+}
+
+template <class select_t, class cdb_t>
+void policy_core_t<select_t, cdb_t>::run(proc_stats_t *p_stats) {
+    while (step(p_stats)) {
+        if (metrics != NULL && metrics->due())
+            metrics->publish(p_stats, read_cnt, dispatch_queue.size(), n_window);
+        if (flight != NULL)
+            flight->poll(p_stats);
+    }
+
+    if (begin_dump > 0)
+        print_timing(std::cout);
+}
+
+template <class select_t, class cdb_t>
+void policy_core_t<select_t, cdb_t>::print_timing(std::ostream &os) const {
+    os << "INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n";
+    for (size_t i = 0; i < dump.size(); i++) {
+        const inst_timing_t &t = dump[i];
+        os << begin_dump + i << "\t"
+           << t.cycle_fetch_decode << "\t"
+           << t.cycle_dispatch << "\t"
+           << t.cycle_schedule << "\t"
+           << t.cycle_execute << "\t"
+           << t.cycle_status_update << "\n";
+    }
+    os << std::endl;
+}
+
+template <class select_t, class cdb_t>
+void policy_core_t<select_t, cdb_t>::dump_state(std::ostream &os) const {
+    os << "dispatch queue: " << dispatch_queue.size()
+       << " scheduling queue: " << n_window
+       << " fetched: " << read_cnt << "\n";
+
+    // registers never written since setup have no tag, leave them out
+    os << "busy registers:";
+    for (int i = 0; i < FUSED_NUM_REGS; i++) {
+        if (!reg_ready[i] && reg_tag[i])
+            os << " r" << i << "=" << reg_tag[i];
+    }
+    os << "\n";
+
+    os << "INST\tOP\tTAG0\tTAG1\tFLAGS\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n";
+    for (size_t i = 0; i < n_window; i++) {
+        const fused_entry_t &e = window[i];
+        const inst_timing_t &t = window_timing[i];
+        os << e.id << "\t" << (int) e.op_code << "\t"
+           << e.src_tag[0] << "\t" << e.src_tag[1] << "\t"
+           << (e.flags & FUSED_SRC0_READY ? '0' : '-') << (e.flags & FUSED_SRC1_READY ? '1' : '-')
+           << (e.flags & FUSED_FIRE ? 'm' : '-') << (e.flags & FUSED_FIRED ? 'f' : '-')
+           << (e.flags & FUSED_EXECUTED ? 'x' : '-') << "\t"
+           << t.cycle_fetch_decode << "\t" << t.cycle_dispatch << "\t"
+           << t.cycle_schedule << "\t" << t.cycle_execute << "\t"
+           << t.cycle_status_update << "\n";
+    }
+}
+
+template <class select_t, class cdb_t>
+void policy_core_t<select_t, cdb_t>::retire(size_t slot) {
+    uint32_t id = window[slot].id;
+
+    if (begin_dump > 0 && id >= begin_dump && id <= end_dump) {
+        size_t i = id - begin_dump;
+        if (i >= dump.size())
+            dump.resize(i + 1);
+        dump[i] = window_timing[slot];
+    }
+
+    if (on_retire != NULL)
+        on_retire(on_retire_arg, id, window_timing[slot]);
+}
+
+// put the result of the instruction in slot on a cdb
+template <class select_t, class cdb_t>
+inline void policy_core_t<select_t, cdb_t>::write_back(size_t slot, uint64_t c, size_t &cdb_used) {
+    fused_entry_t &e = window[slot];
+
+    cdb_tags[cdb_used++] = e.id;
+    if (e.dest_reg >= 0) {
+        reg_ready[e.dest_reg] = true;
+        reg_tag[e.dest_reg] = 0;
+    }
+    e.flags |= FUSED_EXECUTED;
+    window_timing[slot].cycle_execute = c;
+    if (flight_stages != NULL)
+        flight_stages->record(FLIGHT_CDB, e.id, c, e.op_code);
+    fu_free[e.op_code]++;
+
+    if (e.id == redirect_id)
+        redirect_resolved = true;
+}
+
+// start executing e on a function unit of its class
+template <class select_t, class cdb_t>
+inline void policy_core_t<select_t, cdb_t>::fire(fused_entry_t &e, uint64_t c) {
+    fu_free[e.op_code]--;
+    e.flags |= FUSED_FIRED;
+    e.cycle_ready = c + e.latency;
+    if (flight_stages != NULL)
+        flight_stages->record(FLIGHT_FIRE, e.id, c, e.op_code);
+}
+
+template <class select_t, class cdb_t>
+bool policy_core_t<select_t, cdb_t>::step(proc_stats_t *p_stats) {
+    uint64_t c = p_stats->cycle_count;
+    size_t cdb_used = 0;
+    size_t n_cdb_slots = 0;
+    size_t n_fire_slots = 0;
+    size_t i;
+
+    if (done)
+        return false;
+
+    /* first half: state update, execute, schedule */
+    for (i = 0; i < n_window; i++) {
+        fused_entry_t &e = window[i];
+        inst_timing_t &t = window_timing[i];
+
+        if ((e.flags & (FUSED_EXECUTED | FUSED_RETIRING)) == FUSED_EXECUTED) {
+            e.flags |= FUSED_RETIRING;
+            t.cycle_status_update = c;
+        }
+
+        // fired instructions go out on a free cdb, in queue order unless
+        // the cdb policy arbitrates once they are all known
+        if ((e.flags & (FUSED_FIRED | FUSED_EXECUTED)) == FUSED_FIRED && c >= e.cycle_ready) {
+            if (!cdb_t::in_order)
+                cdb_slots[n_cdb_slots++] = i;
+            else if (cdb_used < r)
+                write_back(i, c, cdb_used);
+        }
+
+        if (!(e.flags & FUSED_FIRE)) {
+            if (!t.cycle_schedule)
+                t.cycle_schedule = c;
+            if ((e.flags & (FUSED_SRC0_READY | FUSED_SRC1_READY)) == (FUSED_SRC0_READY | FUSED_SRC1_READY))
+                e.flags |= FUSED_FIRE;
+        }
+    }
+
+    if (!cdb_t::in_order) {
+        size_t n = cdb_policy.grant(cdb_slots.data(), n_cdb_slots, window.data(), r);
+        for (size_t k = 0; k < n; k++)
+            write_back(cdb_slots[k], c, cdb_used);
+    }
+
+    /* first half: dispatch reserves the free scheduling queue slots */
+    uint64_t dq_size = dispatch_queue.size();
+    if (p_stats->max_disp_size < dq_size)
+        p_stats->max_disp_size = dq_size;
+    p_stats->sum_disp_size += dq_size;
+
+    uint64_t n_dispatch = window_limit - n_window;
+    if (n_dispatch > dq_size)
+        n_dispatch = dq_size;
+
+    /* second half: retire, cdb wake-up, fire */
+    size_t kept = 0;
+    for (i = 0; i < n_window; i++) {
+        if (window[i].flags & FUSED_RETIRING) {
+            if (flight != NULL)
+                flight->retire(window[i].id, window[i].op_code, window_timing[i],
+                               window[i].cycle_ready - window[i].latency, c);
+            retire(i);
+            p_stats->retired_instruction++;
+            continue;
+        }
+
+        fused_entry_t e = window[i];
+        for (size_t k = 0; k < cdb_used; k++) {
+            if (!(e.flags & FUSED_SRC0_READY) && e.src_tag[0] == cdb_tags[k]) {
+                e.src_tag[0] = 0;
+                e.flags |= FUSED_SRC0_READY;
+            }
+            if (!(e.flags & FUSED_SRC1_READY) && e.src_tag[1] == cdb_tags[k]) {
+                e.src_tag[1] = 0;
+                e.flags |= FUSED_SRC1_READY;
+            }
+        }
+
+        if ((e.flags & (FUSED_FIRE | FUSED_FIRED)) == FUSED_FIRE) {
+            if (!select_t::in_order)
+                fire_slots[n_fire_slots++] = kept;
+            else if (fu_free[e.op_code])
+                fire(e, c);
+        }
+
+        window[kept] = e;
+        if (kept != i)
+            window_timing[kept] = window_timing[i];
+        kept++;
+    }
+    n_window = kept;
+
+    if (!select_t::in_order) {
+        select_policy.order(fire_slots.data(), n_fire_slots);
+        for (size_t k = 0; k < n_fire_slots; k++) {
+            fused_entry_t &e = window[fire_slots[k]];
+            if (fu_free[e.op_code])
+                fire(e, c);
+        }
+    }
+
+    // nothing left in flight, the last cycle ends here
+    if (read_finished && p_stats->retired_instruction == read_cnt) {
+        done = true;
+        return false;
+    }
+
+    /* second half: dispatch, fetch */
+    dispatch(n_dispatch, c);
+    fetch(p_stats);
+
+    p_stats->cycle_count++;
+    return true;
+}
+
+template <class select_t, class cdb_t>
+void policy_core_t<select_t, cdb_t>::dispatch(uint64_t n, uint64_t cycle) {
+    for (uint64_t k = 0; k < n; k++) {
+        const fused_fetched_t &d = dispatch_queue.front();
+        fused_entry_t &e = window[n_window];
+        inst_timing_t &t = window_timing[n_window];
+        n_window++;
+
+        e.id = d.id;
+        e.latency = d.latency;
+        e.cycle_ready = 0;
+        e.dest_reg = d.dest_reg;
+        e.op_code = d.op_code;
+        e.flags = 0;
+
+        // sources read the register file before the destination is claimed
+        for (int s = 0; s < 2; s++) {
+            int16_t reg = d.src_reg[s];
+            if (reg != -1 && !reg_ready[reg]) {
+                e.src_tag[s] = reg_tag[reg];
+            } else {
+                e.src_tag[s] = 0;
+                e.flags |= (s == 0) ? FUSED_SRC0_READY : FUSED_SRC1_READY;
+            }
+        }
+        if (d.dest_reg != -1) {
+            reg_ready[d.dest_reg] = false;
+            reg_tag[d.dest_reg] = d.id;
+        }
+
+        t.cycle_fetch_decode = d.cycle_fetch;
+        t.cycle_dispatch = d.cycle_fetch + 1;
+        t.cycle_schedule = 0;
+        t.cycle_execute = 0;
+        t.cycle_status_update = 0;
+
+        if (flight_stages != NULL)
+            flight_stages->record(FLIGHT_DISPATCH, d.id, cycle, d.op_code);
+        dispatch_queue.pop_front();
+    }
+}
+
+template <class select_t, class cdb_t>
+void policy_core_t<select_t, cdb_t>::fetch(proc_stats_t *p_stats) {
+    // a mispredicted branch blocks fetch until it executes
+    if (redirect_id) {
+        if (!redirect_resolved) {
+            p_stats->fetch_stall_cycles++;
+            return;
+        }
+        redirect_id = 0;
+    }
+
+    if (read_finished)
+        return;
+
+    group_addr.clear();
+    group_is_load.clear();
+    group_slot.clear();
+
+    const decoded_batch_t &b = decoder.batch();
+    for (uint64_t i = 0; i < f; i++) {
+        size_t k;
+        if (!decoder.next(&k)) {
+            read_finished = true;
+            break;
+        }
+
+        fused_fetched_t d;
+        d.id = read_cnt + 1;
+        d.latency = 1;
+        d.cycle_fetch = p_stats->cycle_count;
+        d.op_code = b.op_code[k];
+        d.dest_reg = b.dest_reg[k];
+        d.src_reg[0] = b.src_reg[0][k];
+        d.src_reg[1] = b.src_reg[1][k];
+
+        if (dcache != NULL && (b.mem_read[k] || b.mem_write[k])) {
+            group_addr.push_back(b.mem_addr[k]);
+            group_is_load.push_back(b.mem_read[k]);
+            group_slot.push_back(dispatch_queue.size());
+        }
+
+        dispatch_queue.push_back(d);
+        read_cnt++;
+        if (flight_stages != NULL)
+            flight_stages->record(FLIGHT_FETCH, d.id, d.cycle_fetch, d.op_code);
+
+        if (bpred != NULL && d.op_code == 2) {
+            bool taken = b.br_taken[k];
+            p_stats->branches++;
+            // predicted on the 32 bit address the stage engine keeps
+            if (bpred->predict_update(b.inst_addr[k], taken) != taken) {
+                p_stats->mispredictions++;
+                redirect_id = d.id;
+                redirect_resolved = false;
+                break;
+            }
+        }
+    }
+
+    if (!group_addr.empty()) {
+        group_latency.assign(group_addr.size(), 1);
+        dcache->access_batch(group_addr.data(), group_is_load.data(), group_latency.data(), group_addr.size());
+        for (size_t k = 0; k < group_slot.size(); k++)
+            dispatch_queue[group_slot[k]].latency = group_latency[k];
+    }
+}
+
+// the policy pairs the driver can pick at run time
+template class policy_core_t<select_oldest_t, cdb_oldest_t>;
+template class policy_core_t<select_oldest_t, cdb_class_t>;
+template class policy_core_t<select_oldest_t, cdb_random_t>;
+template class policy_core_t<select_oldest_t, cdb_ports_t>;
+template class policy_core_t<select_random_t, cdb_oldest_t>;
+template class policy_core_t<select_random_t, cdb_class_t>;
+template class policy_core_t<select_random_t, cdb_random_t>;
+template class policy_core_t<select_random_t, cdb_ports_t>;
@@ -0,0 +1,159 @@
+#ifndef FUSED_H
+#define FUSED_H
+
+#include "procsim.hpp"
+#include "trace_source.hpp"
+#include "trace_decode.hpp"
+#include "policy.hpp"
+#include "mem_stats.hpp"
+
+/*
+ * Fused cycle engine
+ *
+ * Produces the same timing as the stage functions in procsim.cpp, but
+ * walks the scheduling queue twice per cycle instead of eight times:
+ *
+ *   pass 1 (first half)  - state update, execute and schedule marking
+ *   pass 2 (second half) - retirement, cdb wake-up and firing, compacting
+ *                          the window in place
+ *
+ * followed by dispatch from the front of the dispatch queue and fetch.
+ * The scheduling queue is a fixed array of packed entries in dispatch
+ * order with the timestamps kept in a parallel cold array, the dispatch
+ * queue holds small decoded records, and the register file is a flat
+ * array instead of a hash map.
+ *
+ * The core is a template over the select and cdb policies of policy.hpp;
+ * fused_core_t is the oldest first pair.
+ */
+
+#define FUSED_NUM_REGS 256
+
+// a fetched instruction waiting in the dispatch queue
+struct fused_fetched_t {
+    uint32_t id;
+    uint32_t latency;
+    uint64_t cycle_fetch;
+    int16_t dest_reg;
+    int16_t src_reg[2];
+    uint8_t op_code;
+};
+
+// a scheduling queue entry: only what the pipeline looks at every cycle
+struct fused_entry_t {
+    uint32_t id;
+    uint32_t src_tag[2];
+    uint32_t latency;
+    uint64_t cycle_ready;
+    int16_t dest_reg;
+    uint8_t op_code;
+    uint8_t flags;
+};
+
+enum fused_flag_t {
+    FUSED_SRC0_READY = 1,
+    FUSED_SRC1_READY = 2,
+    FUSED_FIRE = 4,
+    FUSED_FIRED = 8,
+    FUSED_EXECUTED = 16,
+    FUSED_RETIRING = 32
+};
+
+class dcache_t;
+class bpred_t;
+class metrics_t;
+class flight_recorder_t;
+
+template <class select_t, class cdb_t>
+class policy_core_t {
+public:
+    policy_core_t(trace_source_t *src, dcache_t *dcache = NULL, bpred_t *bpred = NULL,
+                  const policy_config_t &policy = default_policy_config());
+
+    // same contract as setup_proc / run_proc / complete_proc
+    void setup(proc_stats_t *p_stats, uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f,
+               uint64_t begin_dump, uint64_t end_dump);
+    void run(proc_stats_t *p_stats);
+    void complete(proc_stats_t *p_stats);
+
+    // simulate one cycle, returns false once every instruction retired
+    bool step(proc_stats_t *p_stats);
+
+    // print the timing dump of [begin_dump, end_dump]
+    void print_timing(std::ostream &os) const;
+    // print the scheduling queue and busy registers
+    void dump_state(std::ostream &os) const;
+
+    bool finished() const { return done; }
+    size_t window_size() const { return n_window; }
+    size_t dispatch_queue_size() const { return dispatch_queue.size(); }
+    uint64_t fetched() const { return read_cnt; }
+
+    // called for every instruction as it leaves the scheduling queue
+    void (*on_retire)(void *arg, uint32_t id, const inst_timing_t &timing);
+    void *on_retire_arg;
+
+    // live metrics page run() publishes to, NULL if none
+    metrics_t *metrics;
+    // flight recorder of the pipeline events, NULL if none; set before setup()
+    flight_recorder_t *flight;
+
+private:
+    void fetch(proc_stats_t *p_stats);
+    void dispatch(uint64_t n, uint64_t cycle);
+    void retire(size_t slot);
+    void write_back(size_t slot, uint64_t c, size_t &cdb_used);
+    void fire(fused_entry_t &e, uint64_t c);
+
+    trace_source_t *src;
+    trace_decoder_t decoder;
+    dcache_t *dcache;
+    bpred_t *bpred;
+
+    uint64_t r;
+    uint64_t f;
+    uint64_t begin_dump;
+    uint64_t end_dump;
+
+    uint64_t read_cnt;
+    bool read_finished;
+    bool done;
+
+    // flight, if it records every event and not just the retired instructions
+    flight_recorder_t *flight_stages;
+
+    // mispredicted branch fetch is waiting on, 0 if none
+    uint32_t redirect_id;
+    bool redirect_resolved;
+
+    size_t n_window;
+    size_t window_limit;
+    mem_vector_t<fused_entry_t, MEM_QUEUES> window;
+    mem_vector_t<inst_timing_t, MEM_QUEUES> window_timing;
+    mem_deque_t<fused_fetched_t, MEM_QUEUES> dispatch_queue;
+
+    std::vector<uint32_t> cdb_tags;
+    uint32_t fu_free[3];
+
+    select_t select_policy;
+    cdb_t cdb_policy;
+    // window slots the policies order, when they don't go by queue order
+    std::vector<uint32_t> cdb_slots;
+    std::vector<uint32_t> fire_slots;
+
+    bool reg_ready[FUSED_NUM_REGS];
+    uint32_t reg_tag[FUSED_NUM_REGS];
+
+    mem_vector_t<inst_timing_t, MEM_OUTPUT> dump;
+
+    // loads and stores of the current fetch group
+    std::vector<uint64_t> group_addr;
+    std::vector<uint8_t> group_is_load;
+    std::vector<uint32_t> group_latency;
+    std::vector<size_t> group_slot;
+};
+
+// the engine with the stage engine's timing
+typedef policy_core_t<select_oldest_t, cdb_oldest_t> fused_core_t;
+
+#endif /* FUSED_H */
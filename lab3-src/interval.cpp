@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <cinttypes>
+#include <string.h>
+#include <math.h>
+#include "interval.hpp"
+#include "trace_decode.hpp"
+#include "fused.hpp"
+#include "procsim_driver.hpp"
+
+/* Constants fit to the fused engine on new_traces */
+
+// share of every other back end bound that adds to the largest one
+static const double bound_overlap = 0.175;
+// how fast that share falls off as a bound gets smaller than the largest
+static const double overlap_exponent = 8.0;
+// cycles an instruction holds a scheduling queue slot besides its chain
+static const double window_overhead = 2.1;
+// cycles to fill and drain the pipeline
+static const double startup_cycles = 4.0;
+
+static const char *bound_names[INTERVAL_BOUNDS] = { "fetch", "cdb", "k0", "k1", "k2", "window" };
+
+const char *interval_bound_name(interval_bound_t bound) {
+    return bound_names[bound];
+}
+
+// how deep in the dependency chains of its block every instruction is, for
+// blocks of 1 << shift instructions
+struct chain_tracker_t {
+    uint32_t shift;
+    uint32_t depth[FUSED_NUM_REGS];     // of the last writer of each register
+    uint64_t block[FUSED_NUM_REGS];     // block of that writer, plus one, 0 if none
+
+    uint64_t sum_depth;
+    uint64_t sum_branch_depth;
+
+    void init(uint32_t shift) {
+        this->shift = shift;
+        memset(depth, 0, sizeof(depth));
+        memset(block, 0, sizeof(block));
+        sum_depth = 0;
+        sum_branch_depth = 0;
+    }
+
+    // a chain link costs the latency plus the cycle the wake-up takes
+    void add(uint64_t i, const int16_t *src, int16_t dest, uint32_t latency, bool mispredicted) {
+        uint64_t b = (i >> shift) + 1;
+        uint32_t d = 0;
+
+        for (int s = 0; s < 2; s++) {
+            if (src[s] != -1 && block[src[s]] == b)
+                d = std::max(d, depth[src[s]]);
+        }
+        d += latency + 1;
+
+        if (dest != -1) {
+            depth[dest] = d;
+            block[dest] = b;
+        }
+        sum_depth += d;
+        if (mispredicted)
+            sum_branch_depth += d;
+    }
+};
+
+void interval_profile(trace_source_t *src, dcache_t *dcache, bpred_t *bpred, interval_profile_t *profile) {
+    trace_decoder_t decoder;
+    std::vector<chain_tracker_t> chains(INTERVAL_WINDOWS);
+    uint64_t i = 0;
+    size_t k;
+
+    memset(profile, 0, sizeof(interval_profile_t));
+    for (int w = 0; w < INTERVAL_WINDOWS; w++)
+        chains[w].init(w + 2);
+
+    decoder.reset(src);
+    const decoded_batch_t &b = decoder.batch();
+    while (decoder.next(&k)) {
+        uint8_t op = b.op_code[k];
+        uint32_t latency = 1;
+        bool mispredicted = false;
+        int16_t src_reg[2] = { b.src_reg[0][k], b.src_reg[1][k] };
+
+        if (dcache != NULL && (b.mem_read[k] || b.mem_write[k])) {
+            uint32_t l = dcache->access(b.mem_addr[k]);
+            if (b.mem_read[k])
+                latency = l;
+        }
+        if (bpred != NULL && op == 2) {
+            bool taken = b.br_taken[k];
+            profile->branches++;
+            if (bpred->predict_update(b.inst_addr[k], taken) != taken) {
+                profile->mispredictions++;
+                mispredicted = true;
+            }
+        }
+
+        profile->class_insts[op]++;
+        profile->class_latency[op] += latency;
+        for (int w = 0; w < INTERVAL_WINDOWS; w++)
+            chains[w].add(i, src_reg, b.dest_reg[k], latency, mispredicted);
+        i++;
+    }
+
+    profile->insts = i;
+    for (int w = 0; w < INTERVAL_WINDOWS; w++) {
+        profile->depth[w] = i ? chains[w].sum_depth * 1.0 / i : 0;
+        profile->branch_depth[w] = profile->mispredictions ?
+            chains[w].sum_branch_depth * 1.0 / profile->mispredictions : 0;
+    }
+    if (dcache != NULL) {
+        profile->l1_accesses = dcache->l1.accesses;
+        profile->l1_misses = dcache->l1.misses;
+        profile->l2_accesses = dcache->l2.accesses;
+        profile->l2_misses = dcache->l2.misses;
+    }
+}
+
+// a per-block profile value at window size n, interpolated in log2(n)
+static double at_window(const double *v, double n) {
+    double x = log2(n / INTERVAL_MIN_WINDOW);
+    if (x <= 0)
+        return v[0];
+    if (x >= INTERVAL_WINDOWS - 1)
+        return v[INTERVAL_WINDOWS - 1];
+
+    int w = (int) x;
+    double t = x - w;
+    return v[w] * (1 - t) + v[w + 1] * t;
+}
+
+interval_estimate_t interval_predict(const interval_profile_t &profile, uint64_t r, uint64_t k0, uint64_t k1,
+                                     uint64_t k2, uint64_t f) {
+    interval_estimate_t est;
+    double n = profile.insts;
+    double window = 2.0 * (k0 + k1 + k2);
+    uint64_t k[3] = { k0, k1, k2 };
+
+    // fetch stops at a mispredicted branch until it executes
+    est.mispredict_cycles = profile.mispredictions * at_window(profile.branch_depth, window);
+    est.bound[BOUND_FETCH] = n / f + est.mispredict_cycles;
+    est.bound[BOUND_CDB] = n / r;
+    for (int c = 0; c < 3; c++)
+        est.bound[BOUND_K0 + c] = profile.class_latency[c] * 1.0 / k[c];
+    est.bound[BOUND_WINDOW] = n / window * (at_window(profile.depth, window) + window_overhead);
+
+    est.limit = BOUND_FETCH;
+    for (int b = 1; b < INTERVAL_BOUNDS; b++) {
+        if (est.bound[b] > est.bound[est.limit])
+            est.limit = (interval_bound_t) b;
+    }
+
+    /* Fetch only sets the pace, the back end resources get in each other's way */
+    interval_bound_t busiest = BOUND_CDB;
+    for (int b = BOUND_CDB + 1; b < INTERVAL_BOUNDS; b++) {
+        if (est.bound[b] > est.bound[busiest])
+            busiest = (interval_bound_t) b;
+    }
+    double back_end = est.bound[busiest];
+    for (int b = BOUND_CDB; b < INTERVAL_BOUNDS; b++) {
+        if (b != busiest)
+            back_end += bound_overlap * est.bound[b] * pow(est.bound[b] / est.bound[busiest], overlap_exponent);
+    }
+    // the mispredicted branches stall fetch whatever the back end is doing
+    est.cycles = n ? std::max(n / f, back_end) + est.mispredict_cycles + startup_cycles : 0;
+    return est;
+}
+
+int run_interval(const char *filename, proc_stats_t *p_stats) {
+    trace_source_t *src = open_trace(filename);
+    if (src == NULL)
+        return 1;
+    if (sim_opts.skip > 0) {
+        uint64_t skipped = src->skip(sim_opts.skip);
+        printf("Skipped %" PRIu64 " instructions\n", skipped);
+    }
+
+    dcache_t dcache;
+    if (sim_opts.l1.size && !dcache.init(sim_opts.l1, sim_opts.l2.size ? &sim_opts.l2 : NULL, sim_opts.mem_latency)) {
+        fprintf(stderr, "Cache sizes must be a power of two number of sets of 64 byte lines\n");
+        delete src;
+        return 1;
+    }
+    bpred_t *bpred = create_bpred(sim_opts.bpred, sim_opts.bpred_bits);
+
+    interval_profile_t profile;
+    interval_profile(src, sim_opts.l1.size ? &dcache : NULL, bpred, &profile);
+    delete bpred;
+    bool trace_failed = trace_read_failed(src, profile.insts, filename);
+    delete src;
+    if (trace_failed)
+        return 1;
+
+    interval_estimate_t est = interval_predict(profile, sim_opts.r, sim_opts.k0, sim_opts.k1, sim_opts.k2,
+                                               sim_opts.f);
+
+    memset(p_stats, 0, sizeof(proc_stats_t));
+    p_stats->retired_instruction = profile.insts;
+    p_stats->cycle_count = (unsigned long) (est.cycles + 0.5);
+    p_stats->avg_inst_retired = p_stats->cycle_count ? profile.insts * 1.f / p_stats->cycle_count : 0.f;
+    p_stats->l1_accesses = profile.l1_accesses;
+    p_stats->l1_misses = profile.l1_misses;
+    p_stats->l2_accesses = profile.l2_accesses;
+    p_stats->l2_misses = profile.l2_misses;
+    p_stats->branches = profile.branches;
+    p_stats->mispredictions = profile.mispredictions;
+
+    print_settings();
+    printf("Interval model estimate:\n");
+    printf("Total instructions: %lu\n", p_stats->retired_instruction);
+    printf("Total run time (cycles): %lu\n", p_stats->cycle_count);
+    printf("Avg inst retired per cycle: %f\n", p_stats->avg_inst_retired);
+    printf("Limited by: %s\n", interval_bound_name(est.limit));
+    for (int b = 0; b < INTERVAL_BOUNDS; b++)
+        printf("  %s bound (cycles): %.0f\n", interval_bound_name((interval_bound_t) b), est.bound[b]);
+
+    double window = 2.0 * (sim_opts.k0 + sim_opts.k1 + sim_opts.k2);
+    double n = std::max<uint64_t>(profile.insts, 1);
+    printf("Op mix (k0/k1/k2): %.3f/%.3f/%.3f\n", profile.class_insts[0] / n, profile.class_insts[1] / n,
+           profile.class_insts[2] / n);
+    printf("Avg chain depth in %.0f instructions (cycles): %.3f\n", window, at_window(profile.depth, window));
+
+    if (sim_opts.l1.size) {
+        printf("L1 accesses: %lu\n", p_stats->l1_accesses);
+        printf("L1 miss rate: %f\n", p_stats->l1_accesses ? p_stats->l1_misses * 1.f / p_stats->l1_accesses : 0.f);
+    }
+    if (sim_opts.l2.size) {
+        printf("L2 accesses: %lu\n", p_stats->l2_accesses);
+        printf("L2 miss rate: %f\n", p_stats->l2_accesses ? p_stats->l2_misses * 1.f / p_stats->l2_accesses : 0.f);
+    }
+    if (sim_opts.bpred != BPRED_NONE) {
+        printf("Branch predictor: %s\n", bpred_name(sim_opts.bpred));
+        printf("Branches: %lu\n", p_stats->branches);
+        printf("Mispredictions: %lu\n", p_stats->mispredictions);
+        printf("Fetch cycles lost to mispredictions: %.0f\n", est.mispredict_cycles);
+    }
+    return 0;
+}
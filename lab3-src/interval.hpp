@@ -0,0 +1,89 @@
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include "procsim.hpp"
+#include "trace_source.hpp"
+
+/*
+ * Interval model
+ *
+ * Estimates the cycles of a run from one streaming pass over the trace
+ * instead of simulating it. The pass builds a profile that doesn't depend
+ * on the processor configuration: the op mix and the execution latency of
+ * every function unit class, the cache and branch predictor outcomes in
+ * program order, and how deep in the dependency chains of their block the
+ * instructions are, for blocks of N consecutive instructions with N from
+ * 4 to 1024. A configuration is then predicted from the profile alone, as
+ * the cycles each resource would need on its own:
+ *
+ *   - fetch, F instructions a cycle plus the cycles it waits for every
+ *     mispredicted branch to resolve
+ *   - the result buses, R a cycle
+ *   - every function unit class, busy for the latency of its instructions
+ *   - the scheduling queue, whose 2 * (k0 + k1 + k2) slots are each held
+ *     for the wait on the instruction's chain and a few pipeline cycles
+ *     (instructions leave it out of order, so the average depth counts
+ *     rather than the longest chain)
+ *
+ * Fetch and the busiest back end resource overlap completely, so a run
+ * takes the larger of the two. Fetch delivers at a steady rate and costs
+ * nothing when it ties, but the back end resources contend for the same
+ * instructions: every other back end bound adds a share that is close to
+ * zero unless it is near the busiest one. The mispredicted branches add
+ * their fetch stalls on top, and the pipeline takes a few cycles to fill
+ * and drain. The constants are fit to the detailed engine on new_traces,
+ * interval_calibrate.sh measures the error against it:
+ *
+ *   SET      RUNS  MEAN_ABS_ERROR  MEAN_ERROR  WORST  WITHIN_5%
+ *   fit      5184  1.77%           -0.48%      16.0%  87.8%
+ *   holdout   864  4.08%           -0.76%      18.8%  64.0%
+ */
+
+#define INTERVAL_WINDOWS 9
+#define INTERVAL_MIN_WINDOW 4
+
+enum interval_bound_t {
+    BOUND_FETCH, BOUND_CDB, BOUND_K0, BOUND_K1, BOUND_K2, BOUND_WINDOW, INTERVAL_BOUNDS
+};
+
+// what the pass over a trace found, independent of R, k0, k1, k2 and F
+struct interval_profile_t {
+    uint64_t insts;
+    uint64_t class_insts[3];
+    uint64_t class_latency[3];      // execution cycles of each function unit class
+
+    uint64_t branches;
+    uint64_t mispredictions;
+    uint64_t l1_accesses;
+    uint64_t l1_misses;
+    uint64_t l2_accesses;
+    uint64_t l2_misses;
+
+    // for blocks of INTERVAL_MIN_WINDOW << w instructions: the cycles from
+    // the start of its block until an instruction executes if it only had
+    // to wait on its chain, on average over all instructions and over the
+    // mispredicted branches
+    double depth[INTERVAL_WINDOWS];
+    double branch_depth[INTERVAL_WINDOWS];
+};
+
+struct interval_estimate_t {
+    double cycles;
+    double bound[INTERVAL_BOUNDS];  // cycles each resource alone needs
+    double mispredict_cycles;       // of the fetch bound, waiting on mispredicted branches
+    interval_bound_t limit;         // the largest bound
+};
+
+class dcache_t;
+class bpred_t;
+
+// profile what is left of src, the data cache and predictor may be NULL
+void interval_profile(trace_source_t *src, dcache_t *dcache, bpred_t *bpred, interval_profile_t *profile);
+
+// estimate a run with r result buses, k0, k1 and k2 function units and fetch width f
+interval_estimate_t interval_predict(const interval_profile_t &profile, uint64_t r, uint64_t k0, uint64_t k1,
+                                     uint64_t k2, uint64_t f);
+
+const char *interval_bound_name(interval_bound_t bound);
+
+#endif /* INTERVAL_H */
@@ -0,0 +1,103 @@
+#!/bin/bash
+#
+# Calibration of the interval model (--model=interval) against the fused engine
+#
+# Simulates a grid of configurations over the traces with --lockstep, estimates
+# every one with --model=interval and prints one line per run with the bounds
+# the estimate was made from, then the error per set and per trace. The "fit"
+# set is what the constants in interval.cpp were fit to, the "holdout" set
+# (other fetch widths, predictors, caches and R) only checks them.
+#
+#   ./interval_calibrate.sh [TRACE...] > calibration.txt
+#
+
+PROCSIM=${PROCSIM:-./procsim}
+if [ $# -eq 0 ]; then
+    set -- ../new_traces/100k.bzip.gz ../new_traces/100k.gcc.gz ../new_traces/100k.libq.gz ../new_traces/100k.mcf.gz
+fi
+
+# set, name and options of every predictor and cache variant, fetch widths, R
+FIT_VARIANTS=("none|" "gshare|--bpred=gshare" "l1l2-gshare|--l1=32k:8:2 --l2=256k:8:10 --bpred=gshare")
+FIT_F="1 2 4 8"
+FIT_R="1 2 4 8"
+HOLDOUT_VARIANTS=("tage|--bpred=tage" "l1-bimodal|--l1=8k:2:3 --bpred=bimodal:8")
+HOLDOUT_F="3 6"
+HOLDOUT_R="3 6"
+K="1 2 3"
+
+# R:K0:K1:K2 for every R in $1 and k0, k1, k2 in $K
+configs() {
+    local list=""
+    for r in $1; do
+        for k0 in $K; do
+            for k1 in $K; do
+                for k2 in $K; do
+                    list="$list${list:+,}$r:$k0:$k1:$k2"
+                done
+            done
+        done
+    done
+    echo "$list"
+}
+
+# the value after the last ": " of the line starting with $1
+field() {
+    echo "$2" | grep "^ *$1" | head -1 | awk -F': ' '{ print $NF }'
+}
+
+run_set() {
+    local set=$1 fs=$2 rs=$3
+    shift 3
+    local variants=("$@")
+    local list=$(configs "$rs")
+
+    for trace in "${TRACES[@]}"; do
+        for v in "${variants[@]}"; do
+            local name=${v%%|*} opts=${v#*|}
+            for f in $fs; do
+                # R k0 k1 k2 INSTS CYCLES ... of every configuration
+                $PROCSIM -f $f -i $trace --no-cache $opts --lockstep=$list 2>/dev/null |
+                    awk '$1 ~ /^[0-9]+$/ && NF >= 6 { print $1, $2, $3, $4, $6 }' |
+                while read r k0 k1 k2 actual; do
+                    local out=$($PROCSIM -r $r -f $f -j $k0 -k $k1 -l $k2 -i $trace --no-cache $opts \
+                                --model=interval 2>/dev/null)
+                    local mispredict=$(field "Fetch cycles lost" "$out")
+                    echo "$set $(basename $trace) $name $f $r $k0 $k1 $k2 $actual" \
+                         "$(field "Total run time" "$out") $(field "Limited by" "$out")" \
+                         "$(field "fetch bound" "$out") ${mispredict:-0} $(field "cdb bound" "$out")" \
+                         "$(field "k0 bound" "$out") $(field "k1 bound" "$out") $(field "k2 bound" "$out")" \
+                         "$(field "window bound" "$out") $(field "Avg chain depth" "$out")"
+                done
+            done
+        done
+    done
+}
+
+TRACES=("$@")
+echo "SET TRACE VARIANT F R K0 K1 K2 CYCLES ESTIMATE LIMIT FETCH MISPREDICT CDB K0B K1B K2B WINDOW DEPTH"
+{
+    run_set fit "$FIT_F" "$FIT_R" "${FIT_VARIANTS[@]}"
+    run_set holdout "$HOLDOUT_F" "$HOLDOUT_R" "${HOLDOUT_VARIANTS[@]}"
+} | awk '
+    { print }
+    {
+        err = ($10 - $9) / $9 * 100
+        abs = err < 0 ? -err : err
+        n[$1]++; sum[$1] += abs; bias[$1] += err
+        if (abs > worst[$1]) worst[$1] = abs
+        key = $1 " " $2
+        tn[key]++; tsum[key] += abs
+        if (abs > tworst[key]) tworst[key] = abs
+        if (abs <= 5) within5[$1]++
+    }
+    END {
+        print ""
+        print "SET RUNS MEAN_ABS_ERROR MEAN_ERROR WORST WITHIN_5%"
+        for (s in n)
+            printf "%s %d %.2f%% %+.2f%% %.1f%% %.1f%%\n", s, n[s], sum[s] / n[s], bias[s] / n[s], worst[s],
+                   within5[s] * 100 / n[s]
+        print ""
+        print "SET TRACE RUNS MEAN_ABS_ERROR WORST"
+        for (k in tn)
+            printf "%s %d %.2f%% %.1f%%\n", k, tn[k], tsum[k] / tn[k], tworst[k]
+    }'
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include "procsim_driver.hpp"
+#include "trace_source.hpp"
+#include "trace_decode.hpp"
+#include "fused.hpp"
+#include "mem_stats.hpp"
+
+/*
+ * Lockstep sweeps
+ *
+ * Simulates configurations that differ only in R, k0, k1 and k2 side by
+ * side in one pass over a trace. Everything that doesn't depend on the
+ * timing is done once, by a shared front end, in program order: decoding,
+ * the cache latency of loads, whether a branch is mispredicted, and which
+ * earlier instruction produces each source register (a busy register is
+ * always waiting on its last writer, so only whether it is still busy is
+ * left to the lanes). Each lane is a fused engine core reduced to the
+ * timing dependent state, kept in arrays over the lanes, and every cycle
+ * advances all the lanes that are still running. The lanes run the fused
+ * engine's pipeline with the default policies, so every lane gets the
+ * statistics of a run of its configuration on its own.
+ */
+
+// an instruction as the front end hands it to the lanes
+struct lockstep_inst_t {
+    uint32_t producer[2];   // last earlier writer of each source register, 0 if none
+    uint32_t latency;
+    int16_t dest_reg;
+    int16_t src_reg[2];
+    uint8_t op_code;
+    uint8_t mispredicted;
+};
+
+struct lockstep_stream_t {
+    trace_decoder_t decoder;
+    dcache_t *dcache;
+    bpred_t *bpred;
+
+    uint64_t base;          // id of the first instruction still kept
+    mem_deque_t<lockstep_inst_t, MEM_INSTRUCTIONS> insts;
+    uint32_t last_writer[FUSED_NUM_REGS];
+    bool finished;
+    uint64_t branches;
+    uint64_t mispredictions;
+
+    lockstep_stream_t(trace_source_t *src, dcache_t *dcache, bpred_t *bpred)
+        : dcache(dcache), bpred(bpred), base(1), finished(false), branches(0), mispredictions(0) {
+        decoder.reset(src);
+        memset(last_writer, 0, sizeof(last_writer));
+    }
+
+    // returns false if the trace ends before instruction id
+    bool fetch(uint64_t id) {
+        while (base + insts.size() <= id) {
+            if (finished || !decode_next()) {
+                finished = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const lockstep_inst_t &operator[](uint64_t id) const { return insts[id - base]; }
+
+    // forget the instructions before id
+    void trim(uint64_t id) {
+        while (base < id && !insts.empty()) {
+            insts.pop_front();
+            base++;
+        }
+    }
+
+private:
+    bool decode_next();
+};
+
+bool lockstep_stream_t::decode_next() {
+    size_t k;
+    if (!decoder.next(&k))
+        return false;
+
+    const decoded_batch_t &b = decoder.batch();
+    uint32_t id = base + insts.size();
+    lockstep_inst_t d;
+
+    d.op_code = b.op_code[k];
+    d.dest_reg = b.dest_reg[k];
+    d.latency = 1;
+    d.mispredicted = 0;
+
+    // sources read the register file before the destination is claimed
+    for (int s = 0; s < 2; s++) {
+        d.src_reg[s] = b.src_reg[s][k];
+        d.producer[s] = d.src_reg[s] != -1 ? last_writer[d.src_reg[s]] : 0;
+    }
+    if (d.dest_reg != -1)
+        last_writer[d.dest_reg] = id;
+
+    if (dcache != NULL && (b.mem_read[k] || b.mem_write[k])) {
+        uint32_t latency = dcache->access(b.mem_addr[k]);
+        if (b.mem_read[k])
+            d.latency = latency;
+    }
+
+    if (bpred != NULL && d.op_code == 2) {
+        bool taken = b.br_taken[k];
+        branches++;
+        if (bpred->predict_update(b.inst_addr[k], taken) != taken) {
+            mispredictions++;
+            d.mispredicted = 1;
+        }
+    }
+
+    insts.push_back(d);
+    return true;
+}
+
+// one R:K0:K1:K2 point of the sweep
+struct lockstep_config_t {
+    uint64_t r;
+    uint64_t k[3];
+};
+
+// per lane state, one element (or a fixed stride) per lane
+struct lockstep_lanes_t {
+    size_t n;
+    uint64_t f;
+    size_t stride;          // window slots per lane
+
+    std::vector<uint64_t> r;
+    std::vector<uint64_t> window_limit;
+    std::vector<uint64_t> n_window;
+    std::vector<uint32_t> fu_free;          // 3 per lane
+    std::vector<uint64_t> fetched;
+    std::vector<uint64_t> dispatched;
+    std::vector<uint32_t> redirect_id;
+    std::vector<uint8_t> redirect_resolved;
+    std::vector<uint8_t> read_finished;
+    std::vector<uint8_t> done;
+    mem_vector_t<uint8_t, MEM_QUEUES> reg_ready;        // FUSED_NUM_REGS per lane
+    mem_vector_t<fused_entry_t, MEM_QUEUES> window;     // stride per lane
+    std::vector<proc_stats_t> stats;
+    std::vector<uint32_t> cdb_tags;
+
+    void setup(const std::vector<lockstep_config_t> &configs, uint64_t f);
+    // simulate one cycle of lane l, returns false once it retired everything
+    bool step(size_t l, lockstep_stream_t &stream);
+};
+
+void lockstep_lanes_t::setup(const std::vector<lockstep_config_t> &configs, uint64_t f) {
+    n = configs.size();
+    this->f = f;
+
+    stride = 0;
+    uint64_t max_r = 0;
+    for (auto &c : configs) {
+        stride = std::max<size_t>(stride, 2 * (c.k[0] + c.k[1] + c.k[2]));
+        max_r = std::max(max_r, c.r);
+    }
+
+    r.resize(n);
+    window_limit.resize(n);
+    n_window.assign(n, 0);
+    fu_free.resize(3 * n);
+    fetched.assign(n, 0);
+    dispatched.assign(n, 0);
+    redirect_id.assign(n, 0);
+    redirect_resolved.assign(n, 0);
+    read_finished.assign(n, 0);
+    done.assign(n, 0);
+    reg_ready.resize(n * FUSED_NUM_REGS);
+    window.resize(n * stride);
+    stats.resize(n);
+    cdb_tags.resize(max_r);
+
+    for (size_t l = 0; l < n; l++) {
+        r[l] = configs[l].r;
+        window_limit[l] = 2 * (configs[l].k[0] + configs[l].k[1] + configs[l].k[2]);
+        for (int c = 0; c < 3; c++)
+            fu_free[3 * l + c] = configs[l].k[c];
+
+        // registers past the first 64 start out busy, as in the stage engine
+        for (int i = 0; i < FUSED_NUM_REGS; i++)
+            reg_ready[l * FUSED_NUM_REGS + i] = (i < 64);
+
+        memset(&stats[l], 0, sizeof(proc_stats_t));
+        stats[l].cycle_count = 1;
+    }
+}
+
+// the cycle of fused_core_t::step on lane l
+bool lockstep_lanes_t::step(size_t l, lockstep_stream_t &stream) {
+    proc_stats_t &st = stats[l];
+    fused_entry_t *win = &window[l * stride];
+    uint32_t *fu = &fu_free[3 * l];
+    uint8_t *ready = &reg_ready[l * FUSED_NUM_REGS];
+    uint64_t c = st.cycle_count;
+    size_t cdb_used = 0;
+    size_t i;
+
+    /* first half: state update, execute, schedule */
+    for (i = 0; i < n_window[l]; i++) {
+        fused_entry_t &e = win[i];
+
+        if ((e.flags & (FUSED_EXECUTED | FUSED_RETIRING)) == FUSED_EXECUTED)
+            e.flags |= FUSED_RETIRING;
+
+        if ((e.flags & (FUSED_FIRED | FUSED_EXECUTED)) == FUSED_FIRED && c >= e.cycle_ready && cdb_used < r[l]) {
+            cdb_tags[cdb_used++] = e.id;
+            if (e.dest_reg >= 0)
+                ready[e.dest_reg] = 1;
+            e.flags |= FUSED_EXECUTED;
+            fu[e.op_code]++;
+
+            if (e.id == redirect_id[l])
+                redirect_resolved[l] = 1;
+        }
+
+        if (!(e.flags & FUSED_FIRE) &&
+            (e.flags & (FUSED_SRC0_READY | FUSED_SRC1_READY)) == (FUSED_SRC0_READY | FUSED_SRC1_READY))
+            e.flags |= FUSED_FIRE;
+    }
+
+    /* first half: dispatch reserves the free scheduling queue slots */
+    uint64_t dq_size = fetched[l] - dispatched[l];
+    if (st.max_disp_size < dq_size)
+        st.max_disp_size = dq_size;
+    st.sum_disp_size += dq_size;
+
+    uint64_t n_dispatch = std::min(window_limit[l] - n_window[l], dq_size);
+
+    /* second half: retire, cdb wake-up, fire */
+    size_t kept = 0;
+    for (i = 0; i < n_window[l]; i++) {
+        if (win[i].flags & FUSED_RETIRING) {
+            st.retired_instruction++;
+            continue;
+        }
+
+        fused_entry_t e = win[i];
+        for (size_t k = 0; k < cdb_used; k++) {
+            if (!(e.flags & FUSED_SRC0_READY) && e.src_tag[0] == cdb_tags[k]) {
+                e.src_tag[0] = 0;
+                e.flags |= FUSED_SRC0_READY;
+            }
+            if (!(e.flags & FUSED_SRC1_READY) && e.src_tag[1] == cdb_tags[k]) {
+                e.src_tag[1] = 0;
+                e.flags |= FUSED_SRC1_READY;
+            }
+        }
+
+        if ((e.flags & (FUSED_FIRE | FUSED_FIRED)) == FUSED_FIRE && fu[e.op_code]) {
+            fu[e.op_code]--;
+            e.flags |= FUSED_FIRED;
+            e.cycle_ready = c + e.latency;
+        }
+
+        win[kept++] = e;
+    }
+    n_window[l] = kept;
+
+    // nothing left in flight, the last cycle ends here
+    if (read_finished[l] && st.retired_instruction == fetched[l]) {
+        done[l] = 1;
+        return false;
+    }
+
+    /* second half: dispatch */
+    for (uint64_t k = 0; k < n_dispatch; k++) {
+        uint32_t id = ++dispatched[l];
+        const lockstep_inst_t &d = stream[id];
+        fused_entry_t &e = win[n_window[l]++];
+
+        e.id = id;
+        e.latency = d.latency;
+        e.cycle_ready = 0;
+        e.dest_reg = d.dest_reg;
+        e.op_code = d.op_code;
+        e.flags = 0;
+
+        // a busy source waits on its last writer
+        for (int s = 0; s < 2; s++) {
+            if (d.src_reg[s] != -1 && !ready[d.src_reg[s]]) {
+                e.src_tag[s] = d.producer[s];
+            } else {
+                e.src_tag[s] = 0;
+                e.flags |= (s == 0) ? FUSED_SRC0_READY : FUSED_SRC1_READY;
+            }
+        }
+        if (d.dest_reg != -1)
+            ready[d.dest_reg] = 0;
+    }
+
+    /* second half: fetch */
+    bool fetching = true;
+    if (redirect_id[l]) {
+        if (!redirect_resolved[l]) {
+            st.fetch_stall_cycles++;
+            fetching = false;
+        } else {
+            redirect_id[l] = 0;
+        }
+    }
+    for (uint64_t k = 0; fetching && !read_finished[l] && k < f; k++) {
+        uint64_t id = fetched[l] + 1;
+        if (!stream.fetch(id)) {
+            read_finished[l] = 1;
+            break;
+        }
+        fetched[l]++;
+
+        if (stream[id].mispredicted) {
+            redirect_id[l] = id;
+            redirect_resolved[l] = 0;
+            break;
+        }
+    }
+
+    st.cycle_count++;
+    return true;
+}
+
+static bool parse_lockstep_configs(const char *arg, std::vector<lockstep_config_t> &configs) {
+    std::istringstream list(arg);
+    std::string item;
+
+    while (std::getline(list, item, ',')) {
+        lockstep_config_t c;
+        if (sscanf(item.c_str(), "%" SCNu64 ":%" SCNu64 ":%" SCNu64 ":%" SCNu64,
+                   &c.r, &c.k[0], &c.k[1], &c.k[2]) != 4 ||
+            c.r == 0 || c.k[0] == 0 || c.k[1] == 0 || c.k[2] == 0)
+            return false;
+        configs.push_back(c);
+    }
+    return !configs.empty();
+}
+
+int run_lockstep(const char *filename, const char *configs_arg) {
+    std::vector<lockstep_config_t> configs;
+    if (!parse_lockstep_configs(configs_arg, configs)) {
+        fprintf(stderr, "Bad lockstep configurations %s, expected R:K0:K1:K2[,R:K0:K1:K2...]\n", configs_arg);
+        return 1;
+    }
+
+    trace_source_t *src = open_trace(filename);
+    if (src == NULL)
+        return 1;
+    if (sim_opts.skip > 0) {
+        uint64_t skipped = src->skip(sim_opts.skip);
+        printf("Skipped %" PRIu64 " instructions\n", skipped);
+    }
+
+    dcache_t dcache;
+    if (sim_opts.l1.size && !dcache.init(sim_opts.l1, sim_opts.l2.size ? &sim_opts.l2 : NULL, sim_opts.mem_latency)) {
+        fprintf(stderr, "Cache sizes must be a power of two number of sets of 64 byte lines\n");
+        delete src;
+        return 1;
+    }
+    bpred_t *bpred = create_bpred(sim_opts.bpred, sim_opts.bpred_bits);
+
+    lockstep_stream_t stream(src, sim_opts.l1.size ? &dcache : NULL, bpred);
+    lockstep_lanes_t lanes;
+    lanes.setup(configs, sim_opts.f);
+
+    /* Advance every running lane by a cycle, dropping what all lanes dispatched */
+    size_t running = lanes.n;
+    while (running > 0) {
+        uint64_t oldest = UINT64_MAX;
+        for (size_t l = 0; l < lanes.n; l++) {
+            if (lanes.done[l])
+                continue;
+            if (!lanes.step(l, stream))
+                running--;
+            oldest = std::min(oldest, lanes.dispatched[l] + 1);
+        }
+        stream.trim(oldest);
+    }
+
+    printf("Lockstep sweep: %zu configurations of %s, F %" PRIu64 "\n", lanes.n, filename, sim_opts.f);
+    printf("R\tk0\tk1\tk2\tINSTS\tCYCLES\tIPC\tMAX_DISP\tAVG_DISP\n");
+    for (size_t l = 0; l < lanes.n; l++) {
+        proc_stats_t &st = lanes.stats[l];
+
+        st.avg_disp_size = st.sum_disp_size / st.cycle_count;
+        st.avg_inst_retired = st.retired_instruction * 1.f / st.cycle_count;
+        printf("%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%lu\t%lu\t%f\t%lu\t%f\n",
+               configs[l].r, configs[l].k[0], configs[l].k[1], configs[l].k[2], st.retired_instruction,
+               st.cycle_count, st.avg_inst_retired, st.max_disp_size, st.avg_disp_size);
+    }
+
+    if (sim_opts.l1.size)
+        printf("L1 accesses: %" PRIu64 ", misses: %" PRIu64 "\n", dcache.l1.accesses, dcache.l1.misses);
+    if (bpred != NULL)
+        printf("Branches: %" PRIu64 ", mispredictions: %" PRIu64 "\n", stream.branches, stream.mispredictions);
+
+    delete bpred;
+    bool trace_failed = trace_read_failed(src, lanes.n ? lanes.stats[0].retired_instruction : 0, filename);
+    delete src;
+    return trace_failed ? 1 : 0;
+}
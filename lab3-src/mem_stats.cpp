@@ -0,0 +1,34 @@
+#include <sys/resource.h>
+#include "mem_stats.hpp"
+
+mem_pool_stats_t mem_pools[MEM_POOLS];
+
+const char *mem_pool_name(mem_pool_t pool) {
+    switch (pool) {
+    case MEM_INSTRUCTIONS:
+        return "instructions";
+    case MEM_QUEUES:
+        return "queues";
+    case MEM_TRACE:
+        return "trace buffers";
+    case MEM_OUTPUT:
+        return "output buffers";
+    default:
+        return "other";
+    }
+}
+
+uint64_t mem_allocations() {
+    uint64_t n = 0;
+    for (int i = 0; i < MEM_POOLS; i++)
+        n += mem_pools[i].allocations.load(std::memory_order_relaxed);
+    return n;
+}
+
+uint64_t mem_peak_rss() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    // linux reports kilobytes
+    return (uint64_t) usage.ru_maxrss * 1024;
+}
@@ -0,0 +1,95 @@
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <new>
+#include <vector>
+
+/*
+ * Memory footprint accounting
+ *
+ * Containers that can grow with the trace allocate through mem_allocator_t,
+ * which charges every allocation to a pool. Memory that isn't allocated
+ * through a container (e.g. a mapped trace) is charged with
+ * mem_account_alloc / mem_account_free. The counters are atomic, so the
+ * cores of a multi-core run share them.
+ */
+
+enum mem_pool_t {
+    MEM_INSTRUCTIONS,   // fetched instructions and their control blocks
+    MEM_QUEUES,         // dispatch and scheduling queues, register file, cdbs
+    MEM_TRACE,          // decoded trace buffers and mapped traces
+    MEM_OUTPUT,         // timing dump buffers
+    MEM_POOLS
+};
+
+struct mem_pool_stats_t {
+    std::atomic<int64_t> live;
+    std::atomic<int64_t> peak;
+    std::atomic<uint64_t> allocations;
+};
+
+extern mem_pool_stats_t mem_pools[MEM_POOLS];
+
+const char *mem_pool_name(mem_pool_t pool);
+
+inline void mem_account_alloc(mem_pool_t pool, size_t bytes) {
+    mem_pool_stats_t &p = mem_pools[pool];
+    int64_t live = p.live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t peak = p.peak.load(std::memory_order_relaxed);
+
+    while (live > peak && !p.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+        ;
+    p.allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void mem_account_free(mem_pool_t pool, size_t bytes) {
+    mem_pools[pool].live.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+// total allocations over all pools
+uint64_t mem_allocations();
+
+// peak resident set size of the process in bytes
+uint64_t mem_peak_rss();
+
+// std::allocator that charges its memory to POOL
+template <class T, mem_pool_t POOL>
+struct mem_allocator_t {
+    typedef T value_type;
+
+    template <class U>
+    struct rebind {
+        typedef mem_allocator_t<U, POOL> other;
+    };
+
+    mem_allocator_t() { }
+    template <class U>
+    mem_allocator_t(const mem_allocator_t<U, POOL> &) { }
+
+    T *allocate(size_t n) {
+        mem_account_alloc(POOL, n * sizeof(T));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        mem_account_free(POOL, n * sizeof(T));
+        ::operator delete(p);
+    }
+};
+
+template <class T, class U, mem_pool_t POOL>
+bool operator==(const mem_allocator_t<T, POOL> &, const mem_allocator_t<U, POOL> &) { return true; }
+template <class T, class U, mem_pool_t POOL>
+bool operator!=(const mem_allocator_t<T, POOL> &, const mem_allocator_t<U, POOL> &) { return false; }
+
+template <class T, mem_pool_t POOL>
+using mem_vector_t = std::vector<T, mem_allocator_t<T, POOL> >;
+
+template <class T, mem_pool_t POOL>
+using mem_deque_t = std::deque<T, mem_allocator_t<T, POOL> >;
+
+#endif /* MEM_STATS_H */
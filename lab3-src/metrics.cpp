@@ -0,0 +1,159 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "metrics.hpp"
+
+metrics_t *proc_metrics = NULL;
+
+uint64_t metrics_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool metrics_page_valid(const metrics_page_t *page) {
+    uint64_t magic;
+    memcpy(&magic, METRICS_MAGIC, sizeof(magic));
+    return __atomic_load_n((const uint64_t *) page->magic, __ATOMIC_ACQUIRE) == magic;
+}
+
+bool metrics_page_expired(const metrics_page_t *page, uint64_t now_ns) {
+    return page->state.load(std::memory_order_relaxed) == METRICS_DONE &&
+           page->updated_ns.load(std::memory_order_relaxed) + METRICS_DONE_GRACE_NS < now_ns;
+}
+
+// the pages finished runs left behind, in case procsim-top never saw them
+static void remove_expired_pages() {
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL)
+        return;
+
+    uint64_t now = metrics_now_ns();
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, METRICS_PREFIX, strlen(METRICS_PREFIX)) != 0)
+            continue;
+
+        std::string path = std::string("/") + ent->d_name;
+        int fd = shm_open(path.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            continue;
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(metrics_page_t))
+            p = mmap(NULL, sizeof(metrics_page_t), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            continue;
+
+        const metrics_page_t *page = (const metrics_page_t *) p;
+        if (metrics_page_valid(page) && metrics_page_expired(page, now))
+            shm_unlink(path.c_str());
+        munmap(p, sizeof(metrics_page_t));
+    }
+    closedir(dir);
+}
+
+bool metrics_t::open(const char *trace, uint32_t core, uint64_t interval) {
+    static std::atomic<uint32_t> next_page(0);
+
+    close();
+    remove_expired_pages();
+    name = "/" METRICS_PREFIX + std::to_string((long long) getpid()) + "-" + std::to_string(next_page++);
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, sizeof(metrics_page_t)) == 0)
+        p = mmap(NULL, sizeof(metrics_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    page = new (p) metrics_page_t();
+    page->pid = getpid();
+    page->core = core;
+    strncpy(page->trace, trace, sizeof(page->trace) - 1);
+    page->start_ns = metrics_now_ns();
+
+    this->interval = interval ? interval : 1;
+    countdown = this->interval;
+    last_ns = page->start_ns;
+    last_retired = 0;
+
+    // readers only trust a page once the magic is in place, after everything above
+    uint64_t magic;
+    memcpy(&magic, METRICS_MAGIC, sizeof(magic));
+    __atomic_store_n((uint64_t *) page->magic, magic, __ATOMIC_RELEASE);
+    return true;
+}
+
+// remove a page once the grace period is over, from a detached process
+// that holds none of our descriptors so nobody waits on it
+static void unlink_later(const char *name) {
+    pid_t child = fork();
+    if (child < 0) {
+        shm_unlink(name);
+        return;
+    }
+    if (child > 0) {
+        waitpid(child, NULL, 0);
+        return;
+    }
+
+    if (fork() == 0) {
+        for (long fd = sysconf(_SC_OPEN_MAX) - 1; fd >= 0; fd--)
+            ::close(fd);
+        struct timespec grace = { (time_t) (METRICS_DONE_GRACE_NS / 1000000000ULL), 0 };
+        while (nanosleep(&grace, &grace) != 0)
+            ;
+        shm_unlink(name);
+    }
+    _exit(0);
+}
+
+void metrics_t::close() {
+    if (page == NULL)
+        return;
+
+    // a finished page stays for procsim-top, see METRICS_DONE_GRACE_NS
+    bool done = page->state.load(std::memory_order_relaxed) == METRICS_DONE;
+    munmap(page, sizeof(metrics_page_t));
+    if (done)
+        unlink_later(name.c_str());
+    else
+        shm_unlink(name.c_str());
+    page = NULL;
+}
+
+void metrics_t::publish(const proc_stats_t *p_stats, uint64_t fetched, uint64_t dispatch_queue,
+                        uint64_t scheduling_queue, bool done) {
+    if (page == NULL)
+        return;
+
+    uint64_t now = metrics_now_ns();
+    if (now > last_ns) {
+        uint64_t rate = (p_stats->retired_instruction - last_retired) * 1000000000ULL / (now - last_ns);
+        page->inst_per_sec.store(rate, std::memory_order_relaxed);
+    }
+    last_ns = now;
+    last_retired = p_stats->retired_instruction;
+
+    page->cycles.store(p_stats->cycle_count, std::memory_order_relaxed);
+    page->retired.store(p_stats->retired_instruction, std::memory_order_relaxed);
+    page->fetched.store(fetched, std::memory_order_relaxed);
+    page->dispatch_queue.store(dispatch_queue, std::memory_order_relaxed);
+    page->scheduling_queue.store(scheduling_queue, std::memory_order_relaxed);
+    page->updated_ns.store(now, std::memory_order_relaxed);
+    if (done)
+        page->state.store(METRICS_DONE, std::memory_order_relaxed);
+}
@@ -0,0 +1,89 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+#include "procsim.hpp"
+
+/*
+ * Live metrics page
+ *
+ * A running simulation publishes its progress in a one page shared memory
+ * segment, /procsim-metrics-<pid>-<n>, every interval cycles. The page is
+ * written with relaxed atomic stores and nothing ever waits on it, so the
+ * only cost in the cycle loop is a countdown. procsim-top lists the pages
+ * of every live simulation.
+ *
+ * A finished run leaves its page behind in the done state so procsim-top
+ * gets to see it, a detached process removes it METRICS_DONE_GRACE_NS
+ * later. Should that process die, readers and the next simulation remove
+ * pages that have been done for longer.
+ */
+
+#define METRICS_MAGIC "PMETRIC1"
+#define METRICS_PREFIX "procsim-metrics-"
+#define DEFAULT_METRICS_INTERVAL 100000
+#define METRICS_DONE_GRACE_NS (10 * 1000000000ULL)
+
+enum metrics_state_t { METRICS_RUNNING, METRICS_DONE };
+
+struct metrics_page_t {
+    char magic[8];
+    int32_t pid;
+    uint32_t core;
+    char trace[128];
+    uint64_t start_ns;
+
+    std::atomic<uint32_t> state;
+    std::atomic<uint64_t> updated_ns;
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> retired;
+    std::atomic<uint64_t> fetched;
+    std::atomic<uint64_t> dispatch_queue;
+    std::atomic<uint64_t> scheduling_queue;
+    // simulated instructions retired per host second, over the last interval
+    std::atomic<uint64_t> inst_per_sec;
+};
+
+// wall clock in nanoseconds
+uint64_t metrics_now_ns();
+
+// the magic is published last, true once the rest of the page can be read
+bool metrics_page_valid(const metrics_page_t *page);
+
+// true once a finished page has been kept for the grace period
+bool metrics_page_expired(const metrics_page_t *page, uint64_t now_ns);
+
+class metrics_t {
+public:
+    metrics_t() : page(NULL) { }
+    ~metrics_t() { close(); }
+
+    // create the page of one simulated core
+    bool open(const char *trace, uint32_t core, uint64_t interval);
+    void close();
+
+    // true once every interval calls
+    bool due() {
+        if (--countdown)
+            return false;
+        countdown = interval;
+        return true;
+    }
+
+    void publish(const proc_stats_t *p_stats, uint64_t fetched, uint64_t dispatch_queue,
+                 uint64_t scheduling_queue, bool done = false);
+
+private:
+    std::string name;
+    metrics_page_t *page;
+    uint64_t interval;
+    uint64_t countdown;
+    uint64_t last_ns;
+    uint64_t last_retired;
+};
+
+// metrics of the current simulation, NULL when disabled
+extern metrics_t *proc_metrics;
+
+#endif /* METRICS_H */
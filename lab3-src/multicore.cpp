@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "procsim_driver.hpp"
+#include "trace_source.hpp"
+#include "metrics.hpp"
+#include "flight.hpp"
+#include "fused.hpp"
+
+// cores meet here every quantum; the last one to arrive runs the serial
+// phase, where structures shared between cores are brought up to date,
+// before it lets the others go on to the next quantum
+class quantum_barrier_t {
+public:
+    // serial(arg) is the serial phase, NULL for none
+    quantum_barrier_t(unsigned count, void (*serial)(void *), void *arg)
+        : quanta(0), serial(serial), serial_arg(arg), count(count), waiting(0), generation(0) { }
+
+    void arrive_and_wait() {
+        std::unique_lock<std::mutex> lock(m);
+        uint64_t gen = generation;
+
+        if (++waiting == count) {
+            release();
+            return;
+        }
+        cv.wait(lock, [&]() { return generation != gen; });
+    }
+
+    // a finished core stops taking part in later quanta
+    void arrive_and_drop() {
+        std::unique_lock<std::mutex> lock(m);
+
+        count--;
+        if (count > 0 && waiting == count)
+            release();
+    }
+
+    uint64_t quanta;
+
+private:
+    // with the lock held, so no core starts its next quantum before the serial phase is done
+    void release() {
+        quanta++;
+        if (serial != NULL)
+            serial(serial_arg);
+        waiting = 0;
+        generation++;
+        cv.notify_all();
+    }
+
+    void (*serial)(void *);
+    void *serial_arg;
+    std::mutex m;
+    std::condition_variable cv;
+    unsigned count;
+    unsigned waiting;
+    uint64_t generation;
+};
+
+struct core_t {
+    sim_options_t opts;
+    trace_source_t *src;
+    dcache_t dcache;
+    bpred_t *bpred;
+    fused_core_t *core;
+    proc_stats_t stats;
+    metrics_t metrics;
+    flight_recorder_t flight;
+};
+
+// every core dumps its flight recorder into its own file, path-core<i>.json
+static std::string core_flight_path(const std::string &path, size_t core) {
+    std::string suffix = "-core" + std::to_string((unsigned long long) core);
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+        return path + suffix;
+    return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+static void run_core(core_t *c, quantum_barrier_t *barrier, uint64_t quantum) {
+    for (;;) {
+        bool running = true;
+        for (uint64_t i = 0; i < quantum && running; i++) {
+            running = c->core->step(&c->stats);
+            if (c->core->metrics != NULL && c->core->metrics->due())
+                c->core->metrics->publish(&c->stats, c->core->fetched(), c->core->dispatch_queue_size(),
+                                          c->core->window_size());
+            if (c->core->flight != NULL)
+                c->core->flight->poll(&c->stats);
+        }
+
+        if (!running) {
+            if (c->core->metrics != NULL)
+                c->core->metrics->publish(&c->stats, c->core->fetched(), 0, 0, true);
+            barrier->arrive_and_drop();
+            return;
+        }
+        barrier->arrive_and_wait();
+    }
+}
+
+int run_multicore(std::vector<batch_job_t> &jobs, uint64_t quantum) {
+    std::vector<core_t> cores(jobs.size());
+    int status = 0;
+
+    if (quantum == 0)
+        quantum = 1;
+
+    // every core owns its trace, configuration and pipeline
+    for (size_t i = 0; i < jobs.size(); i++) {
+        core_t &c = cores[i];
+
+        c.opts = sim_opts;
+        c.src = NULL;
+        c.bpred = NULL;
+        c.core = NULL;
+        if (!apply_config(&c.opts, jobs[i].config)) {
+            fprintf(stderr, "Bad settings for %s: %s\n", jobs[i].trace.c_str(), jobs[i].config.c_str());
+            status = 1;
+            break;
+        }
+
+        c.src = open_trace(jobs[i].trace.c_str());
+        if (c.src == NULL) {
+            status = 1;
+            break;
+        }
+        if (c.opts.l1.size && !c.dcache.init(c.opts.l1, c.opts.l2.size ? &c.opts.l2 : NULL, c.opts.mem_latency)) {
+            fprintf(stderr, "Cache sizes must be a power of two number of sets of 64 byte lines\n");
+            status = 1;
+            break;
+        }
+        c.bpred = create_bpred(c.opts.bpred, c.opts.bpred_bits);
+        c.core = new fused_core_t(c.src, c.opts.l1.size ? &c.dcache : NULL, c.bpred);
+
+        if (c.opts.metrics_interval && c.metrics.open(jobs[i].trace.c_str(), i, c.opts.metrics_interval))
+            c.core->metrics = &c.metrics;
+        std::string flight_path = c.opts.flight_path ? c.opts.flight_path : flight_default_path();
+        if (c.opts.flight) {
+            c.flight.init(c.opts.flight_events, core_flight_path(flight_path, i),
+                          "core " + std::to_string((unsigned long long) i), sim_max_latency(c.opts));
+            c.core->flight = &c.flight;
+        }
+
+        memset(&c.stats, 0, sizeof(proc_stats_t));
+        c.core->setup(&c.stats, c.opts.r, c.opts.k0, c.opts.k1, c.opts.k2, c.opts.f,
+                      c.opts.begin_dump, c.opts.end_dump);
+    }
+
+    if (status == 0) {
+        // the cores share nothing yet, so there is no serial phase to run
+        quantum_barrier_t barrier(cores.size(), NULL, NULL);
+        std::vector<std::thread> threads;
+
+        for (auto &c : cores)
+            threads.push_back(std::thread(run_core, &c, &barrier, quantum));
+        for (auto &t : threads)
+            t.join();
+        for (size_t i = 0; i < cores.size(); i++) {
+            if (trace_read_failed(cores[i].src, cores[i].stats.retired_instruction, jobs[i].trace.c_str()))
+                status = 1;
+        }
+
+        printf("Multi-core run: %zu cores, %" PRIu64 " cycle quantum, %" PRIu64 " quanta\n",
+               cores.size(), quantum, barrier.quanta);
+        printf("CORE\tTRACE\tR\tk0\tk1\tk2\tF\tINSTS\tCYCLES\tIPC\n");
+
+        unsigned long total_inst = 0;
+        unsigned long system_cycles = 0;
+        float sum_ipc = 0;
+        for (size_t i = 0; i < cores.size(); i++) {
+            core_t &c = cores[i];
+            c.core->complete(&c.stats);
+
+            printf("%zu\t%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%lu\t%lu\t%f\n",
+                   i, jobs[i].trace.c_str(), c.opts.r, c.opts.k0, c.opts.k1, c.opts.k2, c.opts.f,
+                   c.stats.retired_instruction, c.stats.cycle_count, c.stats.avg_inst_retired);
+
+            total_inst += c.stats.retired_instruction;
+            if (system_cycles < c.stats.cycle_count)
+                system_cycles = c.stats.cycle_count;
+            sum_ipc += c.stats.avg_inst_retired;
+        }
+        printf("\n");
+        printf("Total instructions: %lu\n", total_inst);
+        printf("Total run time (cycles): %lu\n", system_cycles);
+        printf("Aggregate IPC (sum of cores): %f\n", sum_ipc);
+        printf("System IPC (instructions per system cycle): %f\n",
+               system_cycles ? total_inst * 1.f / system_cycles : 0.f);
+
+        for (size_t i = 0; i < cores.size(); i++) {
+            if (cores[i].opts.begin_dump > 0) {
+                std::cout << std::endl << "Core " << i << ": " << jobs[i].trace << std::endl;
+                cores[i].core->print_timing(std::cout);
+            }
+        }
+
+        if (sim_opts.flight_path != NULL) {
+            for (auto &c : cores) {
+                if (c.core->flight != NULL)
+                    c.flight.dump();
+            }
+        }
+    }
+
+    for (auto &c : cores) {
+        delete c.core;
+        delete c.bpred;
+        delete c.src;
+    }
+    return status;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include "policy.hpp"
+
+const char *select_kind_name(select_kind_t kind) {
+    switch (kind) {
+    case SELECT_RANDOM:
+        return "random";
+    default:
+        return "oldest";
+    }
+}
+
+const char *cdb_kind_name(cdb_kind_t kind) {
+    switch (kind) {
+    case CDB_CLASS:
+        return "class";
+    case CDB_RANDOM:
+        return "random";
+    case CDB_PORTS:
+        return "ports";
+    default:
+        return "oldest";
+    }
+}
+
+// arg is name, optionally followed by ':', leaving the parameters in *params
+static bool match_policy(const char *arg, const char *name, const char **params) {
+    size_t len = strlen(name);
+
+    if (strncmp(arg, name, len) != 0 || (arg[len] != '\0' && arg[len] != ':'))
+        return false;
+    *params = arg[len] == ':' ? arg + len + 1 : NULL;
+    return true;
+}
+
+bool parse_select_policy(const char *arg, policy_config_t *config) {
+    const char *params;
+
+    if (match_policy(arg, "oldest", &params) && params == NULL) {
+        config->select = SELECT_OLDEST;
+        return true;
+    }
+    if (match_policy(arg, "random", &params)) {
+        config->select = SELECT_RANDOM;
+        if (params != NULL)
+            config->seed = strtoull(params, NULL, 10);
+        return true;
+    }
+    return false;
+}
+
+bool parse_cdb_policy(const char *arg, policy_config_t *config) {
+    const char *params;
+
+    if (match_policy(arg, "oldest", &params) && params == NULL) {
+        config->cdb = CDB_OLDEST;
+        return true;
+    }
+
+    if (match_policy(arg, "class", &params)) {
+        config->cdb = CDB_CLASS;
+        if (params == NULL)
+            params = "210";
+        // a permutation of the three classes
+        if (strlen(params) != 3)
+            return false;
+        bool seen[3] = { false, false, false };
+        for (int i = 0; i < 3; i++) {
+            int c = params[i] - '0';
+            if (c < 0 || c > 2 || seen[c])
+                return false;
+            seen[c] = true;
+            config->class_order[i] = c;
+        }
+        return true;
+    }
+
+    if (match_policy(arg, "random", &params)) {
+        config->cdb = CDB_RANDOM;
+        if (params != NULL)
+            config->seed = strtoull(params, NULL, 10);
+        return true;
+    }
+
+    if (match_policy(arg, "ports", &params)) {
+        config->cdb = CDB_PORTS;
+        memset(config->ports, 0, sizeof(config->ports));
+        if (params != NULL)
+            return sscanf(params, "%u:%u:%u", &config->ports[0], &config->ports[1], &config->ports[2]) == 3;
+        return true;
+    }
+    return false;
+}
+
+bool policy_check_ports(policy_config_t *config, uint64_t r) {
+    if (config->cdb != CDB_PORTS)
+        return true;
+
+    if (config->ports[0] + config->ports[1] + config->ports[2] == 0) {
+        for (int c = 0; c < 3; c++)
+            config->ports[c] = r / 3 + (c < (int) (r % 3));
+    }
+    return config->ports[0] && config->ports[1] && config->ports[2] &&
+           config->ports[0] + config->ports[1] + config->ports[2] == r;
+}
+
+std::string policy_config_string(const policy_config_t &config) {
+    std::ostringstream out;
+
+    if (config.select != SELECT_OLDEST) {
+        out << " select=" << select_kind_name(config.select);
+        if (config.select == SELECT_RANDOM)
+            out << ":" << config.seed;
+    }
+
+    if (config.cdb != CDB_OLDEST) {
+        out << " cdb=" << cdb_kind_name(config.cdb);
+        if (config.cdb == CDB_CLASS)
+            out << ":" << (int) config.class_order[0] << (int) config.class_order[1] << (int) config.class_order[2];
+        else if (config.cdb == CDB_RANDOM)
+            out << ":" << config.seed;
+        else if (config.cdb == CDB_PORTS)
+            out << ":" << config.ports[0] << ":" << config.ports[1] << ":" << config.ports[2];
+    }
+    return out.str();
+}
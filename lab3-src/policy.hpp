@@ -0,0 +1,174 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <string>
+
+/*
+ * Select and result bus policies
+ *
+ * The fused engine is a template over two policy types. The select policy
+ * orders the marked instructions competing for function units, the cdb
+ * policy decides which of the instructions finishing this cycle get a
+ * result bus. Policies are plain classes whose members inline into the
+ * core, so every policy pair is its own core without indirect calls.
+ * Policies with in_order set keep the window order, oldest first, and the
+ * core grants in its scan without collecting candidates; the pair of them
+ * is fused_core_t and has the stage engine's timing.
+ */
+
+enum select_kind_t { SELECT_OLDEST, SELECT_RANDOM };
+enum cdb_kind_t { CDB_OLDEST, CDB_CLASS, CDB_RANDOM, CDB_PORTS };
+
+// run time parameters of the policies
+struct policy_config_t {
+    select_kind_t select;
+    cdb_kind_t cdb;
+    uint64_t seed;              // of the random policies
+    uint8_t class_order[3];     // function unit classes by result bus priority, highest first
+    uint32_t ports[3];          // result buses of each class
+};
+
+#define DEFAULT_POLICY_SEED 1
+
+// oldest first for both, class order 210 and an even port split if switched
+inline policy_config_t default_policy_config() {
+    policy_config_t config = { SELECT_OLDEST, CDB_OLDEST, DEFAULT_POLICY_SEED, { 2, 1, 0 }, { 0, 0, 0 } };
+    return config;
+}
+
+// xorshift64* generator, the same sequence on every host
+struct policy_rng_t {
+    uint64_t state;
+
+    void seed(uint64_t s) { state = s ? s : 0x9e3779b97f4a7c15ULL; }
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dULL;
+    }
+
+    void shuffle(uint32_t *slots, size_t n) {
+        for (size_t i = n; i > 1; i--)
+            std::swap(slots[i - 1], slots[next() % i]);
+    }
+};
+
+/** SELECT policies: reorder the n window slots marked to fire */
+
+// oldest first
+struct select_oldest_t {
+    static const bool in_order = true;
+
+    void init(const policy_config_t &) { }
+    void order(uint32_t *, size_t) { }
+};
+
+// in a random order
+struct select_random_t {
+    static const bool in_order = false;
+
+    void init(const policy_config_t &config) { rng.seed(config.seed); }
+    void order(uint32_t *slots, size_t n) { rng.shuffle(slots, n); }
+
+    policy_rng_t rng;
+};
+
+/** CDB policies: move the window slots granted a bus to the front of the
+ *  n finishing ones (oldest first) and return how many there are, at most r */
+
+// oldest first
+struct cdb_oldest_t {
+    static const bool in_order = true;
+
+    void init(const policy_config_t &) { }
+
+    template <class entry_t>
+    size_t grant(uint32_t *, size_t n, const entry_t *, size_t r) { return std::min(n, r); }
+};
+
+// by function unit class in class_order, oldest first within a class
+struct cdb_class_t {
+    static const bool in_order = false;
+
+    void init(const policy_config_t &config) { std::copy(config.class_order, config.class_order + 3, order); }
+
+    template <class entry_t>
+    size_t grant(uint32_t *slots, size_t n, const entry_t *window, size_t r) {
+        size_t granted = 0;
+
+        for (int p = 0; p < 3; p++) {
+            for (size_t i = granted; i < n && granted < r; i++) {
+                if (window[slots[i]].op_code == order[p]) {
+                    std::rotate(slots + granted, slots + i, slots + i + 1);
+                    granted++;
+                }
+            }
+        }
+        return granted;
+    }
+
+    uint8_t order[3];
+};
+
+// in a random order
+struct cdb_random_t {
+    static const bool in_order = false;
+
+    void init(const policy_config_t &config) { rng.seed(config.seed); }
+
+    template <class entry_t>
+    size_t grant(uint32_t *slots, size_t n, const entry_t *, size_t r) {
+        rng.shuffle(slots, n);
+        return std::min(n, r);
+    }
+
+    policy_rng_t rng;
+};
+
+// every class has buses of its own, oldest first within a class
+struct cdb_ports_t {
+    static const bool in_order = false;
+
+    void init(const policy_config_t &config) { std::copy(config.ports, config.ports + 3, ports); }
+
+    template <class entry_t>
+    size_t grant(uint32_t *slots, size_t n, const entry_t *window, size_t) {
+        uint32_t used[3] = { 0, 0, 0 };
+        size_t granted = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            uint8_t op = window[slots[i]].op_code;
+            if (used[op] < ports[op]) {
+                used[op]++;
+                std::rotate(slots + granted, slots + i, slots + i + 1);
+                granted++;
+            }
+        }
+        return granted;
+    }
+
+    uint32_t ports[3];
+};
+
+const char *select_kind_name(select_kind_t kind);
+const char *cdb_kind_name(cdb_kind_t kind);
+
+// parse "oldest" or "random[:SEED]" into config
+bool parse_select_policy(const char *arg, policy_config_t *config);
+// parse "oldest", "class[:ORDER]" (e.g. 210, the default), "random[:SEED]" or
+// "ports[:P0:P1:P2]" (default: the buses split evenly) into config
+bool parse_cdb_policy(const char *arg, policy_config_t *config);
+
+// split r buses evenly over the classes if no ports were given
+// returns false unless every class has a port and they add up to r
+bool policy_check_ports(policy_config_t *config, uint64_t r);
+
+// policies as "select=... cdb=..." for the result cache key, empty for the defaults
+std::string policy_config_string(const policy_config_t &config);
+
+#endif /* POLICY_H */
@@ -1,21 +1,33 @@
+#include <algorithm>
 #include "procsim.hpp"
+#include "dcache.hpp"
+#include "bpred.hpp"
+#include "mem_stats.hpp"
+#include "metrics.hpp"
+#include "flight.hpp"
+#include "stalls.hpp"
 
 proc_settings_t cpu;
 
-std::vector<proc_inst_ptr_t> all_instrs;
+// timestamps of every fetched instruction, indexed by id - 1
+mem_vector_t<inst_timing_t, MEM_INSTRUCTIONS> all_timing;
 
-std::deque<proc_inst_ptr_t> dispatching_queue;
-std::vector<proc_inst_ptr_t> scheduling_queue;
+mem_deque_t<proc_fetched_t, MEM_QUEUES> dispatching_queue;
+mem_vector_t<proc_entry_t, MEM_QUEUES> scheduling_queue;
 int scheduling_queue_limit;
 
-std::unordered_map<uint32_t, register_info_t> register_file;
+std::unordered_map<uint32_t, register_info_t, std::hash<uint32_t>, std::equal_to<uint32_t>,
+                   mem_allocator_t<std::pair<const uint32_t, register_info_t>, MEM_QUEUES> > register_file;
 
-std::vector<proc_cdb_t> cdb;
+mem_vector_t<proc_cdb_t, MEM_QUEUES> cdb;
 std::unordered_map<uint32_t, uint32_t> fu_cnt;
 std::unordered_map<uint32_t, rs_status_t> fu0;
 std::unordered_map<uint32_t, rs_status_t> fu1;
 std::unordered_map<uint32_t, rs_status_t> fu2;
 
+dcache_t *proc_dcache = NULL;
+bpred_t *proc_bpred = NULL;
+
 
 /**
  * Subroutine for initializing the processor. You many add and initialize any global or heap
@@ -35,6 +47,13 @@ void setup_proc(proc_stats_t *p_stats, uint64_t r, uint64_t k0, uint64_t k1, uin
     p_stats->cycle_count = 1;
 
     cpu = proc_settings_t(f, begin_dump, end_dump);
+    reset_read_instruction();
+
+    all_timing.clear();
+    dispatching_queue.clear();
+    scheduling_queue.clear();
+    register_file.clear();
+    cdb.clear();
 
     for(i = 0; i < 64; i++){
         register_file[i] = {true};
@@ -65,6 +84,12 @@ void setup_proc(proc_stats_t *p_stats, uint64_t r, uint64_t k0, uint64_t k1, uin
  * @p_stats Pointer to the statistics structure
  */
 void complete_proc(proc_stats_t *p_stats) {
+    if (proc_dcache != NULL) {
+        p_stats->l1_accesses = proc_dcache->l1.accesses;
+        p_stats->l1_misses = proc_dcache->l1.misses;
+        p_stats->l2_accesses = proc_dcache->l2.accesses;
+        p_stats->l2_misses = proc_dcache->l2.misses;
+    }
     p_stats->avg_disp_size = p_stats->sum_disp_size / p_stats->cycle_count;
     p_stats->avg_inst_retired = p_stats->retired_instruction * 1.f / p_stats->cycle_count; 
 }
@@ -77,59 +102,121 @@ void complete_proc(proc_stats_t *p_stats) {
  * @p_stats Pointer to the statistics structure
  */
 void run_proc(proc_stats_t* p_stats) {   
-    while (!cpu.finished) {
-        // invoke pipline for current cycle
-        state_update(p_stats, cycle_half_t::FIRST);
-        execute(p_stats, cycle_half_t::FIRST);
-        schedule(p_stats, cycle_half_t::FIRST);
-        dispatch(p_stats, cycle_half_t::FIRST);
-
-        state_update(p_stats, cycle_half_t::SECOND);
-
-        if (!cpu.finished){
-            execute(p_stats, cycle_half_t::SECOND);
-            schedule(p_stats, cycle_half_t::SECOND);
-            dispatch(p_stats, cycle_half_t::SECOND);
-            instr_fetch_and_decode(p_stats, cycle_half_t::SECOND);            
-        
-            p_stats->cycle_count++;
-        }
+    while (step_proc(p_stats)) {
+        if (proc_metrics != NULL && proc_metrics->due())
+            proc_metrics->publish(p_stats, cpu.read_cnt, dispatching_queue.size(), scheduling_queue.size());
+        if (proc_flight != NULL)
+            proc_flight->poll(p_stats);
     }
     
     // print result
     if(cpu.begin_dump > 0){
         std::cout << "INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE" << std::endl;
 
-        for (auto &i : all_instrs){
-            if(i->id >= cpu.begin_dump && i->id <= cpu.end_dump){
-                std::cout << i->id << "\t"
-                          << i->cycle_fetch_decode << "\t" 
-                          << i->cycle_dispatch << "\t"
-                          << i->cycle_schedule << "\t"
-                          << i->cycle_execute << "\t"
-                          << i->cycle_status_update << std::endl;  
-            }
+        for (uint64_t id = cpu.begin_dump; id <= cpu.end_dump && id <= all_timing.size(); id++){
+            const inst_timing_t &i = all_timing[id - 1];
+            std::cout << id << "\t"
+                      << i.cycle_fetch_decode << "\t" 
+                      << i.cycle_dispatch << "\t"
+                      << i.cycle_schedule << "\t"
+                      << i.cycle_execute << "\t"
+                      << i.cycle_status_update << std::endl;  
         }
         std::cout << std::endl;
     }
 }
 
+/**
+ * Subroutine that simulates a single cycle
+ *
+ * @p_stats Pointer to the statistics structure
+ * @return false once every instruction retired
+ */
+bool step_proc(proc_stats_t* p_stats) {
+    if (cpu.finished)
+        return false;
+
+    // invoke pipline for current cycle
+    state_update(p_stats, cycle_half_t::FIRST);
+    execute(p_stats, cycle_half_t::FIRST);
+    schedule(p_stats, cycle_half_t::FIRST);
+    dispatch(p_stats, cycle_half_t::FIRST);
+
+    state_update(p_stats, cycle_half_t::SECOND);
+
+    if (cpu.finished)
+        return false;
+
+    execute(p_stats, cycle_half_t::SECOND);
+    schedule(p_stats, cycle_half_t::SECOND);
+    dispatch(p_stats, cycle_half_t::SECOND);
+    instr_fetch_and_decode(p_stats, cycle_half_t::SECOND);            
+
+    p_stats->cycle_count++;
+    return true;
+}
+
+const inst_timing_t *proc_timing(uint32_t id) {
+    if (id == 0 || id > all_timing.size())
+        return NULL;
+    return &all_timing[id - 1];
+}
+
+void dump_proc_state(std::ostream &os) {
+    os << "dispatch queue: " << dispatching_queue.size()
+       << " scheduling queue: " << scheduling_queue.size()
+       << " fetched: " << cpu.read_cnt << "\n";
+
+    // registers never written since setup have no tag, leave them out
+    os << "busy registers:";
+    std::vector<uint32_t> regs;
+    for (auto &reg : register_file) {
+        if (!reg.second.ready && reg.second.tag)
+            regs.push_back(reg.first);
+    }
+    std::sort(regs.begin(), regs.end());
+    for (auto reg : regs)
+        os << " r" << reg << "=" << register_file[reg].tag;
+    os << "\n";
+
+    os << "INST\tOP\tTAG0\tTAG1\tFLAGS\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n";
+    for (auto &instr : scheduling_queue) {
+        const inst_timing_t &t = all_timing[instr.id - 1];
+        os << instr.id << "\t" << (int) instr.op_code << "\t"
+           << instr.src_tag[0] << "\t" << instr.src_tag[1] << "\t"
+           << (instr.flags & PROC_SRC0_READY ? '0' : '-') << (instr.flags & PROC_SRC1_READY ? '1' : '-')
+           << (instr.flags & PROC_FIRE ? 'm' : '-') << (instr.flags & PROC_FIRED ? 'f' : '-')
+           << (instr.flags & PROC_EXECUTED ? 'x' : '-') << "\t"
+           << t.cycle_fetch_decode << "\t" << t.cycle_dispatch << "\t"
+           << t.cycle_schedule << "\t" << t.cycle_execute << "\t"
+           << t.cycle_status_update << "\n";
+    }
+}
+
+// pipeline event for the flight recorder, retiring instructions go to proc_flight->retire()
+static inline void flight(flight_kind_t kind, uint32_t tag, uint64_t cycle, uint8_t op_code) {
+    if (proc_flight != NULL && proc_flight->every_event())
+        proc_flight->record(kind, tag, cycle, op_code);
+}
+
 /** STATE UPDATE stage */
 void state_update(proc_stats_t* p_stats, const cycle_half_t &half) {
     if (half == cycle_half_t::FIRST) {
         // record instr entry cycle
-        for (auto instr : scheduling_queue) {
-            if (instr != nullptr && instr->executed && !instr->cycle_status_update) {
-                instr->cycle_status_update = p_stats->cycle_count;              
+        for (auto &instr : scheduling_queue) {
+            if ((instr.flags & (PROC_EXECUTED | PROC_RETIRING)) == PROC_EXECUTED) {
+                instr.flags |= PROC_RETIRING;
+                all_timing[instr.id - 1].cycle_status_update = p_stats->cycle_count;              
             }
         }        
     } else {
         // delete instructions from scheduling queue
         auto it = scheduling_queue.begin();
         while(it != scheduling_queue.end()){
-            auto instr = *it;
-
-            if(instr->cycle_status_update){
+            if(it->flags & PROC_RETIRING){
+                if (proc_flight != NULL)
+                    proc_flight->retire(it->id, it->op_code, all_timing[it->id - 1],
+                                        it->cycle_ready - it->latency, p_stats->cycle_count);
                 it = scheduling_queue.erase(it);
                 p_stats->retired_instruction++;
             }else{
@@ -146,13 +233,13 @@ void state_update(proc_stats_t* p_stats, const cycle_half_t &half) {
 // find free cdb to update the tag 
 // 0 - No free cdb
 // 1 - Free cdb found and updated
-int find_free_cdb(proc_inst_ptr_t instr){
+int find_free_cdb(const proc_entry_t &instr){
 		int i, size = cdb.size();
 		for (i=0; i<size; i++) {
             if (cdb[i].free == true) {
                 cdb[i].free = false;
-				cdb[i].reg  = instr->dest_reg;
-                cdb[i].tag = instr->id;
+				cdb[i].reg  = instr.dest_reg;
+                cdb[i].tag = instr.id;
                 return 1;
             }
         }
@@ -174,17 +261,17 @@ void update_instruction_from_cdb(){
 		int i, size = cdb.size();
 		for (i=0; i<size; i++) {
             if (cdb[i].free == false) {
-        		for (auto instr : scheduling_queue) {
-					if (instr->src_ready[0] == false) {
-						if (instr->src_tag[0] == cdb[i].tag) {
-							instr->src_tag[0] = 0;
-							instr->src_ready[0] = true;
+        		for (auto &instr : scheduling_queue) {
+					if (!(instr.flags & PROC_SRC0_READY)) {
+						if (instr.src_tag[0] == cdb[i].tag) {
+							instr.src_tag[0] = 0;
+							instr.flags |= PROC_SRC0_READY;
 						}
 					}
-					if (instr->src_ready[1] == false) {
-						if (instr->src_tag[1] == cdb[i].tag) {
-							instr->src_tag[1] = 0;
-							instr->src_ready[1] = true;
+					if (!(instr.flags & PROC_SRC1_READY)) {
+						if (instr.src_tag[1] == cdb[i].tag) {
+							instr.src_tag[1] = 0;
+							instr.flags |= PROC_SRC1_READY;
 						}
 					}
 				}
@@ -195,20 +282,24 @@ void update_instruction_from_cdb(){
 void execute(proc_stats_t* p_stats, const cycle_half_t &half) {
     if (half == cycle_half_t::FIRST) {
         // record instr entry cycle
-        for (auto instr : scheduling_queue) {            
-            if (instr != nullptr && instr->fired == true && !instr->cycle_execute) {
+        for (auto &instr : scheduling_queue) {            
+            if ((instr.flags & (PROC_FIRED | PROC_EXECUTED)) == PROC_FIRED &&
+                p_stats->cycle_count >= instr.cycle_ready) {
 				// update the CDB with the tag
-                // if (instr->dest_reg != -1) {
+                // if (instr.dest_reg != -1) {
                     if (!find_free_cdb(instr)) {
+                        if (proc_stalls != NULL)
+                            proc_stalls->charge(STALL_CDB, instr.id);
                         continue;
                     }
-            		register_file[instr->dest_reg].ready = true;
-            		register_file[instr->dest_reg].tag = 0;
+            		register_file[instr.dest_reg].ready = true;
+            		register_file[instr.dest_reg].tag = 0;
                // }
-                instr->cycle_execute = p_stats->cycle_count;                  
+                all_timing[instr.id - 1].cycle_execute = p_stats->cycle_count;                  
+                flight(FLIGHT_CDB, instr.id, p_stats->cycle_count, instr.op_code);
 
-                instr->executed = true;
-				fu_cnt[instr->op_code] = fu_cnt[instr->op_code] + 1;
+                instr.flags |= PROC_EXECUTED;
+				fu_cnt[instr.op_code] = fu_cnt[instr.op_code] + 1;
             }
         }
     } else {
@@ -218,8 +309,8 @@ void execute(proc_stats_t* p_stats, const cycle_half_t &half) {
 }
 
 /** SCHEDULE stage */
-int instr_src_available(proc_inst_ptr_t instr) {
-    if ((instr->src_ready[0] == true) && (instr->src_ready[1] == true)) {
+int instr_src_available(const proc_entry_t &instr) {
+    if ((instr.flags & (PROC_SRC0_READY | PROC_SRC1_READY)) == (PROC_SRC0_READY | PROC_SRC1_READY)) {
         return 1;
     }
     return 0;
@@ -228,33 +319,37 @@ int instr_src_available(proc_inst_ptr_t instr) {
 void schedule(proc_stats_t* p_stats, const cycle_half_t &half) {
     if (half == cycle_half_t::FIRST) {
         // record instr entry cycle
-        for (auto instr : scheduling_queue) {
-            if (instr == nullptr || instr->fire)
+        for (auto &instr : scheduling_queue) {
+            if (instr.flags & PROC_FIRE)
                 continue;
             
-            if (!instr->cycle_schedule) {
-                instr->cycle_schedule = p_stats->cycle_count;                 
+            if (!(instr.flags & PROC_SCHEDULED)) {
+                instr.flags |= PROC_SCHEDULED;
+                all_timing[instr.id - 1].cycle_schedule = p_stats->cycle_count;                 
             } 
 			
 			if (!instr_src_available(instr)) {
+                if (proc_stalls != NULL)
+                    proc_stalls->charge(STALL_SOURCES, instr.id);
 				continue;
 			}
             
-            instr->fire = true;
+            instr.flags |= PROC_FIRE;
         } 
     } else {        
         // fire all marked instructions if possible
-        for (auto instr : scheduling_queue) {
-            if (instr == nullptr)
-                continue;
-
-            if (instr->fire && !instr->fired) {
-				if (!fu_cnt[instr->op_code]) {
+        for (auto &instr : scheduling_queue) {
+            if ((instr.flags & (PROC_FIRE | PROC_FIRED)) == PROC_FIRE) {
+				if (!fu_cnt[instr.op_code]) {
+                    if (proc_stalls != NULL)
+                        proc_stalls->charge(STALL_FU, instr.id);
 					continue;
 				} else {
-					--fu_cnt[instr->op_code];
+					--fu_cnt[instr.op_code];
 				}
-                instr->fired = true;
+                instr.flags |= PROC_FIRED;
+                instr.cycle_ready = p_stats->cycle_count + instr.latency;
+                flight(FLIGHT_FIRE, instr.id, p_stats->cycle_count, instr.op_code);
             }
         }
     }
@@ -262,62 +357,52 @@ void schedule(proc_stats_t* p_stats, const cycle_half_t &half) {
 
 /** DISPATCH stage */
 // check data dependency from the register file  
-void update_instr(proc_inst_ptr_t instr) {
-    if (instr->src_reg[0] != -1) { 
-        if (register_file[instr->src_reg[0]].ready == false) { 
-            instr->src_tag[0] = register_file[instr->src_reg[0]].tag; 
-            instr->src_ready[0] = false; 
-        } else { 
-            instr->src_ready[0] = true; 
-            instr->src_tag[0] = 0; 
-        } 
-    } else {
-        instr->src_ready[0] = true; 
-        instr->src_tag[0] = 0; 
-	}
- 
-    if (instr->src_reg[1] != -1) { 
-        if (register_file[instr->src_reg[1]].ready == false) { 
-            instr->src_tag[1] = register_file[instr->src_reg[1]].tag; 
-            instr->src_ready[1] = false; 
+void update_instr(const proc_fetched_t &fetched, proc_entry_t &instr) {
+    for (int i = 0; i < 2; i++) {
+        uint8_t ready = (i == 0) ? PROC_SRC0_READY : PROC_SRC1_READY;
+
+        if (fetched.src_reg[i] != -1 && register_file[fetched.src_reg[i]].ready == false) { 
+            instr.src_tag[i] = register_file[fetched.src_reg[i]].tag; 
         } else { 
-            instr->src_ready[1] = true; 
-            instr->src_tag[1] = 0; 
+            instr.src_tag[i] = 0; 
+            instr.flags |= ready;
         } 
-    } else {
-        instr->src_ready[1] = true; 
-        instr->src_tag[1] = 0; 
-	}
+    }
 }
 
 void dispatch(proc_stats_t* p_stats, const cycle_half_t &half) {
     if (half == cycle_half_t::FIRST) {
-		int available_size = scheduling_queue_limit - scheduling_queue.size();
+		uint64_t available_size = scheduling_queue_limit - scheduling_queue.size();
         if (p_stats->max_disp_size < dispatching_queue.size())
             p_stats->max_disp_size = dispatching_queue.size();
             
         p_stats->sum_disp_size += dispatching_queue.size();
 
-        for (auto instr : dispatching_queue) {
-			if (available_size != 0) {
-				instr->reserved = true;
-				--available_size;
-			}
-        }
+        // the oldest instructions get the free slots
+        cpu.dispatch_reserved = std::min<uint64_t>(available_size, dispatching_queue.size());
     } else {
-        while (!dispatching_queue.empty()) {
-            auto instr = dispatching_queue.front();
-            
-            if (!instr->reserved)
-                break; 
-
-			update_instr(instr);
-            if (instr->dest_reg != -1) {
-            	register_file[instr->dest_reg].ready = false;
-            	register_file[instr->dest_reg].tag = instr->id;
+        for (; cpu.dispatch_reserved > 0; cpu.dispatch_reserved--) {
+            const proc_fetched_t &fetched = dispatching_queue.front();
+            proc_entry_t instr;
+
+            instr.id = fetched.id;
+            instr.latency = fetched.latency;
+            instr.cycle_ready = 0;
+            instr.dest_reg = fetched.dest_reg;
+            instr.op_code = fetched.op_code;
+            instr.flags = 0;
+
+			update_instr(fetched, instr);
+            // every cycle past the first in the dispatch queue lacked a slot
+            if (proc_stalls != NULL && p_stats->cycle_count > all_timing[fetched.id - 1].cycle_dispatch)
+                proc_stalls->charge(STALL_SLOT, fetched.id, p_stats->cycle_count - all_timing[fetched.id - 1].cycle_dispatch);
+            if (fetched.dest_reg != -1) {
+            	register_file[fetched.dest_reg].ready = false;
+            	register_file[fetched.dest_reg].tag = fetched.id;
             }
 			
             scheduling_queue.push_back(instr);            
+            flight(FLIGHT_DISPATCH, instr.id, p_stats->cycle_count, instr.op_code);
 
             dispatching_queue.pop_front();
         }        
@@ -325,43 +410,90 @@ void dispatch(proc_stats_t* p_stats, const cycle_half_t &half) {
 }
 
 /** INSTR-FETCH & DECODE stage */
+// look up the data cache for the loads and stores of a fetch group
+// that starts at dispatch queue position first
+void dcache_lookup(const std::vector<proc_inst_t> &group, size_t first) {
+    static std::vector<uint64_t> addr;
+    static std::vector<uint8_t> is_load;
+    static std::vector<uint32_t> latency;
+    static std::vector<size_t> slot;
+
+    addr.clear();
+    is_load.clear();
+    slot.clear();
+    for (size_t i = 0; i < group.size(); i++) {
+        if (group[i].mem_read || group[i].mem_write) {
+            addr.push_back(group[i].mem_addr);
+            is_load.push_back(group[i].mem_read);
+            slot.push_back(first + i);
+        }
+    }
+
+    latency.assign(addr.size(), 1);
+    proc_dcache->access_batch(addr.data(), is_load.data(), latency.data(), addr.size());
+    for (size_t i = 0; i < slot.size(); i++)
+        dispatching_queue[slot[i]].latency = latency[i];
+}
+
 void instr_fetch_and_decode(proc_stats_t* p_stats, const cycle_half_t &half) {
     if (half == cycle_half_t::SECOND) {          
+        static std::vector<proc_inst_t> group;
+        size_t group_start = dispatching_queue.size();
+
+        group.clear();
+
+        // a mispredicted branch blocks fetch until it executes
+        if (cpu.fetch_redirect != 0) {
+            if (!all_timing[cpu.fetch_redirect - 1].cycle_execute) {
+                p_stats->fetch_stall_cycles++;
+                return;
+            }
+            cpu.fetch_redirect = 0;
+        }
+
         // read the next instructions 
         if (!cpu.read_finished){
             for (uint64_t i = 0; i < cpu.f; i++) { 
-                proc_inst_ptr_t instr = proc_inst_ptr_t(new proc_inst_t());
-              
-                all_instrs.push_back(instr);
+                proc_inst_t instr = proc_inst_t();
                                 
-                if (read_instruction(instr.get())) { 
-                    // reset counters
-                    instr->id = cpu.read_cnt + 1;
-
-                    instr->fire = false;
-                    instr->fired = false;
-                    instr->executed = false;
-
-                    instr->cycle_fetch_decode = p_stats->cycle_count;
-                    instr->cycle_dispatch = p_stats->cycle_count + 1;
-                    instr->cycle_schedule = 0;
-                    instr->cycle_execute = 0;
-                    instr->cycle_status_update = 0;                               
+                if (read_instruction(&instr)) { 
+                    proc_fetched_t fetched;
+                    inst_timing_t timing = inst_timing_t();
+
+                    fetched.id = cpu.read_cnt + 1;
+                    fetched.latency = 1;
+                    fetched.dest_reg = instr.dest_reg;
+                    fetched.src_reg[0] = instr.src_reg[0];
+                    fetched.src_reg[1] = instr.src_reg[1];
+                    fetched.op_code = instr.op_code;
+
+                    timing.cycle_fetch_decode = p_stats->cycle_count;
+                    timing.cycle_dispatch = p_stats->cycle_count + 1;
                     
-                    dispatching_queue.push_back(instr);                                              
+                    dispatching_queue.push_back(fetched);                                              
+                    all_timing.push_back(timing);
+                    group.push_back(instr);
                     cpu.read_cnt++;                     
+                    flight(FLIGHT_FETCH, fetched.id, p_stats->cycle_count, fetched.op_code);
+                    if (proc_stalls != NULL)
+                        proc_stalls->fetch(fetched.id, instr.instruction_address);
+
+                    if (proc_bpred != NULL && instr.op_code == 2) {
+                        p_stats->branches++;
+                        if (proc_bpred->predict_update(instr.instruction_address, instr.br_taken) != instr.br_taken) {
+                            p_stats->mispredictions++;
+                            cpu.fetch_redirect = fetched.id;
+                            break;
+                        }
+                    }
                 } else {
-                    all_instrs.pop_back();
-                
                     cpu.read_finished = true;  
                     break;
                 }
             }
         }   
+
+        if (proc_dcache != NULL && !group.empty())
+            dcache_lookup(group, group_start);
     }
 }
-
-
-
-
-
@@ -7,6 +7,9 @@
 #define DEFAULT_R 8
 #define DEFAULT_F 4
 
+// bump whenever a change alters simulated timing, it keys the result cache
+#define PROCSIM_VERSION "3.3"
+
 #include <cstdint>
 #include <cstdio>
 #include <iostream>
@@ -29,6 +32,20 @@ typedef enum Op_Type_Enum{
 
 enum cycle_half_t { FIRST, SECOND };
 
+// functional unit class of a trace op type: k0 for ALU and other ops,
+// k1 for loads and stores, k2 for branches
+inline int32_t op_class(uint8_t op_type) {
+    switch (op_type) {
+    case OP_LD:
+    case OP_ST:
+        return 1;
+    case OP_CBR:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
 /* Data structure for Trace Record */ 
 typedef struct Trace_Rec_Struct {
     uint64_t inst_addr;  // instruction address 
@@ -48,32 +65,61 @@ typedef struct Trace_Rec_Struct {
     uint64_t br_target;  // Target Address of Branch
 } Trace_Rec;
 
-// our extended instruction structure
+// a decoded trace record
 typedef struct _proc_inst_t
 {
     uint32_t instruction_address;
     int32_t op_code;
     int32_t dest_reg;
     int32_t src_reg[2];
-    
-    uint32_t id;
-    uint64_t dest_tag;
-    uint64_t src_tag[2];
-    bool src_ready[2];
-    
-    bool reserved;
-    bool fire;
-    bool fired;
-    bool executed;
-    
+
+    uint64_t mem_addr;
+    bool mem_read;
+    bool mem_write;
+
+    bool br_taken;
+} proc_inst_t;
+
+// per-instruction timestamps as printed in the timing dump
+struct inst_timing_t {
     uint64_t cycle_fetch_decode;
     uint64_t cycle_dispatch;
     uint64_t cycle_schedule;
     uint64_t cycle_execute;
     uint64_t cycle_status_update;
-} proc_inst_t;
+};
+
+// a fetched instruction waiting in the dispatch queue
+struct proc_fetched_t {
+    uint32_t id;
+    // cycles from firing until the result can go on a cdb
+    uint32_t latency;
+    int16_t dest_reg;
+    int16_t src_reg[2];
+    uint8_t op_code;
+};
 
-typedef std::shared_ptr<proc_inst_t> proc_inst_ptr_t;
+// a scheduling queue entry: only the state the stages look at every
+// cycle, the timestamps live in a separate array indexed by id
+struct proc_entry_t {
+    uint32_t id;
+    uint32_t src_tag[2];
+    uint32_t latency;
+    uint64_t cycle_ready;
+    int16_t dest_reg;
+    uint8_t op_code;
+    uint8_t flags;
+};
+
+enum proc_flag_t {
+    PROC_SRC0_READY = 1,
+    PROC_SRC1_READY = 2,
+    PROC_SCHEDULED = 4,
+    PROC_FIRE = 8,
+    PROC_FIRED = 16,
+    PROC_EXECUTED = 32,
+    PROC_RETIRING = 64
+};
 
 typedef struct _proc_stats_t
 {
@@ -83,6 +129,17 @@ typedef struct _proc_stats_t
     unsigned long max_disp_size;
     double sum_disp_size;
     float avg_disp_size;
+
+    // data cache model, zero when it is disabled
+    unsigned long l1_accesses;
+    unsigned long l1_misses;
+    unsigned long l2_accesses;
+    unsigned long l2_misses;
+
+    // branch prediction, zero when it is disabled
+    unsigned long branches;
+    unsigned long mispredictions;
+    unsigned long fetch_stall_cycles;
 } proc_stats_t;
 
 // a cdb representation
@@ -97,7 +154,8 @@ struct proc_settings_t {
     proc_settings_t() { }
     proc_settings_t(uint64_t f, uint64_t begin_dump, uint64_t end_dump) 
         : f(f), begin_dump(begin_dump), end_dump(end_dump),
-        read_cnt(0), read_finished(false), finished(false) { }
+        read_cnt(0), read_finished(false), finished(false),
+        fetch_redirect(0), dispatch_reserved(0) { }
 
     uint64_t f;
 
@@ -107,6 +165,12 @@ struct proc_settings_t {
     uint64_t read_cnt;
     bool read_finished;
     bool finished;
+
+    // id of the mispredicted branch fetch is waiting on, 0 if none
+    uint32_t fetch_redirect;
+
+    // dispatch queue entries holding a scheduling queue slot this cycle
+    uint64_t dispatch_reserved;
 };
 
 struct register_info_t {
@@ -121,11 +185,27 @@ struct rs_status_t {
 	uint64_t src_tag[2];
 };
 
+class dcache_t;
+class bpred_t;
+
+// data cache model used for loads and stores, NULL when disabled
+extern dcache_t *proc_dcache;
+// branch predictor used at fetch, NULL for perfect prediction
+extern bpred_t *proc_bpred;
+
 bool read_instruction(proc_inst_t* p_inst);
+// drop the instructions read ahead from a previous trace
+void reset_read_instruction();
 
 void setup_proc(proc_stats_t *p_stats, uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f, uint64_t begin_dump, uint64_t end_dump);
 void complete_proc(proc_stats_t* p_stats);
 void run_proc(proc_stats_t* p_stats);
+bool step_proc(proc_stats_t* p_stats);
+
+// timestamps of the instruction with this id, NULL if it wasn't fetched yet
+const inst_timing_t *proc_timing(uint32_t id);
+// print the scheduling queue and busy registers
+void dump_proc_state(std::ostream &os);
 
 // our pipeline stages
 void state_update(proc_stats_t* p_stats, const cycle_half_t &half);
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include "daemon.hpp"
+
+// copy n bytes of the response to out
+static bool relay(int fd, uint64_t n, FILE *out) {
+    std::vector<char> buf(1 << 16);
+    while (n > 0) {
+        size_t chunk = std::min<uint64_t>(n, buf.size());
+        if (!daemon_read(fd, buf.data(), chunk))
+            return false;
+        fwrite(buf.data(), 1, chunk, out);
+        n -= chunk;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) && argc == 2) {
+        printf("procsim-client [PROCSIM OPTIONS]\n");
+        printf("Runs procsim with the options in the daemon started with procsim --daemon,\n");
+        printf("which listens on $PROCSIM_SOCKET or /tmp/procsim-UID.sock\n");
+        return 0;
+    }
+
+    std::string socket_path = daemon_socket_path();
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path.c_str());
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "No daemon on %s, start one with procsim --daemon\n", socket_path.c_str());
+        return 1;
+    }
+
+    /* Send the working directory and the command line */
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("getcwd");
+        return 1;
+    }
+    std::string payload(cwd, strlen(cwd) + 1);
+    payload.append("procsim", sizeof("procsim"));
+    for (int i = 1; i < argc; i++)
+        payload.append(argv[i], strlen(argv[i]) + 1);
+
+    daemon_request_t request;
+    memcpy(request.magic, DAEMON_REQUEST_MAGIC, sizeof(request.magic));
+    request.size = payload.size();
+    if (!daemon_write(fd, &request, sizeof(request)) || !daemon_write(fd, payload.data(), payload.size())) {
+        fprintf(stderr, "Unable to send the job to %s\n", socket_path.c_str());
+        return 1;
+    }
+
+    /* Wait for the report */
+    daemon_response_t response;
+    if (!daemon_read(fd, &response, sizeof(response)) ||
+        memcmp(response.magic, DAEMON_RESPONSE_MAGIC, sizeof(response.magic)) != 0 ||
+        !relay(fd, response.out_size, stdout) || !relay(fd, response.err_size, stderr)) {
+        fprintf(stderr, "The daemon on %s closed the connection\n", socket_path.c_str());
+        return 1;
+    }
+    close(fd);
+    return response.status;
+}
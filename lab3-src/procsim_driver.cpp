@@ -5,10 +5,28 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include "procsim.hpp"
+#include "procsim_driver.hpp"
+#include "trace_source.hpp"
+#include "trace_shm.hpp"
+#include "trace_decode.hpp"
+#include "result_cache.hpp"
+#include "dcache.hpp"
+#include "bpred.hpp"
+#include "fused.hpp"
+#include "mem_stats.hpp"
+#include "metrics.hpp"
+#include "flight.hpp"
+#include "signature.hpp"
+#include "stalls.hpp"
+#include "daemon.hpp"
+#include <sstream>
 
-FILE* inFile;
+trace_source_t* trace_src;
+// records of trace_src read ahead and decoded for read_instruction
+static trace_decoder_t stage_decoder;
 
 void print_help_and_exit(void) {
     printf("procsim [OPTIONS]\n");
@@ -18,6 +36,64 @@ void print_help_and_exit(void) {
     printf("  -f N\t\tNumber of instructions to fetch\n");
     printf("  -r R\t\tNumber of result buses\n");
     printf("  -i traces/file.trace\n");
+    printf("\t\t- or a FIFO streams raw or gzip'ed records as they are produced\n");
+    printf("\t\tSeveral -i options simulate the traces in parallel\n");
+    printf("  -s N\t\tSkip the first N instructions of the trace\n");
+    printf("  -m manifest\tSimulate the traces listed in a manifest\n");
+    printf("  -o dir\t\tDirectory for the per-trace outputs of a batch\n");
+    printf("  -p N\t\tNumber of batch worker processes (default: host cpus)\n");
+    printf("  --shm\t\tShare the decoded trace with concurrent procsim processes\n");
+    printf("  --l1=SIZE:WAYS:LAT\tModel an L1 data cache (e.g. 32k:8:2)\n");
+    printf("  --l2=SIZE:WAYS:LAT\tModel an L2 data cache behind the L1\n");
+    printf("  --mem-latency=N\tLatency of an access missing all caches (default: %d)\n", DEFAULT_MEM_LATENCY);
+    printf("  --bpred=NAME[:BITS]\tPredict branches with bimodal, gshare or tage using\n");
+    printf("\t\t2^BITS entry tables (default: %d), fetch stalls on mispredicts\n", DEFAULT_BPRED_BITS);
+    printf("  --engine=NAME\tstage (default) or fused, a faster engine with the same timing,\n");
+    printf("\t\tor diff to run both in lockstep and stop at the first divergence\n");
+    printf("  --model=NAME\tdetailed (default) simulates, interval estimates the cycles from\n");
+    printf("\t\tone pass over the trace with an analytical model\n");
+    printf("  --multicore\tRun every trace on its own core and host thread (fused engine)\n");
+    printf("  --quantum=N\tCycles between multi-core synchronizations (default: %d)\n", DEFAULT_QUANTUM);
+    printf("  --mem-stats\tReport live and peak memory per subsystem, allocations and\n");
+    printf("\t\tpeak RSS (always simulates, bypassing the result cache)\n");
+    printf("  --metrics[=N]\tPublish progress for procsim-top every N cycles (default: %d)\n",
+           DEFAULT_METRICS_INTERVAL);
+    printf("  --flight=FILE\tWrite the flight recorder's last pipeline events to FILE as a\n");
+    printf("\t\tChrome trace at the end (also on SIGUSR1 and failed invariants)\n");
+    printf("  --flight-events=N\tRecord every pipeline event, keeping the last N, instead of\n");
+    printf("\t\tthe last %d retired instructions\n", FLIGHT_RETIRE_SLOTS);
+    printf("  --no-flight\tTurn the flight recorder off, SIGUSR1 then ends the run\n");
+    printf("  --signature=FILE\tWrite a hash of every instruction's timing and the final\n");
+    printf("\t\tstats to FILE instead of the -b/-e dump\n");
+    printf("  --check-signature=FILE\tCompare the run with a signature, reporting the first\n");
+    printf("\t\tinterval that differs\n");
+    printf("  --signature-interval=N\tInstructions per signature checkpoint (default: %d)\n",
+           DEFAULT_SIGNATURE_INTERVAL);
+    printf("  --search=IPC\tSearch for the fewest resources reaching IPC over all the traces\n");
+    printf("\t\tand print the pareto frontier (fused engine, -p parallel runs)\n");
+    printf("  --search-max=R:K0:K1:K2:F\tUpper bounds of the search (default: %s)\n",
+           DEFAULT_SEARCH_BOUNDS);
+    printf("  --lockstep=LIST\tSimulate the R:K0:K1:K2 configurations of LIST (comma\n");
+    printf("\t\tseparated) side by side over one pass of the trace (fused engine)\n");
+    printf("  --stalls[=N]\tAttribute the cycles instructions wait to their cause and print\n");
+    printf("\t\tthe N addresses that wait the longest (default: %d, stage engine)\n", DEFAULT_STALL_TOP);
+    printf("  --select=POLICY\tOrder in which marked instructions get function units:\n");
+    printf("\t\toldest (default) or random[:SEED] (fused engine)\n");
+    printf("  --cdb=POLICY\tOrder in which finished instructions get result buses: oldest\n");
+    printf("\t\t(default), class[:ORDER] by function unit class (default: 210),\n");
+    printf("\t\trandom[:SEED] or ports[:P0:P1:P2] buses per class (default: R split\n");
+    printf("\t\tevenly) (fused engine)\n");
+    printf("  --simpoints=FILE\tSimulate only the weighted intervals of FILE (from\n");
+    printf("\t\ttracetool simpoint) and estimate the whole-trace IPC\n");
+    printf("  --warmup=N\tInstructions simulated before each interval (default: one interval)\n");
+    printf("  --no-cache\tDon't use the result cache\n");
+    printf("  --verify-cache\tSimulate and check the result against the cache\n");
+    printf("  --cache-dir=DIR\tResult cache directory (default: $PROCSIM_CACHE_DIR\n");
+    printf("\t\tor ~/.cache/procsim)\n");
+    printf("  --daemon[=SOCKET]\tServe the jobs of procsim-client on SOCKET (default:\n");
+    printf("\t\t$PROCSIM_SOCKET or /tmp/procsim-UID.sock), -p of them at a time\n");
+    printf("  --trace-cache=MB\tDecoded traces the daemon keeps in memory (default: %d)\n",
+           DEFAULT_TRACE_CACHE_MB);
     printf("  -h\t\tThis helpful output\n");
     exit(0);
 }
@@ -28,101 +104,632 @@ void print_help_and_exit(void) {
 //  returns true if an instruction was read successfully
 //
 bool read_instruction(proc_inst_t* p_inst){
-    if(inFile == NULL){
+    if(trace_src == NULL){
         return false;
     }
 
-    Trace_Rec tr_entry;    
-
     if (p_inst == NULL){
         fprintf(stderr, "Fetch requires a valid pointer to populate\n");
         return false;
     }
 
-    uint8_t bytes_read = 0;
-    bytes_read = fread(&tr_entry, 1, sizeof(Trace_Rec), inFile);
-    
     // check for end of trace
-    if( bytes_read < sizeof(Trace_Rec)) {
+    size_t i;
+    if (!stage_decoder.next(&i)) {
         return false;
     }
 
-    p_inst->instruction_address = tr_entry.inst_addr;
+    const decoded_batch_t &b = stage_decoder.batch();
+    p_inst->instruction_address = b.inst_addr[i];
+    p_inst->op_code = b.op_code[i];
+    p_inst->dest_reg = b.dest_reg[i];
+    p_inst->src_reg[0] = b.src_reg[0][i];
+    p_inst->src_reg[1] = b.src_reg[1][i];
+    p_inst->mem_addr = b.mem_addr[i];
+    p_inst->mem_read = b.mem_read[i];
+    p_inst->mem_write = b.mem_write[i];
+    p_inst->br_taken = b.br_taken[i];
+
+    return true;
+}
+
+void reset_read_instruction() {
+    stage_decoder.reset(trace_src);
+}
+
+sim_options_t sim_opts;
+std::string cache_dir;
+
+std::string sim_config_string() {
+    std::ostringstream config;
+    config << "r=" << sim_opts.r << " k0=" << sim_opts.k0 << " k1=" << sim_opts.k1
+           << " k2=" << sim_opts.k2 << " f=" << sim_opts.f << " skip=" << sim_opts.skip
+           << " dump=" << sim_opts.begin_dump << "-" << sim_opts.end_dump;
+    if (sim_opts.l1.size) {
+        config << " l1=" << sim_opts.l1.size << ":" << sim_opts.l1.ways << ":" << sim_opts.l1.latency
+               << " l2=" << sim_opts.l2.size << ":" << sim_opts.l2.ways << ":" << sim_opts.l2.latency
+               << " mem=" << sim_opts.mem_latency;
+    }
+    if (sim_opts.bpred != BPRED_NONE)
+        config << " bpred=" << bpred_name(sim_opts.bpred) << ":" << sim_opts.bpred_bits;
+    config << policy_config_string(sim_opts.policy);
+    return config.str();
+}
+
+bool apply_config(sim_options_t *opts, const std::string &config) {
+    std::istringstream fields(config);
+    std::string field;
 
-    if(tr_entry.op_type == OP_ALU){
-        p_inst->op_code = 0;
-    }else if(tr_entry.op_type == OP_LD || tr_entry.op_type == OP_ST){
-        p_inst->op_code = 1;
-    }else if(tr_entry.op_type == OP_CBR){
-        p_inst->op_code = 2;
-    }else if(tr_entry.op_type == OP_OTHER){
-        p_inst->op_code = 0;
+    while (fields >> field) {
+        size_t eq = field.find('=');
+        if (eq == std::string::npos)
+            return false;
+
+        std::string name = field.substr(0, eq);
+        const char *value = field.c_str() + eq + 1;
+
+        if (name == "r")
+            opts->r = atoi(value);
+        else if (name == "f")
+            opts->f = atoi(value);
+        else if (name == "k0")
+            opts->k0 = atoi(value);
+        else if (name == "k1")
+            opts->k1 = atoi(value);
+        else if (name == "k2")
+            opts->k2 = atoi(value);
+        else if (name == "mem")
+            opts->mem_latency = atoi(value);
+        else if (name == "l1") {
+            if (!parse_cache_level(value, &opts->l1))
+                return false;
+        } else if (name == "l2") {
+            if (!parse_cache_level(value, &opts->l2))
+                return false;
+        } else if (name == "bpred") {
+            if (!parse_bpred(value, &opts->bpred, &opts->bpred_bits))
+                return false;
+        } else
+            return false;
     }
 
-    if(tr_entry.dest_needed == 1){
-        p_inst->dest_reg = tr_entry.dest;
-    }else{
-        p_inst->dest_reg = (-1);
+    // same rule as --l2 on the command line
+    if (opts->l2.size && !opts->l1.size) {
+        fprintf(stderr, "l2= needs an l1= in front of it\n");
+        return false;
     }
+    return true;
+}
 
-    if(tr_entry.src1_needed == 1){
-        p_inst->src_reg[0] = tr_entry.src1_reg;
-    }else{
-        p_inst->src_reg[0] = (-1);
-    }        
+// the shared memory copy falls back to a private reader if it can't be set up
+trace_source_t *open_trace(const char *filename) {
+    // a daemon worker reads the copy the daemon keeps
+    trace_source_t *cached = daemon_trace(filename);
+    if (cached != NULL)
+        return cached;
 
-    if(tr_entry.src2_needed == 1){
-        p_inst->src_reg[1] = tr_entry.src2_reg;
-    }else{
-        p_inst->src_reg[1] = (-1);
-    }    
+    if (sim_opts.shm && !is_stream_trace(filename)) {
+        shm_trace_source_t *src = new shm_trace_source_t();
+        if (src->open(filename))
+            return src;
+        delete src;
+    }
+    return open_trace_source(filename);
+}
 
+bool trace_read_failed(trace_source_t *src, uint64_t insts, const char *filename) {
+    if (!src->failed() && insts > 0)
+        return false;
+    fprintf(stderr, "%s: no instructions or a truncated trace, the run failed\n", filename);
     return true;
 }
 
-void print_statistics(proc_stats_t* p_stats);
+void print_settings() {
+    printf("Processor Settings\n");
+    printf("R: %" PRIu64 "\n", sim_opts.r);
+    printf("k0: %" PRIu64 "\n", sim_opts.k0);
+    printf("k1: %" PRIu64 "\n", sim_opts.k1);
+    printf("k2: %" PRIu64 "\n", sim_opts.k2);
+    printf("F: %"  PRIu64 "\n", sim_opts.f);
+    printf("\n");
+}
 
-int main(int argc, char* argv[]) {
+uint64_t sim_max_latency(const sim_options_t &opts) {
+    return (uint64_t) opts.l1.latency + opts.l2.latency + opts.mem_latency;
+}
+
+static void add_signature(void *arg, uint32_t id, const inst_timing_t &timing) {
+    ((timing_signature_t *) arg)->add(id, timing);
+}
+
+// set up, run and finalize a fused core on trace_src
+template <class core_t>
+static void run_fused_core(proc_stats_t *p_stats, timing_signature_t *signature, uint64_t begin_dump,
+                           uint64_t end_dump) {
+    core_t core(trace_src, proc_dcache, proc_bpred, sim_opts.policy);
+
+    core.metrics = proc_metrics;
+    core.flight = proc_flight;
+    if (signature != NULL) {
+        core.on_retire = add_signature;
+        core.on_retire_arg = signature;
+    }
+    core.setup(p_stats, sim_opts.r, sim_opts.k0, sim_opts.k1, sim_opts.k2, sim_opts.f, begin_dump, end_dump);
+    core.run(p_stats);
+    core.complete(p_stats);
+}
+
+template <class select_t>
+static void run_fused_select(proc_stats_t *p_stats, timing_signature_t *signature, uint64_t begin_dump,
+                             uint64_t end_dump) {
+    switch (sim_opts.policy.cdb) {
+    case CDB_CLASS:
+        run_fused_core<policy_core_t<select_t, cdb_class_t> >(p_stats, signature, begin_dump, end_dump);
+        break;
+    case CDB_RANDOM:
+        run_fused_core<policy_core_t<select_t, cdb_random_t> >(p_stats, signature, begin_dump, end_dump);
+        break;
+    case CDB_PORTS:
+        run_fused_core<policy_core_t<select_t, cdb_ports_t> >(p_stats, signature, begin_dump, end_dump);
+        break;
+    default:
+        run_fused_core<policy_core_t<select_t, cdb_oldest_t> >(p_stats, signature, begin_dump, end_dump);
+        break;
+    }
+}
+
+// the fused engine built for the policies of sim_opts
+static void run_fused(proc_stats_t *p_stats, timing_signature_t *signature, uint64_t begin_dump,
+                      uint64_t end_dump) {
+    if (sim_opts.policy.select == SELECT_RANDOM)
+        run_fused_select<select_random_t>(p_stats, signature, begin_dump, end_dump);
+    else
+        run_fused_select<select_oldest_t>(p_stats, signature, begin_dump, end_dump);
+}
+
+int simulate_trace(const char *filename, proc_stats_t *p_stats) {
+    std::string key;
+    result_cache_entry_t cached;
+    bool have_cached = false;
+
+    // a differential run always simulates
+    if (sim_opts.engine == ENGINE_DIFF)
+        return run_diff(filename, p_stats);
+    // an estimate is quicker than a cache lookup
+    if (sim_opts.model == MODEL_INTERVAL)
+        return run_interval(filename, p_stats);
+
+    if (!policy_check_ports(&sim_opts.policy, sim_opts.r)) {
+        fprintf(stderr, "--cdb=ports needs a port for every class, adding up to R\n");
+        return 1;
+    }
+
+    // a signature replaces the timing dump, a check uses the interval it was made with
+    bool signing = sim_opts.signature_path != NULL || sim_opts.check_signature != NULL;
+    timing_signature_t signature;
+    timing_signature_t expected;
+    if (sim_opts.check_signature != NULL && !expected.read(sim_opts.check_signature)) {
+        fprintf(stderr, "Unable to read the signature %s\n", sim_opts.check_signature);
+        return 1;
+    }
+    signature.init(sim_opts.check_signature != NULL ? expected.interval : sim_opts.signature_interval);
+    uint64_t begin_dump = signing ? 0 : sim_opts.begin_dump;
+    uint64_t end_dump = signing ? 0 : sim_opts.end_dump;
+
+    // a cached result has no memory profile, signature or stall attribution,
+    // and hashing a stream for the key would consume it
+    if (sim_opts.cache != CACHE_OFF && !sim_opts.mem_stats && !signing && !sim_opts.stall_top &&
+        !is_stream_trace(filename) && result_cache_key(filename, sim_config_string(), key))
+        have_cached = result_cache_load(cache_dir, key, cached);
+
+    // a hit replays the report without touching the trace
+    if (have_cached && sim_opts.cache == CACHE_ON) {
+        printf("Cached result: %s/%s.res\n", cache_dir.c_str(), key.c_str());
+        print_settings();
+        fwrite(cached.dump.data(), 1, cached.dump.size(), stdout);
+        *p_stats = cached.stats;
+        print_statistics(p_stats);
+        return 0;
+    }
+
+    trace_src = open_trace(filename);
+    if (trace_src == NULL)
+        return 1;
+    if (sim_opts.skip > 0) {
+        // block traces seek straight to the block, gzip traces read ahead
+        uint64_t skipped = trace_src->skip(sim_opts.skip);
+        printf("Skipped %" PRIu64 " instructions\n", skipped);
+    }
+
+    print_settings();
+
+    /* Setup statistics */
+    memset(p_stats, 0, sizeof(proc_stats_t));    
+
+    /* Setup the data cache model */
+    dcache_t dcache;
+    if (sim_opts.l1.size) {
+        if (!dcache.init(sim_opts.l1, sim_opts.l2.size ? &sim_opts.l2 : NULL, sim_opts.mem_latency)) {
+            fprintf(stderr, "Cache sizes must be a power of two number of sets of 64 byte lines\n");
+            delete trace_src;
+            trace_src = NULL;
+            return 1;
+        }
+        proc_dcache = &dcache;
+    }
+
+    /* Setup the branch predictor */
+    proc_bpred = create_bpred(sim_opts.bpred, sim_opts.bpred_bits);
+
+    /* Setup the live metrics page */
+    metrics_t metrics;
+    if (sim_opts.metrics_interval) {
+        if (metrics.open(filename, 0, sim_opts.metrics_interval))
+            proc_metrics = &metrics;
+        else
+            fprintf(stderr, "Unable to create the metrics page, continuing without it\n");
+    }
+
+    /* Setup the flight recorder */
+    flight_recorder_t flight;
+    if (sim_opts.flight) {
+        flight.init(sim_opts.flight_events, sim_opts.flight_path ? sim_opts.flight_path : flight_default_path(),
+                    sim_opts.engine == ENGINE_FUSED ? "fused engine" : "stage engine", sim_max_latency(sim_opts));
+        proc_flight = &flight;
+    }
+
+    /* Setup the stall attribution */
+    stall_stats_t stalls;
+    if (sim_opts.stall_top)
+        proc_stalls = &stalls;
+
+    /* Run the processor, keeping a copy of the timing dump for the cache */
+    // the copy isn't charged to a pool, --mem-stats bypasses the cache and never makes it
+    std::ostringstream dump;
+    std::streambuf *cout_buf = NULL;
+    if (!key.empty())
+        cout_buf = std::cout.rdbuf(dump.rdbuf());
+
+    if (sim_opts.engine == ENGINE_FUSED) {
+        run_fused(p_stats, signing ? &signature : NULL, begin_dump, end_dump);
+    } else {
+        setup_proc(p_stats, sim_opts.r, sim_opts.k0, sim_opts.k1, sim_opts.k2, sim_opts.f,
+                   begin_dump, end_dump);
+        run_proc(p_stats);
+    }
+
+    if (!key.empty()) {
+        std::cout.rdbuf(cout_buf);
+        std::cout << dump.str();
+    }
+
+    /* Finalize stats */
+    if (sim_opts.engine != ENGINE_FUSED)
+        complete_proc(p_stats);
+
+    // the stage engine keeps the timing of every instruction
+    if (signing && sim_opts.engine != ENGINE_FUSED) {
+        for (uint32_t id = 1; id <= p_stats->retired_instruction; id++)
+            signature.add(id, *proc_timing(id));
+    }
+
+    if (proc_metrics != NULL) {
+        proc_metrics->publish(p_stats, p_stats->retired_instruction, 0, 0, true);
+        proc_metrics = NULL;
+    }
+    if (proc_flight != NULL) {
+        if (sim_opts.flight_path != NULL)
+            proc_flight->dump();
+        proc_flight = NULL;
+    }
+
+    print_statistics(p_stats);
+    if (proc_stalls != NULL) {
+        proc_stalls->print(sim_opts.stall_top);
+        proc_stalls = NULL;
+    }
+
+    proc_dcache = NULL;
+    delete proc_bpred;
+    proc_bpred = NULL;
+
+    // the stats of a partial trace would pass for a result, fail rather than cache them
+    bool trace_failed = trace_read_failed(trace_src, p_stats->retired_instruction, filename);
+    delete trace_src;
+    trace_src = NULL;
+    if (trace_failed)
+        return 1;
+
+    if (signing) {
+        int status = 0;
+        signature.finish(p_stats);
+        if (sim_opts.signature_path != NULL) {
+            if (signature.write(sim_opts.signature_path)) {
+                printf("Signature written to %s\n", sim_opts.signature_path);
+            } else {
+                fprintf(stderr, "Unable to write the signature %s\n", sim_opts.signature_path);
+                status = 1;
+            }
+        }
+        if (sim_opts.check_signature != NULL) {
+            if (compare_signatures(expected, signature))
+                printf("Signature matches %s\n", sim_opts.check_signature);
+            else
+                status = 1;
+        }
+        return status;
+    }
+
+    if (key.empty())
+        return 0;
+
+    result_cache_entry_t entry;
+    entry.stats = *p_stats;
+    entry.dump = dump.str();
+
+    if (have_cached) {
+        if (memcmp(&entry.stats, &cached.stats, sizeof(proc_stats_t)) != 0 || entry.dump != cached.dump) {
+            fprintf(stderr, "Cache verify: %s differs from cached result %s\n", filename, key.c_str());
+            return 1;
+        }
+        fprintf(stderr, "Cache verify: %s matches cached result %s\n", filename, key.c_str());
+        return 0;
+    }
+
+    if (!result_cache_store(cache_dir, key, entry))
+        fprintf(stderr, "Unable to store result in %s\n", cache_dir.c_str());
+    return 0;
+}
+
+#define SHORT_OPTIONS "r:f:j:k:l:b:e:i:s:m:o:p:h"
+
+static const struct option long_options[] = {
+    { "shm", no_argument, NULL, 'S' },
+    { "l1", required_argument, NULL, '1' },
+    { "l2", required_argument, NULL, '2' },
+    { "mem-latency", required_argument, NULL, 'L' },
+    { "bpred", required_argument, NULL, 'B' },
+    { "engine", required_argument, NULL, 'E' },
+    { "model", required_argument, NULL, 'D' },
+    { "multicore", no_argument, NULL, 'M' },
+    { "quantum", required_argument, NULL, 'Q' },
+    { "simpoints", required_argument, NULL, 'P' },
+    { "warmup", required_argument, NULL, 'W' },
+    { "mem-stats", no_argument, NULL, 'Y' },
+    { "metrics", optional_argument, NULL, 'T' },
+    { "flight", required_argument, NULL, 'F' },
+    { "flight-events", required_argument, NULL, 'G' },
+    { "no-flight", no_argument, NULL, 'g' },
+    { "signature", required_argument, NULL, 'H' },
+    { "search", required_argument, NULL, 'A' },
+    { "stalls", optional_argument, NULL, 'U' },
+    { "select", required_argument, NULL, 'O' },
+    { "cdb", required_argument, NULL, 'R' },
+    { "search-max", required_argument, NULL, 'X' },
+    { "lockstep", required_argument, NULL, 'Z' },
+    { "daemon", optional_argument, NULL, 'J' },
+    { "trace-cache", required_argument, NULL, 'z' },
+    { "check-signature", required_argument, NULL, 'K' },
+    { "signature-interval", required_argument, NULL, 'I' },
+    { "no-cache", no_argument, NULL, 'N' },
+    { "verify-cache", no_argument, NULL, 'V' },
+    { "cache-dir", required_argument, NULL, 'C' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+bool job_traces(int argc, char *argv[], std::vector<std::string> &traces) {
+    // getopt_long reorders the arguments it is given
+    std::vector<char *> args(argv, argv + argc);
+    std::vector<batch_job_t> jobs;
+    bool ok = true;
+    int opt;
+
+    opterr = 0;
+    optind = 0;
+    while (-1 != (opt = getopt_long(argc, args.data(), SHORT_OPTIONS, long_options, NULL))) {
+        if (opt == 'i') {
+            jobs.push_back(batch_job_t());
+            jobs.back().trace = optarg;
+        } else if (opt == 'm') {
+            ok = read_manifest(optarg, jobs) && ok;
+        }
+    }
+    opterr = 1;
+
+    for (auto &job : jobs)
+        traces.push_back(job.trace);
+    return ok;
+}
+
+int procsim_main(int argc, char* argv[]) {
     int opt;
-    uint64_t f = DEFAULT_F;
-    uint64_t k0 = DEFAULT_K0;
-    uint64_t k1 = DEFAULT_K1;
-    uint64_t k2 = DEFAULT_K2;
-    uint64_t r = DEFAULT_R;
 
-    uint64_t begin_dump; 
-    uint64_t end_dump; 
+    memset(&sim_opts, 0, sizeof(sim_opts));
+    sim_opts.f = DEFAULT_F;
+    sim_opts.k0 = DEFAULT_K0;
+    sim_opts.k1 = DEFAULT_K1;
+    sim_opts.k2 = DEFAULT_K2;
+    sim_opts.r = DEFAULT_R;
+    sim_opts.mem_latency = DEFAULT_MEM_LATENCY;
+    sim_opts.flight = true;
+    sim_opts.signature_interval = DEFAULT_SIGNATURE_INTERVAL;
+    sim_opts.policy = default_policy_config();
+
+    sim_opts.cache = CACHE_ON;
+    cache_dir = result_cache_dir();
 
-    inFile = NULL;
+    trace_src = NULL;
 
     /* Read arguments */ 
-    char tr_filename[256];    
-    char cmd_string[256];    
-    while(-1 != (opt = getopt(argc, argv, "r:f:j:k:l:b:e:i:h"))) {
+    std::vector<batch_job_t> jobs;
+    std::string out_dir;
+    bool batch = false;
+    bool multicore = false;
+    uint64_t quantum = DEFAULT_QUANTUM;
+    const char *simpoints = NULL;
+    int64_t warmup = -1;
+    double search_target = 0;
+    const char *search_bounds = DEFAULT_SEARCH_BOUNDS;
+    const char *lockstep = NULL;
+    std::string daemon_socket;
+    uint64_t trace_cache_mb = DEFAULT_TRACE_CACHE_MB;
+    unsigned n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    optind = 0;
+    while(-1 != (opt = getopt_long(argc, argv, SHORT_OPTIONS, long_options, NULL))) {
         switch(opt) {
         case 'r':
-            r = atoi(optarg);
+            sim_opts.r = atoi(optarg);
             break;
         case 'f':
-            f = atoi(optarg);
+            sim_opts.f = atoi(optarg);
             break;            
         case 'j':
-            k0 = atoi(optarg);
+            sim_opts.k0 = atoi(optarg);
             break;
         case 'k':
-            k1 = atoi(optarg);
+            sim_opts.k1 = atoi(optarg);
             break;
         case 'l':
-            k2 = atoi(optarg);
+            sim_opts.k2 = atoi(optarg);
             break;
         case 'b':
-            begin_dump = atoi(optarg);
+            sim_opts.begin_dump = atoi(optarg);
             break;
         case 'e':
-            end_dump = atoi(optarg);
+            sim_opts.end_dump = atoi(optarg);
             break;    
         case 'i':
-            strcpy(tr_filename, optarg);
+            jobs.push_back(batch_job_t());
+            jobs.back().trace = optarg;
+            break;
+        case 's':
+            sim_opts.skip = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            if (!read_manifest(optarg, jobs))
+                return 1;
+            batch = true;
+            break;
+        case 'o':
+            out_dir = optarg;
+            batch = true;
+            break;
+        case 'p':
+            n_workers = atoi(optarg);
+            break;
+        case 'S':
+            sim_opts.shm = true;
+            break;
+        case '1':
+            if (!parse_cache_level(optarg, &sim_opts.l1))
+                print_help_and_exit();
+            break;
+        case '2':
+            if (!parse_cache_level(optarg, &sim_opts.l2))
+                print_help_and_exit();
+            break;
+        case 'L':
+            sim_opts.mem_latency = atoi(optarg);
+            break;
+        case 'B':
+            if (!parse_bpred(optarg, &sim_opts.bpred, &sim_opts.bpred_bits))
+                print_help_and_exit();
+            break;
+        case 'E':
+            if (strcmp(optarg, "stage") == 0)
+                sim_opts.engine = ENGINE_STAGE;
+            else if (strcmp(optarg, "fused") == 0)
+                sim_opts.engine = ENGINE_FUSED;
+            else if (strcmp(optarg, "diff") == 0)
+                sim_opts.engine = ENGINE_DIFF;
+            else
+                print_help_and_exit();
+            break;
+        case 'D':
+            if (strcmp(optarg, "detailed") == 0)
+                sim_opts.model = MODEL_DETAILED;
+            else if (strcmp(optarg, "interval") == 0)
+                sim_opts.model = MODEL_INTERVAL;
+            else
+                print_help_and_exit();
+            break;
+        case 'M':
+            multicore = true;
+            break;
+        case 'Q':
+            quantum = strtoull(optarg, NULL, 10);
+            break;
+        case 'P':
+            simpoints = optarg;
+            break;
+        case 'W':
+            warmup = strtoll(optarg, NULL, 10);
+            break;
+        case 'Y':
+            sim_opts.mem_stats = true;
+            break;
+        case 'T':
+            sim_opts.metrics_interval = optarg ? strtoull(optarg, NULL, 10) : DEFAULT_METRICS_INTERVAL;
+            if (sim_opts.metrics_interval == 0)
+                print_help_and_exit();
+            break;
+        case 'F':
+            sim_opts.flight_path = optarg;
+            break;
+        case 'G':
+            sim_opts.flight_events = strtoull(optarg, NULL, 10);
+            break;
+        case 'g':
+            sim_opts.flight = false;
+            break;
+        case 'H':
+            sim_opts.signature_path = optarg;
+            break;
+        case 'K':
+            sim_opts.check_signature = optarg;
+            break;
+        case 'I':
+            sim_opts.signature_interval = strtoull(optarg, NULL, 10);
+            break;
+        case 'A':
+            search_target = atof(optarg);
+            if (search_target <= 0)
+                print_help_and_exit();
+            break;
+        case 'X':
+            search_bounds = optarg;
+            break;
+        case 'Z':
+            lockstep = optarg;
+            break;
+        case 'J':
+            daemon_socket = optarg ? optarg : daemon_socket_path();
+            break;
+        case 'z':
+            trace_cache_mb = strtoull(optarg, NULL, 10);
+            break;
+        case 'U':
+            sim_opts.stall_top = optarg ? strtoull(optarg, NULL, 10) : DEFAULT_STALL_TOP;
+            if (sim_opts.stall_top == 0)
+                print_help_and_exit();
+            break;
+        case 'O':
+            if (!parse_select_policy(optarg, &sim_opts.policy))
+                print_help_and_exit();
+            break;
+        case 'R':
+            if (!parse_cdb_policy(optarg, &sim_opts.policy))
+                print_help_and_exit();
+            break;
+        case 'N':
+            sim_opts.cache = CACHE_OFF;
+            break;
+        case 'V':
+            sim_opts.cache = CACHE_VERIFY;
+            break;
+        case 'C':
+            cache_dir = optarg;
             break;
         case 'h':
             /* Fall through */
@@ -132,38 +739,106 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    sprintf(cmd_string,"gunzip -c %s", tr_filename);    
-    if ((inFile = popen(cmd_string, "r")) == NULL){
-        printf("Command string is %s\n", cmd_string);
-        printf("Unable to open the trace file with gzip option \n");
-    } else {
-        printf("Opened file with command: %s \n", cmd_string);
-    } 
+    if (!daemon_socket.empty()) {
+        if (in_daemon_worker()) {
+            fprintf(stderr, "A daemon job can't start another daemon\n");
+            return 1;
+        }
+        return run_daemon(daemon_socket.c_str(), n_workers, trace_cache_mb);
+    }
 
-    printf("Processor Settings\n");
-    printf("R: %" PRIu64 "\n", r);
-    printf("k0: %" PRIu64 "\n", k0);
-    printf("k1: %" PRIu64 "\n", k1);
-    printf("k2: %" PRIu64 "\n", k2);
-    printf("F: %"  PRIu64 "\n", f);
-    printf("\n");
+    if (jobs.empty())
+        print_help_and_exit();
+    if (sim_opts.l2.size && !sim_opts.l1.size) {
+        fprintf(stderr, "--l2 needs an --l1 in front of it\n");
+        return 1;
+    }
 
-    /* Setup statistics */
-    proc_stats_t stats;
-    memset(&stats, 0, sizeof(proc_stats_t));    
+    // a stream can be read once, by one run
+    int n_streams = 0;
+    for (auto &job : jobs)
+        n_streams += is_stream_trace(job.trace.c_str());
+    if (n_streams > 0 && (simpoints != NULL || sim_opts.engine == ENGINE_DIFF)) {
+        fprintf(stderr, "--simpoints and --engine=diff read the trace more than once, they need a file\n");
+        return 1;
+    }
+    for (size_t i = 0; i < jobs.size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (jobs[i].trace == jobs[j].trace && is_stream_trace(jobs[i].trace.c_str())) {
+                fprintf(stderr, "%s can only be streamed once\n", jobs[i].trace.c_str());
+                return 1;
+            }
+        }
+    }
 
-    /* Setup the processor */
-    setup_proc(&stats, r, k0, k1, k2, f, begin_dump, end_dump);
+    if (!sim_opts.flight && (sim_opts.flight_path != NULL || sim_opts.flight_events)) {
+        fprintf(stderr, "--no-flight can't be combined with --flight or --flight-events\n");
+        return 1;
+    }
+    if (sim_opts.flight)
+        flight_install_signal();
 
-    /* Run the processor */
-    run_proc(&stats);
+    // the other modes run fused cores or their own loops and would never print it
+    if (sim_opts.stall_top &&
+        (sim_opts.engine != ENGINE_STAGE || multicore || search_target > 0 || simpoints != NULL || lockstep != NULL)) {
+        fprintf(stderr, "--stalls is counted by single and batch runs of the stage engine\n");
+        return 1;
+    }
 
-    /* Finalize stats */
-    complete_proc(&stats);
+    if ((sim_opts.policy.select != SELECT_OLDEST || sim_opts.policy.cdb != CDB_OLDEST) &&
+        (sim_opts.engine != ENGINE_FUSED || multicore || search_target > 0 || simpoints != NULL)) {
+        fprintf(stderr, "--select and --cdb apply to single runs of the fused engine\n");
+        return 1;
+    }
 
-    print_statistics(&stats);
+    if (sim_opts.model == MODEL_INTERVAL &&
+        (multicore || search_target > 0 || simpoints != NULL || lockstep != NULL || sim_opts.engine == ENGINE_DIFF ||
+         sim_opts.stall_top || sim_opts.signature_path != NULL || sim_opts.check_signature != NULL ||
+         sim_opts.policy.select != SELECT_OLDEST || sim_opts.policy.cdb != CDB_OLDEST)) {
+        fprintf(stderr, "--model=interval estimates single and batch runs with the default policies\n");
+        return 1;
+    }
 
-    return 0;
+    if (lockstep != NULL) {
+        if (batch || jobs.size() != 1 || multicore || search_target > 0 || simpoints != NULL ||
+            sim_opts.engine == ENGINE_DIFF || sim_opts.policy.select != SELECT_OLDEST ||
+            sim_opts.policy.cdb != CDB_OLDEST) {
+            fprintf(stderr, "--lockstep takes exactly one trace and the default policies\n");
+            return 1;
+        }
+        return run_lockstep(jobs[0].trace.c_str(), lockstep);
+    }
+
+    if (multicore)
+        return run_multicore(jobs, quantum);
+
+    if (search_target > 0)
+        return run_search(jobs, search_target, search_bounds, n_workers);
+
+    if ((sim_opts.signature_path != NULL || sim_opts.check_signature != NULL) &&
+        (batch || jobs.size() != 1 || simpoints != NULL || sim_opts.engine == ENGINE_DIFF)) {
+        fprintf(stderr, "--signature and --check-signature take exactly one trace\n");
+        return 1;
+    }
+
+    if (simpoints != NULL) {
+        if (jobs.size() != 1) {
+            fprintf(stderr, "--simpoints takes exactly one trace\n");
+            return 1;
+        }
+        return run_simpoints(jobs[0].trace.c_str(), simpoints, warmup);
+    }
+
+    // several traces run side by side, each reporting into its own file
+    if (batch || jobs.size() > 1)
+        return run_batch(jobs, out_dir, n_workers) ? 1 : 0;
+
+    proc_stats_t stats;
+    return simulate_trace(jobs[0].trace.c_str(), &stats);
+}
+
+int main(int argc, char* argv[]) {
+    return procsim_main(argc, argv);
 }
 
 void print_statistics(proc_stats_t* p_stats) {
@@ -173,5 +848,30 @@ void print_statistics(proc_stats_t* p_stats) {
     printf("Avg inst retired per cycle: %f\n", p_stats->avg_inst_retired);
     printf("Maximum Dispatch queue size: %lu\n", p_stats->max_disp_size);
     printf("Avg Dispatch queue size: %f\n", p_stats->avg_disp_size);    
+
+    if (sim_opts.l1.size) {
+        printf("L1 accesses: %lu\n", p_stats->l1_accesses);
+        printf("L1 miss rate: %f\n", p_stats->l1_accesses ? p_stats->l1_misses * 1.f / p_stats->l1_accesses : 0.f);
+    }
+    if (sim_opts.l2.size) {
+        printf("L2 accesses: %lu\n", p_stats->l2_accesses);
+        printf("L2 miss rate: %f\n", p_stats->l2_accesses ? p_stats->l2_misses * 1.f / p_stats->l2_accesses : 0.f);
+    }
+    if (sim_opts.bpred != BPRED_NONE) {
+        printf("Branch predictor: %s\n", bpred_name(sim_opts.bpred));
+        printf("Branches: %lu\n", p_stats->branches);
+        printf("Mispredictions: %lu\n", p_stats->mispredictions);
+        printf("MPKI: %f\n", p_stats->retired_instruction ? p_stats->mispredictions * 1000.f / p_stats->retired_instruction : 0.f);
+        printf("Lost fetch cycles: %lu\n", p_stats->fetch_stall_cycles);
+    }
+    if (sim_opts.mem_stats) {
+        for (int i = 0; i < MEM_POOLS; i++) {
+            printf("Memory %s (live/peak bytes): %" PRId64 "/%" PRId64 "\n", mem_pool_name((mem_pool_t) i),
+                   mem_pools[i].live.load(), mem_pools[i].peak.load());
+        }
+        printf("Allocations: %" PRIu64 "\n", mem_allocations());
+        printf("Allocations per cycle: %f\n", p_stats->cycle_count ? mem_allocations() * 1.f / p_stats->cycle_count : 0.f);
+        printf("Peak RSS (bytes): %" PRIu64 "\n", mem_peak_rss());
+    }
 }
 
@@ -0,0 +1,134 @@
+#ifndef PROCSIM_DRIVER_H
+#define PROCSIM_DRIVER_H
+
+#include <string>
+#include "procsim.hpp"
+#include "dcache.hpp"
+#include "bpred.hpp"
+#include "policy.hpp"
+
+#define DEFAULT_MEM_LATENCY 100
+#define DEFAULT_QUANTUM 10000
+#define DEFAULT_SEARCH_BOUNDS "8:4:4:4:8"
+
+enum engine_t { ENGINE_STAGE, ENGINE_FUSED, ENGINE_DIFF };
+enum model_t { MODEL_DETAILED, MODEL_INTERVAL };
+
+// command line settings applied to every simulated trace
+struct sim_options_t {
+    uint64_t r;
+    uint64_t k0;
+    uint64_t k1;
+    uint64_t k2;
+    uint64_t f;
+
+    uint64_t begin_dump;
+    uint64_t end_dump;
+    uint64_t skip;
+
+    cache_level_config_t l1;
+    cache_level_config_t l2;
+    uint32_t mem_latency;
+
+    bpred_kind_t bpred;
+    uint32_t bpred_bits;
+
+    int engine;
+    int model;                  // MODEL_INTERVAL estimates instead of simulating
+    bool shm;
+    int cache;
+    bool mem_stats;
+    uint64_t metrics_interval;  // 0: no live metrics page
+    bool flight;                // false: no flight recorder
+    uint64_t flight_events;     // every pipeline event kept, 0: one slot per retired instruction
+    const char *flight_path;    // dump the flight recorder here at the end, or NULL
+
+    // timing signature written to / checked against these files, or NULL
+    const char *signature_path;
+    const char *check_signature;
+    uint64_t signature_interval;
+
+    uint64_t stall_top;         // 0: no stall attribution
+
+    policy_config_t policy;     // select and cdb policies of the fused engine
+};
+
+extern sim_options_t sim_opts;
+
+// the longest an instruction can take to execute under opts
+uint64_t sim_max_latency(const sim_options_t &opts);
+
+// everything in sim_opts that affects the simulated results
+std::string sim_config_string();
+
+// apply per-trace settings like "r=4 k0=2 bpred=gshare" on top of opts
+bool apply_config(sim_options_t *opts, const std::string &config);
+
+struct trace_source_t;
+
+// open a trace the way sim_opts asks for (e.g. through shared memory)
+trace_source_t *open_trace(const char *filename);
+
+// true, with a message, if src ended early on an error or gave no
+// instructions; a run that read it must fail instead of reporting
+bool trace_read_failed(trace_source_t *src, uint64_t insts, const char *filename);
+
+// simulate one trace with sim_opts, printing the report on stdout
+// returns 0 on success
+int simulate_trace(const char *filename, proc_stats_t *p_stats);
+
+void print_settings();
+void print_statistics(proc_stats_t* p_stats);
+
+// run the stage and fused engines in lockstep on one trace, comparing the
+// timestamps of every retired instruction and the statistics each cycle
+// returns 0 if they agree, 1 after reporting the first divergence
+int run_diff(const char *filename, proc_stats_t *p_stats);
+
+// estimate the run of one trace with the interval model (see interval.hpp),
+// printing the report on stdout. returns 0 on success
+int run_interval(const char *filename, proc_stats_t *p_stats);
+
+// the whole command line of a procsim run, main() itself
+int procsim_main(int argc, char *argv[]);
+
+// the traces a procsim command line simulates (its -i and manifests),
+// false if a manifest can't be read
+bool job_traces(int argc, char *argv[], std::vector<std::string> &traces);
+
+// one trace of a batch run, the file its report goes to and its own settings
+struct batch_job_t {
+    std::string trace;
+    std::string output;
+    std::string config;
+};
+
+// read a manifest: one trace per line, optionally followed by its output file
+// and key=value settings (r, f, k0, k1, k2, l1, l2, mem, bpred)
+bool read_manifest(const char *filename, std::vector<batch_job_t> &jobs);
+
+// simulate every job in its own worker process, at most n_workers at a time,
+// and print a summary table. returns the number of failed jobs
+int run_batch(std::vector<batch_job_t> &jobs, const std::string &out_dir, unsigned n_workers);
+
+// simulate every job on its own core and host thread, synchronizing the
+// cores every quantum cycles. returns 0 on success
+int run_multicore(std::vector<batch_job_t> &jobs, uint64_t quantum);
+
+// simulate only the simulation points listed in points_file (see tracetool
+// simpoint), each after warmup instructions of warm-up (-1: one interval),
+// and print the weighted IPC. returns 0 on success
+int run_simpoints(const char *filename, const char *points_file, int64_t warmup);
+
+// find the cheapest (R, k0, k1, k2, F) within bounds ("R:K0:K1:K2:F", each
+// from 1) whose IPC over all the traces together reaches target, simulating
+// up to n_workers candidates at a time, and print the pareto frontier
+// returns 0 if some configuration reaches the target
+int run_search(std::vector<batch_job_t> &jobs, double target, const char *bounds, unsigned n_workers);
+
+// simulate the configurations of configs ("R:K0:K1:K2,...") over one shared
+// pass of the trace with the fused engine's timing and print their stats
+// side by side. returns 0 on success
+int run_lockstep(const char *filename, const char *configs);
+
+#endif /* PROCSIM_DRIVER_H */
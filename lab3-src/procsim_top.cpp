@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "metrics.hpp"
+
+// a metrics page copied out of shared memory
+struct snapshot_t {
+    std::string name;
+    int32_t pid;
+    uint32_t core;
+    std::string trace;
+    uint64_t start_ns;
+    uint32_t state;
+    uint64_t updated_ns;
+    uint64_t cycles;
+    uint64_t retired;
+    uint64_t fetched;
+    uint64_t dispatch_queue;
+    uint64_t scheduling_queue;
+    uint64_t inst_per_sec;
+};
+
+void print_help_and_exit(void) {
+    printf("procsim-top [OPTIONS]\n");
+    printf("  -d SECONDS\tDelay between refreshes (default: 1)\n");
+    printf("  -n N\t\tExit after N refreshes (default: run until interrupted)\n");
+    printf("  -c\t\tRemove the pages left behind by processes that died\n");
+    printf("  -h\t\tThis helpful output\n");
+    printf("Shows the simulations started with procsim --metrics\n");
+    exit(0);
+}
+
+static bool read_page(const std::string &name, snapshot_t *snap, bool clean) {
+    std::string path = "/" + name;
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    // a page still being created may not have its size yet
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(metrics_page_t))
+        p = mmap(NULL, sizeof(metrics_page_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    const metrics_page_t *page = (const metrics_page_t *) p;
+    bool ok = metrics_page_valid(page);
+    if (ok && metrics_page_expired(page, metrics_now_ns())) {
+        // finished and shown for long enough
+        shm_unlink(path.c_str());
+        ok = false;
+    } else if (ok && page->state.load(std::memory_order_relaxed) != METRICS_DONE &&
+               kill(page->pid, 0) != 0 && errno == ESRCH) {
+        // the simulator died without unlinking its page
+        if (clean)
+            shm_unlink(path.c_str());
+        ok = false;
+    }
+
+    if (ok) {
+        snap->name = name;
+        snap->pid = page->pid;
+        snap->core = page->core;
+        snap->trace.assign(page->trace, strnlen(page->trace, sizeof(page->trace)));
+        snap->start_ns = page->start_ns;
+        snap->state = page->state.load(std::memory_order_relaxed);
+        snap->updated_ns = page->updated_ns.load(std::memory_order_relaxed);
+        snap->cycles = page->cycles.load(std::memory_order_relaxed);
+        snap->retired = page->retired.load(std::memory_order_relaxed);
+        snap->fetched = page->fetched.load(std::memory_order_relaxed);
+        snap->dispatch_queue = page->dispatch_queue.load(std::memory_order_relaxed);
+        snap->scheduling_queue = page->scheduling_queue.load(std::memory_order_relaxed);
+        snap->inst_per_sec = page->inst_per_sec.load(std::memory_order_relaxed);
+    }
+
+    munmap(p, sizeof(metrics_page_t));
+    return ok;
+}
+
+static void list_pages(std::vector<snapshot_t> &snaps, bool clean) {
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL)
+        return;
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, METRICS_PREFIX, strlen(METRICS_PREFIX)) != 0)
+            continue;
+        snapshot_t snap;
+        if (read_page(ent->d_name, &snap, clean))
+            snaps.push_back(snap);
+    }
+    closedir(dir);
+
+    std::sort(snaps.begin(), snaps.end(), [](const snapshot_t &a, const snapshot_t &b) {
+        return a.pid != b.pid ? a.pid < b.pid : a.core < b.core;
+    });
+}
+
+static void print_pages(const std::vector<snapshot_t> &snaps) {
+    uint64_t now = metrics_now_ns();
+
+    printf("PID\tCORE\tCYCLES\t\tINSTS\t\tIPC\tDISPQ\tSCHEDQ\tKIPS\tELAPSED\tSTATE\tTRACE\n");
+    for (auto &s : snaps) {
+        bool done = (s.state == METRICS_DONE);
+        double elapsed = ((done ? s.updated_ns : now) - s.start_ns) / 1e9;
+
+        printf("%d\t%u\t%-12" PRIu64 "\t%-12" PRIu64 "\t%.3f\t%" PRIu64 "\t%" PRIu64 "\t%.0f\t%.1fs\t%s\t%s\n",
+               s.pid, s.core, s.cycles, s.retired, s.cycles ? s.retired * 1.0 / s.cycles : 0.0,
+               s.dispatch_queue, s.scheduling_queue, done ? 0.0 : s.inst_per_sec / 1000.0, elapsed,
+               done ? "done" : "run", s.trace.c_str());
+    }
+    if (snaps.empty())
+        printf("(no simulations running with --metrics)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    double delay = 1;
+    long refreshes = -1;
+    bool clean = false;
+
+    while (-1 != (opt = getopt(argc, argv, "d:n:ch"))) {
+        switch (opt) {
+        case 'd':
+            delay = atof(optarg);
+            break;
+        case 'n':
+            refreshes = atol(optarg);
+            break;
+        case 'c':
+            clean = true;
+            break;
+        case 'h':
+            /* Fall through */
+        default:
+            print_help_and_exit();
+            break;
+        }
+    }
+
+    // redraw in place on a terminal, append otherwise
+    bool tty = isatty(STDOUT_FILENO);
+    for (long i = 0; refreshes < 0 || i < refreshes; i++) {
+        if (i > 0)
+            usleep((useconds_t) (delay * 1e6));
+
+        std::vector<snapshot_t> snaps;
+        list_pages(snaps, clean);
+
+        if (tty)
+            printf("\033[H\033[J");
+        else if (i > 0)
+            printf("\n");
+        print_pages(snaps);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <cinttypes>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "result_cache.hpp"
+
+#define RESULT_CACHE_MAGIC "PRCACHE1"
+
+struct result_cache_header_t {
+    char magic[8];
+    proc_stats_t stats;
+    uint64_t dump_size;
+};
+
+static inline uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = (const uint8_t *) data;
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ULL);
+    uint64_t w;
+
+    // eight bytes per step, the tail is zero padded
+    for (; size >= 8; p += 8, size -= 8) {
+        memcpy(&w, p, 8);
+        h = mix64(h ^ w) * 0x9e3779b97f4a7c15ULL;
+    }
+    if (size) {
+        w = 0;
+        memcpy(&w, p, size);
+        h = mix64(h ^ w) * 0x9e3779b97f4a7c15ULL;
+    }
+    return mix64(h);
+}
+
+std::string result_cache_dir() {
+    const char *dir = getenv("PROCSIM_CACHE_DIR");
+    if (dir != NULL && *dir)
+        return dir;
+
+    const char *home = getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/procsim";
+}
+
+bool result_cache_key(const char *filename, const std::string &config, std::string &key) {
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return false;
+
+    std::vector<char> buf(1 << 20);
+    uint64_t h = hash_bytes(PROCSIM_VERSION, strlen(PROCSIM_VERSION), 0);
+    h = hash_bytes(config.data(), config.size(), h);
+
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), fp)) > 0)
+        h = hash_bytes(buf.data(), n, h);
+    bool ok = !ferror(fp);
+    fclose(fp);
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016" PRIx64, h);
+    key = hex;
+    return ok;
+}
+
+bool result_cache_load(const std::string &dir, const std::string &key, result_cache_entry_t &entry) {
+    std::string path = dir + "/" + key + ".res";
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+
+    result_cache_header_t header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              memcmp(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic)) == 0;
+    if (ok) {
+        entry.stats = header.stats;
+        entry.dump.resize(header.dump_size);
+        ok = header.dump_size == 0 || fread(&entry.dump[0], 1, header.dump_size, fp) == header.dump_size;
+    }
+    fclose(fp);
+    return ok;
+}
+
+// mkdir -p
+static bool make_dirs(const std::string &dir) {
+    for (size_t pos = 1; pos <= dir.size(); pos++) {
+        if (pos == dir.size() || dir[pos] == '/') {
+            if (mkdir(dir.substr(0, pos).c_str(), 0755) != 0 && errno != EEXIST)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool result_cache_store(const std::string &dir, const std::string &key, const result_cache_entry_t &entry) {
+    if (!make_dirs(dir))
+        return false;
+
+    // write aside and rename, so concurrent readers never see half an entry
+    std::string path = dir + "/" + key + ".res";
+    std::string tmp = path + "." + std::to_string((long long) getpid());
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (fp == NULL)
+        return false;
+
+    result_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic));
+    header.stats = entry.stats;
+    header.dump_size = entry.dump.size();
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(entry.dump.data(), 1, entry.dump.size(), fp) == entry.dump.size();
+    ok = (fclose(fp) == 0) && ok;
+
+    if (ok)
+        ok = rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok)
+        unlink(tmp.c_str());
+    return ok;
+}
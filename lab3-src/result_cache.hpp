@@ -0,0 +1,35 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <string>
+#include "procsim.hpp"
+
+/*
+ * On-disk cache of simulation results
+ *
+ * Entries are keyed by a hash of the trace file contents, the processor
+ * configuration and PROCSIM_VERSION, and hold the final proc_stats_t plus
+ * the timing dump printed by run_proc(), if one was requested.
+ */
+
+enum result_cache_mode_t { CACHE_ON, CACHE_OFF, CACHE_VERIFY };
+
+struct result_cache_entry_t {
+    proc_stats_t stats;
+    std::string dump;
+};
+
+// 64 bit hash of a buffer, chained through seed
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed);
+
+// cache directory: $PROCSIM_CACHE_DIR, else ~/.cache/procsim
+std::string result_cache_dir();
+
+// key of a trace file simulated with the given configuration string
+// returns false if the trace can't be read
+bool result_cache_key(const char *filename, const std::string &config, std::string &key);
+
+bool result_cache_load(const std::string &dir, const std::string &key, result_cache_entry_t &entry);
+bool result_cache_store(const std::string &dir, const std::string &key, const result_cache_entry_t &entry);
+
+#endif /* RESULT_CACHE_H */
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <string.h>
+#include "procsim_driver.hpp"
+#include "trace_source.hpp"
+#include "simpoint.hpp"
+#include "fused.hpp"
+
+extern trace_source_t* trace_src;
+
+// timing of one simulation point, warm-up excluded
+struct region_result_t {
+    uint64_t insts;
+    uint64_t cycles;
+};
+
+// simulate warmup + length instructions starting at first and measure the
+// cycles between the last warm-up instruction retiring and the end
+static bool simulate_region(const char *filename, uint64_t first, uint64_t warmup, uint64_t length,
+                            region_result_t *result) {
+    trace_source_t *src = open_trace(filename);
+    if (src == NULL)
+        return false;
+    if (src->skip(first) != first) {
+        delete src;
+        return false;
+    }
+    limit_trace_source_t region(src, warmup + length);
+
+    dcache_t dcache;
+    if (sim_opts.l1.size && !dcache.init(sim_opts.l1, sim_opts.l2.size ? &sim_opts.l2 : NULL, sim_opts.mem_latency)) {
+        fprintf(stderr, "Cache sizes must be a power of two number of sets of 64 byte lines\n");
+        delete src;
+        return false;
+    }
+    proc_dcache = sim_opts.l1.size ? &dcache : NULL;
+    proc_bpred = create_bpred(sim_opts.bpred, sim_opts.bpred_bits);
+
+    proc_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+
+    // no timing dump for sampled runs
+    fused_core_t core(&region, proc_dcache, proc_bpred);
+    if (sim_opts.engine == ENGINE_FUSED) {
+        core.setup(&stats, sim_opts.r, sim_opts.k0, sim_opts.k1, sim_opts.k2, sim_opts.f, 0, 0);
+    } else {
+        trace_src = &region;
+        setup_proc(&stats, sim_opts.r, sim_opts.k0, sim_opts.k1, sim_opts.k2, sim_opts.f, 0, 0);
+    }
+
+    uint64_t warm_cycle = 0;
+    bool warm = (warmup == 0);
+    bool running = true;
+    while (running) {
+        uint64_t cycle = stats.cycle_count;
+
+        if (sim_opts.engine == ENGINE_FUSED)
+            running = core.step(&stats);
+        else
+            running = step_proc(&stats);
+
+        if (!warm && stats.retired_instruction >= warmup) {
+            warm_cycle = cycle;
+            warm = true;
+        }
+    }
+
+    result->insts = stats.retired_instruction > warmup ? stats.retired_instruction - warmup : 0;
+    result->cycles = stats.cycle_count - warm_cycle;
+    // a point cut short by a truncated trace would still weigh in
+    bool trace_failed = trace_read_failed(&region, stats.retired_instruction, filename);
+
+    trace_src = NULL;
+    proc_dcache = NULL;
+    delete proc_bpred;
+    proc_bpred = NULL;
+    delete src;
+    return !trace_failed;
+}
+
+int run_simpoints(const char *filename, const char *points_file, int64_t warmup) {
+    simpoint_result_t points;
+    if (!read_simpoints(points_file, &points)) {
+        fprintf(stderr, "Unable to read simulation points from %s\n", points_file);
+        return 1;
+    }
+    if (warmup < 0)
+        warmup = points.interval_size;
+
+    // cpi is the quantity that adds up over the phases of a program
+    std::vector<region_result_t> regions(points.points.size());
+    double cpi = 0;
+    double weight = 0;
+    for (size_t i = 0; i < points.points.size(); i++) {
+        const simpoint_t &p = points.points[i];
+        uint64_t start = p.interval * points.interval_size;
+        uint64_t warm = std::min<uint64_t>(warmup, start);
+
+        if (!simulate_region(filename, start - warm, warm, points.interval_size, &regions[i]) ||
+            regions[i].insts == 0) {
+            fprintf(stderr, "Unable to simulate interval %" PRIu64 " of %s\n", p.interval, filename);
+            return 1;
+        }
+        cpi += p.weight * regions[i].cycles / regions[i].insts;
+        weight += p.weight;
+    }
+    cpi /= weight;
+
+    print_settings();
+    printf("Simulation points: %s (%zu points of %" PRIu64 " instructions, warm-up %" PRId64 ")\n",
+           points_file, points.points.size(), points.interval_size, warmup);
+    printf("INTERVAL\tWEIGHT\tINSTS\tCYCLES\tIPC\n");
+    for (size_t i = 0; i < points.points.size(); i++) {
+        printf("%" PRIu64 "\t%f\t%" PRIu64 "\t%" PRIu64 "\t%f\n", points.points[i].interval,
+               points.points[i].weight, regions[i].insts, regions[i].cycles,
+               regions[i].insts * 1.0 / regions[i].cycles);
+    }
+
+    printf("\n");
+    printf("Weighted stats:\n");
+    printf("Avg inst retired per cycle: %f\n", 1 / cpi);
+    if (points.instructions)
+        printf("Estimated run time (cycles): %.0f\n", cpi * points.instructions);
+    return 0;
+}
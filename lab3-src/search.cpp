@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "procsim_driver.hpp"
+#include "trace_source.hpp"
+#include "fused.hpp"
+#include "mem_stats.hpp"
+
+/*
+ * Design-space search
+ *
+ * The ipc never drops when a resource is added, so for every (k0, k1, k2, F)
+ * the configurations reaching the target are exactly those with R at
+ * least some minimum. The search binary searches that minimum for every
+ * (k0, k1, k2, F), cheapest first, and bounds it from both sides without
+ * simulating: R can't be below the target ipc (nor can k0 + k1 + k2 or F),
+ * it is never above the minimum of a combination with one unit less of
+ * anything, and it is not worth finding once R + k0 + k1 + k2 + F would
+ * cost more than the cheapest passing configuration so far. A simulation
+ * stops as soon as the target is out of reach even at full width, the
+ * ones that stopped are finished afterwards for the Pareto frontier.
+ */
+
+// cycles between two checks of the early abort bound
+#define SEARCH_CHECK_CYCLES 4096
+// minimum R of a combination that was never searched
+#define SEARCH_UNKNOWN UINT64_MAX
+
+enum search_outcome_t { SEARCH_PASS, SEARCH_FAIL, SEARCH_ABORTED };
+
+struct search_trace_t {
+    std::string name;
+    mem_vector_t<Trace_Rec, MEM_TRACE> recs;
+};
+
+struct search_point_t {
+    uint64_t v[5];      // r, k0, k1, k2, f
+    int outcome;
+    uint64_t cycles;
+
+    uint64_t cost() const { return v[0] + v[1] + v[2] + v[3] + v[4]; }
+    // an upper bound on the ipc of any trace: retire, fire and fetch widths
+    uint64_t width() const { return std::min(std::min(v[0], v[1] + v[2] + v[3]), v[4]); }
+};
+
+struct search_t {
+    std::vector<search_trace_t> traces;
+    uint64_t total_insts;
+    double target;
+    uint64_t max_v[5];
+
+    // minimum R of every (k0, k1, k2, F), 0 if none within the bounds
+    std::vector<uint64_t> min_r;
+    std::atomic<uint64_t> best_cost;
+
+    std::mutex lock;
+    std::vector<search_point_t> runs;
+
+    size_t index(const uint64_t *v) const {
+        return (((v[1] - 1) * max_v[2] + (v[2] - 1)) * max_v[3] + (v[3] - 1)) * max_v[4] + (v[4] - 1);
+    }
+};
+
+static bool parse_search_bounds(const char *arg, uint64_t *v) {
+    return sscanf(arg, "%" SCNu64 ":%" SCNu64 ":%" SCNu64 ":%" SCNu64 ":%" SCNu64,
+                  &v[0], &v[1], &v[2], &v[3], &v[4]) == 5 &&
+           v[0] && v[1] && v[2] && v[3] && v[4];
+}
+
+// simulate the traces one after the other on the fused engine, giving up
+// (if early_abort) as soon as even retiring at full width from now on
+// can't reach the target
+static void evaluate(const search_t &s, search_point_t *p, bool early_abort = true) {
+    uint64_t r = p->v[0];
+    uint64_t issue = std::min(r, p->v[1] + p->v[2] + p->v[3]);
+    uint64_t f = p->v[4];
+
+    // cycles the traces not simulated yet need at the very least
+    uint64_t rest = 0;
+    for (auto &t : s.traces)
+        rest += t.recs.size() / p->width();
+
+    p->cycles = 0;
+    for (auto &t : s.traces) {
+        uint64_t n = t.recs.size();
+        rest -= n / p->width();
+
+        memory_trace_source_t src(t.recs.data(), n);
+        dcache_t dcache;
+        if (sim_opts.l1.size)
+            dcache.init(sim_opts.l1, sim_opts.l2.size ? &sim_opts.l2 : NULL, sim_opts.mem_latency);
+        bpred_t *bpred = create_bpred(sim_opts.bpred, sim_opts.bpred_bits);
+
+        proc_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+        fused_core_t core(&src, sim_opts.l1.size ? &dcache : NULL, bpred);
+        core.setup(&stats, r, p->v[1], p->v[2], p->v[3], f, 0, 0);
+
+        uint64_t countdown = SEARCH_CHECK_CYCLES;
+        bool aborted = false;
+        while (core.step(&stats)) {
+            if (!early_abort || --countdown)
+                continue;
+            countdown = SEARCH_CHECK_CYCLES;
+
+            // fetched instructions retire at most issue per cycle, the
+            // others are also held back by fetch
+            uint64_t left = std::max((n - stats.retired_instruction) / issue, (n - core.fetched()) / f);
+            uint64_t bound = p->cycles + stats.cycle_count + left + rest;
+            if (s.total_insts < s.target * bound) {
+                aborted = true;
+                break;
+            }
+        }
+        delete bpred;
+
+        if (aborted) {
+            p->outcome = SEARCH_ABORTED;
+            return;
+        }
+        core.complete(&stats);
+        p->cycles += stats.cycle_count;
+    }
+
+    p->outcome = s.total_insts >= s.target * p->cycles ? SEARCH_PASS : SEARCH_FAIL;
+}
+
+// binary search the minimum R of one (k0, k1, k2, F), recording it in
+// s.min_r unless the cost bound cut the search short
+static void search_combination(search_t &s, const uint64_t *v) {
+    search_point_t p;
+    memcpy(p.v, v, sizeof(p.v));
+    uint64_t others = v[1] + v[2] + v[3] + v[4];
+    size_t at = s.index(v);
+
+    uint64_t lo = std::max<uint64_t>(1, (uint64_t) ceil(s.target));
+    uint64_t hi = s.max_v[0];
+    bool hi_passes = false;
+
+    // one unit less of anything needs at least as many result buses
+    for (int d = 1; d < 5; d++) {
+        if (v[d] == 1)
+            continue;
+        p.v[d]--;
+        uint64_t r = s.min_r[s.index(p.v)];
+        p.v[d]++;
+
+        if (r != SEARCH_UNKNOWN && r != 0 && r <= hi) {
+            hi = r;
+            hi_passes = true;
+        }
+    }
+
+    // the target needs more result buses than any cheaper neighbour that passed
+    if ((double) std::min(v[1] + v[2] + v[3], v[4]) < s.target || lo > hi) {
+        s.min_r[at] = 0;
+        return;
+    }
+
+    while (lo < hi || (lo == hi && !hi_passes)) {
+        if (others + lo > s.best_cost.load()) {
+            s.min_r[at] = SEARCH_UNKNOWN;
+            return;
+        }
+
+        p.v[0] = (lo == hi) ? hi : (lo + hi) / 2;
+        evaluate(s, &p);
+        {
+            std::lock_guard<std::mutex> guard(s.lock);
+            s.runs.push_back(p);
+        }
+
+        if (p.outcome == SEARCH_PASS) {
+            hi = p.v[0];
+            hi_passes = true;
+        } else {
+            lo = p.v[0] + 1;
+        }
+        if (lo > hi) {
+            s.min_r[at] = 0;
+            return;
+        }
+    }
+
+    s.min_r[at] = hi;
+    uint64_t cost = others + hi;
+    uint64_t best = s.best_cost.load();
+    while (cost < best && !s.best_cost.compare_exchange_weak(best, cost))
+        ;
+}
+
+static void print_point(const search_t &s, const search_point_t &p) {
+    printf("%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%f\n",
+           p.cost(), p.v[0], p.v[1], p.v[2], p.v[3], p.v[4], s.total_insts * 1.0 / p.cycles);
+}
+
+int run_search(std::vector<batch_job_t> &jobs, double target, const char *bounds, unsigned n_workers) {
+    search_t s;
+    if (!parse_search_bounds(bounds, s.max_v)) {
+        fprintf(stderr, "Bad search bounds %s, expected R:K0:K1:K2:F\n", bounds);
+        return 1;
+    }
+    if (n_workers == 0)
+        n_workers = 1;
+    s.target = target;
+    if (std::max<uint64_t>(1, (uint64_t) ceil(target)) > s.max_v[0]) {
+        fprintf(stderr, "Target IPC %f needs more than the %" PRIu64 " result buses of the bounds\n", target,
+                s.max_v[0]);
+        return 1;
+    }
+
+    /* Decode every trace once, the candidates replay them from memory */
+    s.traces.resize(jobs.size());
+    s.total_insts = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        trace_source_t *src = open_trace(jobs[i].trace.c_str());
+        if (src == NULL)
+            return 1;
+
+        Trace_Rec rec;
+        s.traces[i].name = jobs[i].trace;
+        while (src->read(&rec))
+            s.traces[i].recs.push_back(rec);
+        bool trace_failed = trace_read_failed(src, s.traces[i].recs.size(), jobs[i].trace.c_str());
+        delete src;
+        if (trace_failed)
+            return 1;
+        s.total_insts += s.traces[i].recs.size();
+    }
+    if (s.total_insts == 0) {
+        fprintf(stderr, "The traces hold no instructions\n");
+        return 1;
+    }
+
+    /* Every (k0, k1, k2, F), cheapest first */
+    std::vector<search_point_t> combos;
+    search_point_t p;
+    p.v[0] = 0;
+    for (p.v[1] = 1; p.v[1] <= s.max_v[1]; p.v[1]++)
+        for (p.v[2] = 1; p.v[2] <= s.max_v[2]; p.v[2]++)
+            for (p.v[3] = 1; p.v[3] <= s.max_v[3]; p.v[3]++)
+                for (p.v[4] = 1; p.v[4] <= s.max_v[4]; p.v[4]++)
+                    combos.push_back(p);
+    std::stable_sort(combos.begin(), combos.end(),
+                     [](const search_point_t &a, const search_point_t &b) { return a.cost() < b.cost(); });
+
+    s.min_r.assign(combos.size(), SEARCH_UNKNOWN);
+    s.best_cost = UINT64_MAX;
+
+    /* Combinations of one cost don't bound each other and run in parallel */
+    size_t first = 0;
+    while (first < combos.size()) {
+        uint64_t cost = combos[first].cost();
+        size_t last = first;
+        while (last < combos.size() && combos[last].cost() == cost)
+            last++;
+
+        // the fewest result buses the target allows are already too expensive
+        if (cost + std::max<uint64_t>(1, (uint64_t) ceil(target)) > s.best_cost.load())
+            break;
+
+        std::atomic<size_t> next(first);
+        std::vector<std::thread> workers;
+        for (unsigned w = 0; w < std::min<size_t>(n_workers, last - first); w++) {
+            workers.push_back(std::thread([&]() {
+                for (size_t i = next++; i < last; i = next++)
+                    search_combination(s, combos[i].v);
+            }));
+        }
+        for (auto &t : workers)
+            t.join();
+        first = last;
+    }
+
+    /* Report */
+    uint64_t in_bounds = combos.size() * s.max_v[0];
+    size_t aborted = 0;
+    for (auto &r : s.runs)
+        aborted += (r.outcome == SEARCH_ABORTED);
+
+    printf("Design-space search: target IPC %f on %zu traces (%" PRIu64 " instructions)\n",
+           target, s.traces.size(), s.total_insts);
+    printf("Bounds: R 1-%" PRIu64 " k0 1-%" PRIu64 " k1 1-%" PRIu64 " k2 1-%" PRIu64 " F 1-%" PRIu64 "\n",
+           s.max_v[0], s.max_v[1], s.max_v[2], s.max_v[3], s.max_v[4]);
+    printf("Configurations: %" PRIu64 " in bounds, %zu simulated (%zu stopped early), %" PRIu64
+           " decided by width, monotonicity or cost\n", in_bounds, s.runs.size(), aborted,
+           in_bounds - s.runs.size());
+
+    if (s.best_cost.load() == UINT64_MAX) {
+        printf("\nNo configuration within the bounds reaches the target\n");
+        return 1;
+    }
+
+    // a minimum inherited from a cheaper combination was never simulated
+    std::vector<search_point_t> cheapest;
+    for (auto &c : combos) {
+        uint64_t r = s.min_r[s.index(c.v)];
+        if (r == 0 || r == SEARCH_UNKNOWN || c.cost() + r != s.best_cost.load())
+            continue;
+
+        search_point_t point = c;
+        point.v[0] = r;
+        auto run = std::find_if(s.runs.begin(), s.runs.end(), [&](const search_point_t &x) {
+            return memcmp(x.v, point.v, sizeof(point.v)) == 0;
+        });
+        if (run != s.runs.end()) {
+            point = *run;
+        } else {
+            evaluate(s, &point);
+            s.runs.push_back(point);
+        }
+        if (point.outcome == SEARCH_PASS)
+            cheapest.push_back(point);
+    }
+    if (cheapest.empty()) {
+        printf("\nNo configuration within the bounds reaches the target\n");
+        return 1;
+    }
+
+    printf("\nCheapest configurations:\n");
+    printf("COST\tR\tk0\tk1\tk2\tF\tIPC\n");
+    for (auto &c : cheapest)
+        print_point(s, c);
+
+    /* Finish the runs that stopped early, the frontier needs their ipc */
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < std::min<size_t>(n_workers, aborted); w++) {
+        workers.push_back(std::thread([&]() {
+            for (size_t i = next++; i < s.runs.size(); i = next++) {
+                if (s.runs[i].outcome == SEARCH_ABORTED)
+                    evaluate(s, &s.runs[i], false);
+            }
+        }));
+    }
+    for (auto &t : workers)
+        t.join();
+
+    // best ipc at every cost among all the runs, kept while it improves
+    std::vector<const search_point_t *> done;
+    for (auto &r : s.runs)
+        done.push_back(&r);
+    std::stable_sort(done.begin(), done.end(), [](const search_point_t *a, const search_point_t *b) {
+        return a->cost() != b->cost() ? a->cost() < b->cost() : a->cycles < b->cycles;
+    });
+
+    printf("\nPareto frontier (IPC against total resources, simulated configurations):\n");
+    printf("COST\tR\tk0\tk1\tk2\tF\tIPC\n");
+    uint64_t best_cycles = 0;
+    for (auto c : done) {
+        if (best_cycles && c->cycles >= best_cycles)
+            continue;
+        best_cycles = c->cycles;
+        print_point(s, *c);
+    }
+    return 0;
+}
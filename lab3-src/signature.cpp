@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <algorithm>
+#include <string.h>
+#include "signature.hpp"
+
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t hash_step(uint64_t h, uint64_t v) {
+    return mix64(h ^ (v + 0x9e3779b97f4a7c15ULL));
+}
+
+void timing_signature_t::init(uint64_t interval) {
+    this->interval = interval ? interval : 1;
+    instructions = 0;
+    cycles = 0;
+    stats = 0;
+    checkpoints.clear();
+}
+
+void timing_signature_t::add(uint32_t id, const inst_timing_t &timing) {
+    uint64_t h = mix64(id);
+    h = hash_step(h, timing.cycle_fetch_decode);
+    h = hash_step(h, timing.cycle_dispatch);
+    h = hash_step(h, timing.cycle_schedule);
+    h = hash_step(h, timing.cycle_execute);
+    h = hash_step(h, timing.cycle_status_update);
+
+    // until finish() a checkpoint holds the sum of its interval
+    size_t k = (id - 1) / interval;
+    if (k >= checkpoints.size())
+        checkpoints.resize(k + 1, 0);
+    checkpoints[k] += h;
+    instructions++;
+}
+
+void timing_signature_t::finish(const proc_stats_t *p_stats) {
+    uint64_t h = 0;
+    for (auto &c : checkpoints) {
+        h = hash_step(h, c);
+        c = h;
+    }
+
+    uint64_t sum_disp;
+    memcpy(&sum_disp, &p_stats->sum_disp_size, sizeof(sum_disp));
+
+    cycles = p_stats->cycle_count;
+    stats = 0;
+    stats = hash_step(stats, p_stats->retired_instruction);
+    stats = hash_step(stats, p_stats->cycle_count);
+    stats = hash_step(stats, p_stats->max_disp_size);
+    stats = hash_step(stats, sum_disp);
+    stats = hash_step(stats, p_stats->l1_accesses);
+    stats = hash_step(stats, p_stats->l1_misses);
+    stats = hash_step(stats, p_stats->l2_accesses);
+    stats = hash_step(stats, p_stats->l2_misses);
+    stats = hash_step(stats, p_stats->branches);
+    stats = hash_step(stats, p_stats->mispredictions);
+    stats = hash_step(stats, p_stats->fetch_stall_cycles);
+}
+
+bool timing_signature_t::write(const char *filename) const {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+        return false;
+
+    fprintf(fp, "# procsim timing signature\n");
+    fprintf(fp, "interval %" PRIu64 "\n", interval);
+    fprintf(fp, "instructions %" PRIu64 "\n", instructions);
+    fprintf(fp, "cycles %" PRIu64 "\n", cycles);
+    fprintf(fp, "stats %016" PRIx64 "\n", stats);
+    for (auto c : checkpoints)
+        fprintf(fp, "%016" PRIx64 "\n", c);
+
+    return fclose(fp) == 0;
+}
+
+bool timing_signature_t::read(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+        return false;
+
+    init(0);
+    interval = 0;
+
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp) != NULL) {
+        uint64_t c;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "interval %" SCNu64, &interval) == 1 ||
+            sscanf(line, "instructions %" SCNu64, &instructions) == 1 ||
+            sscanf(line, "cycles %" SCNu64, &cycles) == 1 ||
+            sscanf(line, "stats %" SCNx64, &stats) == 1)
+            continue;
+
+        ok = sscanf(line, "%" SCNx64, &c) == 1;
+        if (ok)
+            checkpoints.push_back(c);
+    }
+    fclose(fp);
+
+    return ok && interval > 0;
+}
+
+bool compare_signatures(const timing_signature_t &expected, const timing_signature_t &actual) {
+    if (expected.interval != actual.interval) {
+        printf("Signature mismatch: interval %" PRIu64 " instead of %" PRIu64 "\n",
+               actual.interval, expected.interval);
+        return false;
+    }
+
+    size_t n = std::min(expected.checkpoints.size(), actual.checkpoints.size());
+    for (size_t k = 0; k < n; k++) {
+        if (expected.checkpoints[k] == actual.checkpoints[k])
+            continue;
+
+        uint64_t first = k * actual.interval + 1;
+        uint64_t last = std::min((k + 1) * actual.interval, std::max(expected.instructions, actual.instructions));
+        printf("Signature mismatch: timing differs in interval %zu (instructions %" PRIu64 "-%" PRIu64 ")\n",
+               k, first, last);
+        return false;
+    }
+
+    if (expected.instructions != actual.instructions || expected.checkpoints.size() != actual.checkpoints.size()) {
+        printf("Signature mismatch: %" PRIu64 " instructions instead of %" PRIu64 "\n",
+               actual.instructions, expected.instructions);
+        return false;
+    }
+    if (expected.stats != actual.stats) {
+        printf("Signature mismatch: final statistics differ (%" PRIu64 " cycles instead of %" PRIu64 ")\n",
+               actual.cycles, expected.cycles);
+        return false;
+    }
+    return true;
+}
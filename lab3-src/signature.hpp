@@ -0,0 +1,43 @@
+#ifndef SIGNATURE_H
+#define SIGNATURE_H
+
+#include <string>
+#include <vector>
+#include "procsim.hpp"
+
+/*
+ * Timing signatures
+ *
+ * Instead of printing the FETCH/DISP/SCHED/EXEC/STATE line of every
+ * instruction, a run can be summarized by a hash of those tuples. Every
+ * instruction's tuple is hashed together with its tag and summed into the
+ * checkpoint its tag falls in, so the engines may add instructions in any
+ * retirement order. The checkpoints of interval instructions each are
+ * chained into a rolling hash, and the final statistics get a hash of
+ * their own. Comparing two signatures points at the first interval whose
+ * timing differs.
+ */
+
+#define DEFAULT_SIGNATURE_INTERVAL 10000
+
+struct timing_signature_t {
+    uint64_t interval;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t stats;                     // hash of the final statistics
+    std::vector<uint64_t> checkpoints;  // rolling hash at the end of every interval
+
+    void init(uint64_t interval);
+    void add(uint32_t id, const inst_timing_t &timing);
+    // chain the checkpoints and hash the statistics once every instruction is in
+    void finish(const proc_stats_t *p_stats);
+
+    bool write(const char *filename) const;
+    bool read(const char *filename);
+};
+
+// print the first difference of actual from expected on stdout
+// returns true if they match
+bool compare_signatures(const timing_signature_t &expected, const timing_signature_t &actual);
+
+#endif /* SIGNATURE_H */
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <string.h>
+#include "simpoint.hpp"
+
+// largest gap between two instructions of one basic block
+#define SIMPOINT_MAX_INST_BYTES 15
+#define KMEANS_SEEDS 5
+#define KMEANS_MAX_ITERATIONS 100
+
+static inline uint64_t splitmix64(uint64_t &state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// uniform in [0, 1)
+static inline double random_unit(uint64_t &state) {
+    return (splitmix64(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// add len instructions of the block starting at bb to the projected vector
+static void project_block(uint64_t bb, uint64_t len, uint64_t seed, std::vector<double> &vec) {
+    uint64_t state = seed ^ (bb * 0xff51afd7ed558ccdULL);
+    for (size_t d = 0; d < vec.size(); d++)
+        vec[d] += len * (2.0 * random_unit(state) - 1.0);
+}
+
+static double distance2(const double *a, const double *b, uint32_t dims) {
+    double sum = 0;
+    for (uint32_t d = 0; d < dims; d++)
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    return sum;
+}
+
+// k-means++ seeding, then Lloyd iterations
+// returns the sum of squared distances to the assigned centres
+static double kmeans(const std::vector<double> &data, uint64_t n, uint32_t dims, uint32_t k, uint64_t seed,
+                     std::vector<uint32_t> &assign, std::vector<double> &centers) {
+    uint64_t state = seed;
+    std::vector<double> nearest(n);
+
+    centers.assign((size_t) k * dims, 0);
+    assign.assign(n, 0);
+
+    uint64_t first = splitmix64(state) % n;
+    std::copy(&data[first * dims], &data[first * dims] + dims, &centers[0]);
+    for (uint64_t i = 0; i < n; i++)
+        nearest[i] = distance2(&data[i * dims], &centers[0], dims);
+
+    for (uint32_t c = 1; c < k; c++) {
+        double total = 0;
+        for (uint64_t i = 0; i < n; i++)
+            total += nearest[i];
+
+        // pick the next centre with probability proportional to distance^2
+        double target = random_unit(state) * total;
+        uint64_t pick = n - 1;
+        for (uint64_t i = 0; i < n; i++) {
+            target -= nearest[i];
+            if (target < 0) {
+                pick = i;
+                break;
+            }
+        }
+
+        std::copy(&data[pick * dims], &data[pick * dims] + dims, &centers[c * dims]);
+        for (uint64_t i = 0; i < n; i++)
+            nearest[i] = std::min(nearest[i], distance2(&data[i * dims], &centers[c * dims], dims));
+    }
+
+    double sse = 0;
+    std::vector<uint64_t> sizes(k);
+    for (int iter = 0; iter < KMEANS_MAX_ITERATIONS; iter++) {
+        bool changed = (iter == 0);
+
+        sse = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            uint32_t best = 0;
+            double best_d = distance2(&data[i * dims], &centers[0], dims);
+            for (uint32_t c = 1; c < k; c++) {
+                double d = distance2(&data[i * dims], &centers[c * dims], dims);
+                if (d < best_d) {
+                    best_d = d;
+                    best = c;
+                }
+            }
+            if (assign[i] != best) {
+                assign[i] = best;
+                changed = true;
+            }
+            sse += best_d;
+        }
+        if (!changed)
+            break;
+
+        // an emptied cluster keeps its old centre
+        std::vector<double> sums((size_t) k * dims, 0);
+        std::fill(sizes.begin(), sizes.end(), 0);
+        for (uint64_t i = 0; i < n; i++) {
+            sizes[assign[i]]++;
+            for (uint32_t d = 0; d < dims; d++)
+                sums[assign[i] * dims + d] += data[i * dims + d];
+        }
+        for (uint32_t c = 0; c < k; c++) {
+            if (sizes[c] == 0)
+                continue;
+            for (uint32_t d = 0; d < dims; d++)
+                centers[c * dims + d] = sums[c * dims + d] / sizes[c];
+        }
+    }
+    return sse;
+}
+
+// Bayesian information criterion of a clustering under a spherical
+// gaussian model, as in x-means
+static double bic(uint64_t n, uint32_t dims, uint32_t k, double sse, const std::vector<uint32_t> &assign) {
+    std::vector<uint64_t> sizes(k);
+    for (auto a : assign)
+        sizes[a]++;
+
+    double variance = n > k ? sse / (n - k) : 0;
+    if (variance < 1e-12)
+        variance = 1e-12;
+
+    double likelihood = 0;
+    for (uint32_t c = 0; c < k; c++) {
+        double r = sizes[c];
+        if (r == 0)
+            continue;
+        likelihood += -r / 2 * log(2 * M_PI) - r * dims / 2 * log(variance) - (r - k) / 2 +
+                      r * log(r) - r * log((double) n);
+    }
+
+    double params = (k - 1) + (double) dims * k + 1;
+    return likelihood - params / 2 * log((double) n);
+}
+
+bool find_simpoints(trace_source_t *src, const simpoint_options_t &opts, simpoint_result_t *result) {
+    uint32_t dims = opts.dims;
+    std::vector<double> data;
+    std::vector<double> vec(dims, 0);
+
+    uint64_t in_interval = 0;
+    uint64_t total = 0;
+    uint64_t bb = 0;
+    uint64_t bb_len = 0;
+    uint64_t prev_addr = 0;
+    bool prev_branch = false;
+    Trace_Rec rec;
+
+    /* Build the projected basic block vector of every interval */
+    while (src->read(&rec)) {
+        bool leader = (total == 0) || prev_branch || rec.inst_addr <= prev_addr ||
+                      rec.inst_addr - prev_addr > SIMPOINT_MAX_INST_BYTES;
+        if (leader) {
+            if (bb_len)
+                project_block(bb, bb_len, opts.seed, vec);
+            bb = rec.inst_addr;
+            bb_len = 0;
+        }
+
+        bb_len++;
+        in_interval++;
+        total++;
+        prev_addr = rec.inst_addr;
+        prev_branch = (rec.op_type == OP_CBR);
+
+        // a block running over the interval end counts in both intervals
+        if (in_interval == opts.interval_size) {
+            project_block(bb, bb_len, opts.seed, vec);
+            bb_len = 0;
+
+            for (auto v : vec)
+                data.push_back(v / opts.interval_size);
+            std::fill(vec.begin(), vec.end(), 0);
+            in_interval = 0;
+        }
+    }
+
+    uint64_t n = data.size() / dims;
+    result->interval_size = opts.interval_size;
+    result->instructions = total;
+    result->intervals = n;
+    result->bic.clear();
+    result->points.clear();
+    if (n == 0)
+        return false;
+
+    /* Cluster for every k, keeping the best of a few seeds */
+    uint32_t max_k = std::min<uint64_t>(opts.max_k, n);
+    std::vector<std::vector<uint32_t> > assigns(max_k + 1);
+    std::vector<std::vector<double> > centers(max_k + 1);
+
+    for (uint32_t k = 1; k <= max_k; k++) {
+        double best_sse = -1;
+        for (int s = 0; s < KMEANS_SEEDS; s++) {
+            std::vector<uint32_t> assign;
+            std::vector<double> center;
+            double sse = kmeans(data, n, dims, k, opts.seed + k * KMEANS_SEEDS + s, assign, center);
+            if (best_sse < 0 || sse < best_sse) {
+                best_sse = sse;
+                assigns[k].swap(assign);
+                centers[k].swap(center);
+            }
+        }
+        result->bic.push_back(bic(n, dims, k, best_sse, assigns[k]));
+    }
+
+    // the smallest k within 90% of the best score
+    double lo = *std::min_element(result->bic.begin(), result->bic.end());
+    double hi = *std::max_element(result->bic.begin(), result->bic.end());
+    uint32_t k = 1;
+    while (k < max_k && result->bic[k - 1] < lo + 0.9 * (hi - lo))
+        k++;
+
+    /* Every cluster is represented by the interval nearest its centre */
+    const std::vector<uint32_t> &assign = assigns[k];
+    for (uint32_t c = 0; c < k; c++) {
+        uint64_t size = 0;
+        uint64_t best = n;
+        double best_d = 0;
+
+        for (uint64_t i = 0; i < n; i++) {
+            if (assign[i] != c)
+                continue;
+            size++;
+            double d = distance2(&data[i * dims], &centers[k][c * dims], dims);
+            if (best == n || d < best_d) {
+                best = i;
+                best_d = d;
+            }
+        }
+        if (size == 0)
+            continue;
+
+        simpoint_t point;
+        point.interval = best;
+        point.weight = size * 1.0 / n;
+        point.cluster = c;
+        result->points.push_back(point);
+    }
+
+    std::sort(result->points.begin(), result->points.end(),
+              [](const simpoint_t &a, const simpoint_t &b) { return a.interval < b.interval; });
+    return true;
+}
+
+bool write_simpoints(const char *filename, const simpoint_result_t &result) {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+        return false;
+
+    fprintf(fp, "# procsim simulation points\n");
+    fprintf(fp, "interval %" PRIu64 "\n", result.interval_size);
+    fprintf(fp, "instructions %" PRIu64 "\n", result.instructions);
+    fprintf(fp, "# INTERVAL\tWEIGHT\tCLUSTER\n");
+    for (auto &p : result.points)
+        fprintf(fp, "%" PRIu64 "\t%f\t%u\n", p.interval, p.weight, p.cluster);
+
+    return fclose(fp) == 0;
+}
+
+bool read_simpoints(const char *filename, simpoint_result_t *result) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+        return false;
+
+    result->interval_size = 0;
+    result->instructions = 0;
+    result->intervals = 0;
+    result->bic.clear();
+    result->points.clear();
+
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp) != NULL) {
+        simpoint_t p;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "interval %" SCNu64, &result->interval_size) == 1 ||
+            sscanf(line, "instructions %" SCNu64, &result->instructions) == 1)
+            continue;
+
+        ok = sscanf(line, "%" SCNu64 " %lf %u", &p.interval, &p.weight, &p.cluster) == 3;
+        if (ok)
+            result->points.push_back(p);
+    }
+    fclose(fp);
+
+    return ok && result->interval_size > 0 && !result->points.empty();
+}
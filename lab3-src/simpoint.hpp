@@ -0,0 +1,52 @@
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+#include <string>
+#include "trace_source.hpp"
+
+/*
+ * Phase analysis for sampled simulation
+ *
+ * The trace is cut into fixed size intervals and every interval gets a
+ * basic block vector: how many instructions it executed in each basic
+ * block. A basic block starts after a conditional branch or wherever
+ * inst_addr jumps. The vectors are randomly projected down to a few
+ * dimensions as they are built, clustered with k-means for every k up to
+ * a limit, and the smallest k that scores close to the best BIC wins.
+ * The interval closest to each cluster centre is that cluster's
+ * simulation point, weighted by the share of intervals in the cluster.
+ */
+
+#define SIMPOINT_DEFAULT_INTERVAL 10000
+#define SIMPOINT_DEFAULT_MAX_K 10
+#define SIMPOINT_DEFAULT_DIMS 15
+
+struct simpoint_t {
+    uint64_t interval;  // index of the interval, it starts at interval * interval_size
+    double weight;
+    uint32_t cluster;
+};
+
+struct simpoint_options_t {
+    uint64_t interval_size;
+    uint32_t max_k;
+    uint32_t dims;
+    uint64_t seed;
+};
+
+struct simpoint_result_t {
+    uint64_t interval_size;
+    uint64_t instructions;          // in the whole trace
+    uint64_t intervals;             // complete intervals that were clustered
+    std::vector<double> bic;        // score of every k, starting at k = 1
+    std::vector<simpoint_t> points;
+};
+
+// stream src and pick its simulation points, false if the trace is
+// shorter than one interval
+bool find_simpoints(trace_source_t *src, const simpoint_options_t &opts, simpoint_result_t *result);
+
+bool write_simpoints(const char *filename, const simpoint_result_t &result);
+bool read_simpoints(const char *filename, simpoint_result_t *result);
+
+#endif /* SIMPOINT_H */
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <string.h>
+#include <algorithm>
+#include "stalls.hpp"
+
+#define STALL_TABLE_INITIAL 1024
+
+stall_stats_t *proc_stalls = NULL;
+
+static const char *stall_reason_names[STALL_REASONS] = {
+    "sources not ready", "no free function unit", "no free result bus", "no scheduling queue slot"
+};
+
+static inline size_t hash_pc(uint64_t pc) {
+    pc *= 0x9e3779b97f4a7c15ULL;
+    return pc ^ (pc >> 32);
+}
+
+stall_stats_t::stall_stats_t() : table(STALL_TABLE_INITIAL), used(0) {
+    memset(totals, 0, sizeof(totals));
+}
+
+// linear probing, kept at most half full
+stall_pc_t *stall_stats_t::lookup(uint64_t pc) {
+    size_t mask = table.size() - 1;
+    size_t i = hash_pc(pc) & mask;
+
+    while (table[i].pc != pc + 1) {
+        if (table[i].pc == 0) {
+            if (2 * (used + 1) > table.size()) {
+                grow();
+                return lookup(pc);
+            }
+            memset(&table[i], 0, sizeof(stall_pc_t));
+            table[i].pc = pc + 1;
+            used++;
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &table[i];
+}
+
+void stall_stats_t::grow() {
+    mem_vector_t<stall_pc_t, MEM_OUTPUT> old(table.size() * 2);
+    old.swap(table);
+
+    size_t mask = table.size() - 1;
+    for (auto &e : old) {
+        if (e.pc == 0)
+            continue;
+        size_t i = hash_pc(e.pc - 1) & mask;
+        while (table[i].pc != 0)
+            i = (i + 1) & mask;
+        table[i] = e;
+    }
+}
+
+void stall_stats_t::print(uint64_t n) const {
+    uint64_t total = 0;
+    for (int r = 0; r < STALL_REASONS; r++)
+        total += totals[r];
+
+    printf("Stall cycles (instruction-cycles spent waiting): %" PRIu64 "\n", total);
+    for (int r = 0; r < STALL_REASONS; r++) {
+        printf("  %s: %" PRIu64 " (%.1f%%)\n", stall_reason_names[r], totals[r],
+               total ? totals[r] * 100.0 / total : 0.0);
+    }
+
+    std::vector<const stall_pc_t *> pcs;
+    for (auto &e : table) {
+        if (e.pc != 0 && e.total() > 0)
+            pcs.push_back(&e);
+    }
+    n = std::min<uint64_t>(n, pcs.size());
+    std::partial_sort(pcs.begin(), pcs.begin() + n, pcs.end(), [](const stall_pc_t *a, const stall_pc_t *b) {
+        return a->total() != b->total() ? a->total() > b->total() : a->pc < b->pc;
+    });
+
+    printf("Top %" PRIu64 " stalled addresses (of %zu):\n", n, pcs.size());
+    printf("PC\t\tTOTAL\tSHARE\tSOURCES\tFU\tCDB\tSLOT\n");
+    for (uint64_t i = 0; i < n; i++) {
+        const stall_pc_t &e = *pcs[i];
+        printf("%-12" PRIx64 "\t%" PRIu64 "\t%.1f%%\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+               e.pc - 1, e.total(), total ? e.total() * 100.0 / total : 0.0, e.cycles[STALL_SOURCES],
+               e.cycles[STALL_FU], e.cycles[STALL_CDB], e.cycles[STALL_SLOT]);
+    }
+}
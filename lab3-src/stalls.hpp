@@ -0,0 +1,68 @@
+#ifndef STALLS_H
+#define STALLS_H
+
+#include "procsim.hpp"
+#include "mem_stats.hpp"
+
+/*
+ * Stall attribution
+ *
+ * The stage functions charge every cycle an instruction spends waiting to
+ * one cause, both in a total per cause and per instruction address in an
+ * open addressing table, so a slow run tells which resource is short and
+ * which code suffers from it.
+ */
+
+#define DEFAULT_STALL_TOP 10
+
+enum stall_reason_t {
+    STALL_SOURCES,      // in the scheduling queue, waiting on operands
+    STALL_FU,           // ready to fire, no free function unit of its class
+    STALL_CDB,          // done executing, no free result bus
+    STALL_SLOT,         // in the dispatch queue, no free scheduling queue slot
+    STALL_REASONS
+};
+
+struct stall_pc_t {
+    uint64_t pc;        // instruction address + 1, 0 marks an empty slot
+    uint64_t cycles[STALL_REASONS];
+
+    uint64_t total() const {
+        return cycles[STALL_SOURCES] + cycles[STALL_FU] + cycles[STALL_CDB] + cycles[STALL_SLOT];
+    }
+};
+
+class stall_stats_t {
+public:
+    stall_stats_t();
+
+    // remember the address of instruction id as it is fetched
+    void fetch(uint32_t id, uint64_t pc) {
+        if (pc_of.size() < id)
+            pc_of.resize(id);
+        pc_of[id - 1] = pc;
+    }
+
+    void charge(stall_reason_t reason, uint32_t id, uint64_t cycles = 1) {
+        totals[reason] += cycles;
+        lookup(pc_of[id - 1])->cycles[reason] += cycles;
+    }
+
+    // print the totals and the n addresses that stalled the longest
+    void print(uint64_t n) const;
+
+    uint64_t totals[STALL_REASONS];
+
+private:
+    stall_pc_t *lookup(uint64_t pc);
+    void grow();
+
+    mem_vector_t<uint64_t, MEM_INSTRUCTIONS> pc_of;
+    mem_vector_t<stall_pc_t, MEM_OUTPUT> table;
+    size_t used;
+};
+
+// attribution of the stage engine, NULL when disabled
+extern stall_stats_t *proc_stalls;
+
+#endif /* STALLS_H */
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <thread>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "trace_block.hpp"
+
+bool is_block_trace(const char *filename) {
+    char magic[8];
+
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return false;
+
+    bool match = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+                 memcmp(magic, TRACE_BLOCK_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return match;
+}
+
+/** WRITER */
+bool trace_block_writer_t::open(const char *filename, uint32_t block_records) {
+    if (block_records == 0)
+        return false;
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+        return false;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_BLOCK_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.record_size = sizeof(Trace_Rec);
+    header.block_records = block_records;
+
+    pending.clear();
+    pending.reserve(block_records);
+    index.clear();
+
+    // the real header is written by close() once the index is known
+    return fwrite(&header, sizeof(header), 1, fp) == 1;
+}
+
+bool trace_block_writer_t::write(const Trace_Rec *rec) {
+    pending.push_back(*rec);
+    if (pending.size() == header.block_records)
+        return flush_block();
+    return true;
+}
+
+bool trace_block_writer_t::flush_block() {
+    if (pending.empty())
+        return true;
+
+    uLong raw_size = pending.size() * sizeof(Trace_Rec);
+    uLongf comp_size = compressBound(raw_size);
+    std::vector<Bytef> comp(comp_size);
+
+    if (compress2(comp.data(), &comp_size, (const Bytef *) pending.data(), raw_size, Z_DEFAULT_COMPRESSION) != Z_OK)
+        return false;
+
+    trace_block_index_t entry;
+    entry.first_record = header.record_count;
+    entry.offset = ftello(fp);
+    entry.comp_size = comp_size;
+    entry.records = pending.size();
+
+    if (fwrite(comp.data(), 1, comp_size, fp) != comp_size)
+        return false;
+
+    index.push_back(entry);
+    header.record_count += pending.size();
+    header.block_count++;
+    pending.clear();
+    return true;
+}
+
+bool trace_block_writer_t::close() {
+    if (fp == NULL)
+        return true;
+
+    bool ok = flush_block();
+
+    header.index_offset = ftello(fp);
+    if (!index.empty())
+        ok = ok && fwrite(index.data(), sizeof(trace_block_index_t), index.size(), fp) == index.size();
+
+    ok = ok && fseeko(fp, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    fp = NULL;
+    return ok;
+}
+
+/** READER */
+trace_block_reader_t::~trace_block_reader_t() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool trace_block_reader_t::open(const char *filename) {
+    fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, TRACE_BLOCK_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != 1 || header.record_size != sizeof(Trace_Rec)) {
+        fprintf(stderr, "%s is not a valid block trace\n", filename);
+        return false;
+    }
+
+    size_t index_size = header.block_count * sizeof(trace_block_index_t);
+    index.resize(header.block_count);
+    if (index_size && pread(fd, index.data(), index_size, header.index_offset) != (ssize_t) index_size) {
+        fprintf(stderr, "Unable to read the block index of %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+bool trace_block_reader_t::read_block(uint64_t block, Trace_Rec *out) const {
+    if (block >= header.block_count)
+        return false;
+
+    const trace_block_index_t &entry = index[block];
+    std::vector<Bytef> comp(entry.comp_size);
+
+    if (pread(fd, comp.data(), entry.comp_size, entry.offset) != (ssize_t) entry.comp_size)
+        return false;
+
+    uLongf raw_size = entry.records * sizeof(Trace_Rec);
+    if (uncompress((Bytef *) out, &raw_size, comp.data(), entry.comp_size) != Z_OK)
+        return false;
+
+    return raw_size == entry.records * sizeof(Trace_Rec);
+}
+
+bool read_blocks_parallel(const trace_block_reader_t &reader, uint64_t first, uint64_t count,
+                          unsigned n_threads, Trace_Rec *out) {
+    if (count == 0)
+        return true;
+    if (n_threads == 0)
+        n_threads = 1;
+    if (n_threads > count)
+        n_threads = count;
+
+    uint64_t base = reader.block_info(first).first_record;
+    std::atomic<uint64_t> next(first);
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> workers;
+
+    // every worker keeps pulling the next undecoded block
+    for (unsigned t = 0; t < n_threads; t++) {
+        workers.push_back(std::thread([&]() {
+            uint64_t b;
+            while ((b = next++) < first + count) {
+                Trace_Rec *dst = out + (reader.block_info(b).first_record - base);
+                if (!reader.read_block(b, dst))
+                    ok = false;
+            }
+        }));
+    }
+    for (auto &w : workers)
+        w.join();
+
+    return ok;
+}
+
+/** SEQUENTIAL SOURCE */
+block_trace_source_t::~block_trace_source_t() {
+    if (next_ready.valid())
+        next_ready.wait();
+}
+
+bool block_trace_source_t::open(const char *filename) {
+    if (!reader.open(filename))
+        return false;
+
+    block = 0;
+    pos = 0;
+    cur.clear();
+    if (reader.block_count() == 0)
+        return true;
+    return load_block(0);
+}
+
+void block_trace_source_t::prefetch(uint64_t b) {
+    if (b >= reader.block_count())
+        return;
+
+    next_block = b;
+    next.resize(reader.block_info(b).records);
+    next_ready = std::async(std::launch::async, [this, b]() {
+        return reader.read_block(b, next.data());
+    });
+}
+
+bool block_trace_source_t::load_block(uint64_t b) {
+    bool ok = false;
+    bool have = false;
+
+    // the pending prefetch owns the next buffer until it completes
+    if (next_ready.valid()) {
+        ok = next_ready.get();
+        have = (next_block == b);
+    }
+
+    if (have) {
+        cur.swap(next);
+    } else {
+        cur.resize(reader.block_info(b).records);
+        ok = reader.read_block(b, cur.data());
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Unable to decompress trace block %" PRIu64 "\n", b);
+        error = true;
+        cur.clear();
+        block = reader.block_count();
+        return false;
+    }
+
+    block = b;
+    pos = 0;
+    prefetch(b + 1);
+    return true;
+}
+
+bool block_trace_source_t::read(Trace_Rec *rec) {
+    if (pos == cur.size()) {
+        if (block + 1 >= reader.block_count() || !load_block(block + 1))
+            return false;
+    }
+
+    *rec = cur[pos++];
+    return true;
+}
+
+size_t block_trace_source_t::read_batch(Trace_Rec *recs, size_t n) {
+    size_t i = 0;
+
+    while (i < n) {
+        if (pos == cur.size()) {
+            if (block + 1 >= reader.block_count() || !load_block(block + 1))
+                break;
+        }
+
+        size_t k = std::min(n - i, cur.size() - pos);
+        memcpy(recs + i, cur.data() + pos, k * sizeof(Trace_Rec));
+        pos += k;
+        i += k;
+    }
+    return i;
+}
+
+bool block_trace_source_t::seek(uint64_t record) {
+    if (record >= reader.record_count()) {
+        cur.clear();
+        pos = 0;
+        block = reader.block_count();
+        return false;
+    }
+
+    uint64_t b = reader.block_of(record);
+    if (b != block || cur.empty()) {
+        if (!load_block(b))
+            return false;
+    }
+
+    pos = record - reader.block_info(b).first_record;
+    return true;
+}
+
+uint64_t block_trace_source_t::skip(uint64_t n) {
+    uint64_t at = reader.record_count();
+    if (!cur.empty())
+        at = reader.block_info(block).first_record + pos;
+
+    uint64_t target = at + n;
+    if (target > reader.record_count())
+        target = reader.record_count();
+
+    seek(target);
+    return target - at;
+}
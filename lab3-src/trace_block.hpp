@@ -0,0 +1,123 @@
+#ifndef TRACE_BLOCK_H
+#define TRACE_BLOCK_H
+
+#include <future>
+#include <string>
+#include "trace_source.hpp"
+#include "mem_stats.hpp"
+
+/*
+ * Seekable block trace container (.ptb)
+ *
+ *   header | block 0 | block 1 | ... | block n-1 | index
+ *
+ * Every block holds up to block_records Trace_Rec records compressed
+ * independently with zlib, so any block can be decoded on its own and
+ * several blocks can be decoded at the same time. The index maps the
+ * first instruction of every block to its file offset.
+ */
+
+#define TRACE_BLOCK_MAGIC "PTBLK001"
+#define TRACE_BLOCK_DEFAULT_RECORDS 65536
+
+struct trace_block_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t block_records;
+    uint32_t reserved;
+    uint64_t record_count;
+    uint64_t block_count;
+    uint64_t index_offset;
+};
+
+struct trace_block_index_t {
+    uint64_t first_record;
+    uint64_t offset;
+    uint32_t comp_size;
+    uint32_t records;
+};
+
+// returns true if the file starts with the block container magic
+bool is_block_trace(const char *filename);
+
+// streams records into a new block container
+class trace_block_writer_t {
+public:
+    trace_block_writer_t() : fp(NULL) { }
+    ~trace_block_writer_t() { close(); }
+
+    bool open(const char *filename, uint32_t block_records = TRACE_BLOCK_DEFAULT_RECORDS);
+    bool write(const Trace_Rec *rec);
+    bool close();
+
+private:
+    bool flush_block();
+
+    FILE *fp;
+    trace_block_header_t header;
+    std::vector<Trace_Rec> pending;
+    std::vector<trace_block_index_t> index;
+};
+
+// random access to the blocks of a container
+// read_block() only uses pread() and local state, so it may be called
+// from several threads at once
+class trace_block_reader_t {
+public:
+    trace_block_reader_t() : fd(-1) { }
+    ~trace_block_reader_t();
+
+    bool open(const char *filename);
+
+    uint64_t record_count() const { return header.record_count; }
+    uint64_t block_count() const { return header.block_count; }
+    uint32_t block_records() const { return header.block_records; }
+    const trace_block_index_t &block_info(uint64_t block) const { return index[block]; }
+
+    // block holding the record with the given (0 based) instruction number
+    uint64_t block_of(uint64_t record) const { return record / header.block_records; }
+
+    // decompress a block, out must hold block_info(block).records records
+    bool read_block(uint64_t block, Trace_Rec *out) const;
+
+private:
+    int fd;
+    trace_block_header_t header;
+    std::vector<trace_block_index_t> index;
+};
+
+// decompress the blocks [first, first + count) with up to n_threads threads
+bool read_blocks_parallel(const trace_block_reader_t &reader, uint64_t first, uint64_t count,
+                          unsigned n_threads, Trace_Rec *out);
+
+// sequential reader over a block container, decoding the next block in the
+// background while the current one is consumed
+struct block_trace_source_t : public trace_source_t {
+    block_trace_source_t() : block(0), pos(0) { }
+    ~block_trace_source_t();
+
+    bool open(const char *filename);
+
+    bool read(Trace_Rec *rec);
+    size_t read_batch(Trace_Rec *recs, size_t n);
+    uint64_t skip(uint64_t n);
+
+    // position the reader on the given (0 based) instruction number
+    bool seek(uint64_t record);
+
+    trace_block_reader_t reader;
+
+private:
+    bool load_block(uint64_t b);
+    void prefetch(uint64_t b);
+
+    uint64_t block;
+    size_t pos;
+    mem_vector_t<Trace_Rec, MEM_TRACE> cur;
+    mem_vector_t<Trace_Rec, MEM_TRACE> next;
+    std::future<bool> next_ready;
+    uint64_t next_block;
+};
+
+#endif /* TRACE_BLOCK_H */
@@ -0,0 +1,362 @@
+#include <stddef.h>
+#include <cinttypes>
+#include <string.h>
+#include "trace_codec.hpp"
+
+// tag byte of every record
+#define TAG_STATIC_HIT 1   // static fields as remembered for inst_addr
+#define TAG_MEM_READ   2
+#define TAG_MEM_WRITE  4
+#define TAG_BR_DIR     8
+#define TAG_MEM_DELTA  16  // mem_addr delta follows
+#define TAG_MEM_ZERO   32  // mem_addr is 0
+#define TAG_PC_NEXT    64  // inst_addr followed the previous instruction before
+#define TAG_RAW        128 // the whole record follows uncompressed
+
+// largest encoded record: tag + raw record
+#define CODEC_MAX_RECORD 64
+#define CODEC_BUFFER_SIZE (1 << 20)
+
+codec_state_t::codec_state_t() : prev_inst_addr(0), prev_mem_addr(0) {
+    table.resize(1 << TRACE_CODEC_TABLE_BITS);
+    memset(table.data(), 0, table.size() * sizeof(codec_entry_t));
+    prev_entry = &table[0];
+}
+
+codec_state_t::codec_state_t(const codec_state_t &other) {
+    *this = other;
+}
+
+codec_state_t &codec_state_t::operator=(const codec_state_t &other) {
+    prev_inst_addr = other.prev_inst_addr;
+    prev_mem_addr = other.prev_mem_addr;
+    table = other.table;
+    prev_entry = &table[other.prev_entry - other.table.data()];
+    return *this;
+}
+
+static inline void put_varint(std::vector<uint8_t> &buf, uint64_t v) {
+    while (v >= 0x80) {
+        buf.push_back(v | 0x80);
+        v >>= 7;
+    }
+    buf.push_back(v);
+}
+
+static inline uint64_t get_varint(const uint8_t *&p) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            break;
+    }
+    return v;
+}
+
+static inline uint64_t zigzag(uint64_t delta) {
+    return (delta << 1) ^ (uint64_t) ((int64_t) delta >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t v) {
+    return (v >> 1) ^ -(v & 1);
+}
+
+static inline void put_u64(std::vector<uint8_t> &buf, uint64_t v) {
+    const uint8_t *b = (const uint8_t *) &v;
+    buf.insert(buf.end(), b, b + sizeof(v));
+}
+
+static inline uint64_t get_u64(const uint8_t *&p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return v;
+}
+
+// the static fields are the nine bytes from op_type to cc_write, copied at once
+static_assert(sizeof(codec_static_t) == 9 &&
+              offsetof(Trace_Rec, cc_write) == offsetof(Trace_Rec, op_type) + 8 &&
+              offsetof(Trace_Rec, dest) == offsetof(Trace_Rec, op_type) + 1 &&
+              offsetof(Trace_Rec, src2_needed) == offsetof(Trace_Rec, op_type) + 6,
+              "unexpected Trace_Rec layout");
+
+static inline void get_static(const Trace_Rec *rec, codec_static_t *fields) {
+    memcpy(fields, &rec->op_type, sizeof(*fields));
+}
+
+static inline void set_static(Trace_Rec *rec, const codec_static_t &fields) {
+    memcpy(&rec->op_type, &fields, sizeof(fields));
+}
+
+// the address a mem_addr delta is taken from
+static inline uint64_t mem_base(const codec_state_t &state, const codec_entry_t &e, uint64_t inst_addr) {
+    return e.inst_addr == inst_addr ? e.last_mem : state.prev_mem_addr;
+}
+
+// learn from a record, identically on both sides
+static inline void codec_update(codec_state_t &state, codec_entry_t &e, const Trace_Rec *rec) {
+    if (e.inst_addr != rec->inst_addr)
+        e.last_mem = state.prev_mem_addr;
+
+    e.inst_addr = rec->inst_addr;
+    e.br_target = rec->br_target;
+    get_static(rec, &e.fields);
+
+    if (rec->mem_addr != 0) {
+        e.last_mem = rec->mem_addr;
+        state.prev_mem_addr = rec->mem_addr;
+    }
+    state.prev_entry->next_inst_addr = rec->inst_addr;
+    state.prev_entry = &e;
+    state.prev_inst_addr = rec->inst_addr;
+}
+
+bool is_codec_trace(const char *filename) {
+    char magic[8];
+
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return false;
+
+    bool match = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+                 memcmp(magic, TRACE_CODEC_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return match;
+}
+
+/** ENCODER */
+bool trace_codec_writer_t::open(const char *filename) {
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+        return false;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_CODEC_MAGIC, sizeof(header.magic));
+    header.version = 1;
+
+    state = codec_state_t();
+    buf.clear();
+    buf.reserve(CODEC_BUFFER_SIZE + CODEC_MAX_RECORD);
+    written = sizeof(header);
+
+    // the record count is filled in by close()
+    return fwrite(&header, sizeof(header), 1, fp) == 1;
+}
+
+bool trace_codec_writer_t::write(const Trace_Rec *rec) {
+    codec_entry_t &e = state.entry(rec->inst_addr);
+    size_t tag_pos = buf.size();
+    uint8_t tag = 0;
+
+    buf.push_back(0);
+
+    if (rec->mem_read > 1 || rec->mem_write > 1 || rec->br_dir > 1) {
+        // flags that don't fit in one bit, keep everything as is
+        tag = TAG_RAW;
+        codec_static_t fields;
+        get_static(rec, &fields);
+
+        put_u64(buf, rec->inst_addr);
+        buf.insert(buf.end(), (const uint8_t *) &fields, (const uint8_t *) &fields + sizeof(fields));
+        put_u64(buf, rec->mem_addr);
+        buf.push_back(rec->mem_write);
+        buf.push_back(rec->mem_read);
+        buf.push_back(rec->br_dir);
+        put_u64(buf, rec->br_target);
+    } else {
+        codec_static_t fields;
+        get_static(rec, &fields);
+
+        if (rec->mem_read)
+            tag |= TAG_MEM_READ;
+        if (rec->mem_write)
+            tag |= TAG_MEM_WRITE;
+        if (rec->br_dir)
+            tag |= TAG_BR_DIR;
+
+        if (rec->inst_addr == state.prev_entry->next_inst_addr)
+            tag |= TAG_PC_NEXT;
+        else
+            put_varint(buf, zigzag(rec->inst_addr - state.prev_inst_addr));
+
+        if (e.inst_addr == rec->inst_addr && e.br_target == rec->br_target &&
+            memcmp(&e.fields, &fields, sizeof(fields)) == 0) {
+            tag |= TAG_STATIC_HIT;
+        } else {
+            buf.insert(buf.end(), (const uint8_t *) &fields, (const uint8_t *) &fields + sizeof(fields));
+            put_varint(buf, zigzag(rec->br_target - rec->inst_addr));
+        }
+
+        uint64_t base = mem_base(state, e, rec->inst_addr);
+        if (rec->mem_addr == 0) {
+            tag |= TAG_MEM_ZERO;
+        } else if (rec->mem_addr != base) {
+            tag |= TAG_MEM_DELTA;
+            put_varint(buf, zigzag(rec->mem_addr - base));
+        }
+    }
+
+    buf[tag_pos] = tag;
+    codec_update(state, e, rec);
+    header.record_count++;
+
+    if (buf.size() >= CODEC_BUFFER_SIZE) {
+        if (fwrite(buf.data(), 1, buf.size(), fp) != buf.size())
+            return false;
+        written += buf.size();
+        buf.clear();
+    }
+    return true;
+}
+
+bool trace_codec_writer_t::close() {
+    if (fp == NULL)
+        return true;
+
+    bool ok = buf.empty() || fwrite(buf.data(), 1, buf.size(), fp) == buf.size();
+    written += buf.size();
+    buf.clear();
+
+    ok = ok && fseeko(fp, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    fp = NULL;
+    return ok;
+}
+
+/** DECODER */
+codec_trace_source_t::~codec_trace_source_t() {
+    if (fp != NULL)
+        fclose(fp);
+}
+
+bool codec_trace_source_t::open(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+        return false;
+
+    if (!open(f)) {
+        fprintf(stderr, "%s is not a valid codec trace\n", filename);
+        return false;
+    }
+    return true;
+}
+
+bool codec_trace_source_t::open(FILE *f) {
+    fp = f;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, TRACE_CODEC_MAGIC, sizeof(header.magic)) != 0 || header.version != 1)
+        return false;
+
+    state = codec_state_t();
+    // zeroed slack past the end keeps a truncated record inside the buffer
+    buf.assign(CODEC_BUFFER_SIZE + CODEC_MAX_RECORD, 0);
+    pos = 0;
+    end = 0;
+    eof = false;
+    decoded = 0;
+    return true;
+}
+
+// move the unread tail to the front and top the buffer up
+bool codec_trace_source_t::refill() {
+    size_t left = end - pos;
+    memmove(buf.data(), buf.data() + pos, left);
+    pos = 0;
+    end = left;
+
+    while (end < CODEC_BUFFER_SIZE && !eof) {
+        size_t n = fread(buf.data() + end, 1, CODEC_BUFFER_SIZE - end, fp);
+        if (n == 0)
+            eof = true;
+        end += n;
+    }
+    memset(buf.data() + end, 0, buf.size() - end);
+    return end > 0;
+}
+
+size_t codec_trace_source_t::read_batch(Trace_Rec *recs, size_t n) {
+    size_t i;
+    // refill() moves the data within buf, never buf itself
+    const uint8_t *base = buf.data();
+
+    for (i = 0; i < n; i++) {
+        if (end - pos < CODEC_MAX_RECORD && !eof)
+            refill();
+        if (pos >= end) {
+            // a file cut between two records still decodes cleanly
+            if (!error && header.record_count && decoded != header.record_count) {
+                fprintf(stderr, "Codec trace is truncated: %" PRIu64 " of %" PRIu64 " records\n", decoded,
+                        header.record_count);
+                error = true;
+            }
+            break;
+        }
+
+        const uint8_t *p = base + pos;
+        uint8_t tag = *p++;
+        Trace_Rec *rec = &recs[i];
+        codec_entry_t *e;
+
+        memset(rec, 0, sizeof(*rec));
+
+        if (tag & TAG_RAW) {
+            codec_static_t fields;
+
+            rec->inst_addr = get_u64(p);
+            memcpy(&fields, p, sizeof(fields));
+            p += sizeof(fields);
+            set_static(rec, fields);
+            rec->mem_addr = get_u64(p);
+            rec->mem_write = *p++;
+            rec->mem_read = *p++;
+            rec->br_dir = *p++;
+            rec->br_target = get_u64(p);
+            e = &state.entry(rec->inst_addr);
+        } else {
+            if (tag & TAG_PC_NEXT)
+                rec->inst_addr = state.prev_entry->next_inst_addr;
+            else
+                rec->inst_addr = state.prev_inst_addr + unzigzag(get_varint(p));
+            e = &state.entry(rec->inst_addr);
+
+            if (tag & TAG_STATIC_HIT) {
+                set_static(rec, e->fields);
+                rec->br_target = e->br_target;
+            } else {
+                codec_static_t fields;
+                memcpy(&fields, p, sizeof(fields));
+                p += sizeof(fields);
+                set_static(rec, fields);
+                rec->br_target = rec->inst_addr + unzigzag(get_varint(p));
+            }
+
+            if (tag & TAG_MEM_ZERO)
+                rec->mem_addr = 0;
+            else if (tag & TAG_MEM_DELTA)
+                rec->mem_addr = mem_base(state, *e, rec->inst_addr) + unzigzag(get_varint(p));
+            else
+                rec->mem_addr = mem_base(state, *e, rec->inst_addr);
+
+            rec->mem_read = (tag & TAG_MEM_READ) != 0;
+            rec->mem_write = (tag & TAG_MEM_WRITE) != 0;
+            rec->br_dir = (tag & TAG_BR_DIR) != 0;
+        }
+
+        pos = p - base;
+        if (pos > end) {
+            fprintf(stderr, "Codec trace is truncated\n");
+            error = true;
+            pos = end;
+            break;
+        }
+        codec_update(state, *e, rec);
+        decoded++;
+    }
+    return i;
+}
+
+bool codec_trace_source_t::read(Trace_Rec *rec) {
+    return read_batch(rec, 1) == 1;
+}
@@ -0,0 +1,121 @@
+#ifndef TRACE_CODEC_H
+#define TRACE_CODEC_H
+
+#include "trace_source.hpp"
+#include "mem_stats.hpp"
+
+/*
+ * Compact trace codec (.ptc)
+ *
+ *   header | record | record | ...
+ *
+ * Every record starts with a tag byte. A direct-mapped table indexed by
+ * inst_addr remembers, for each instruction, the static fields (op type,
+ * registers, needed flags, condition codes and branch target), the
+ * instruction that followed it and the last mem_addr it used. Whatever
+ * matches the table is only a bit in the tag; inst_addr otherwise is a
+ * zigzag varint delta from the previous record and mem_addr a delta from
+ * the last address of the same instruction. The one bit fields live in
+ * the tag too, records with flag values above one are stored raw.
+ * A typical record takes one to three bytes.
+ */
+
+#define TRACE_CODEC_MAGIC "PTCODEC1"
+#define TRACE_CODEC_TABLE_BITS 12
+
+struct trace_codec_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t record_count;  // 0 if the writer could not seek back
+};
+
+// the part of a record that repeats for every execution of an instruction
+struct codec_static_t {
+    uint8_t op_type;
+    uint8_t dest;
+    uint8_t dest_needed;
+    uint8_t src1_reg;
+    uint8_t src2_reg;
+    uint8_t src1_needed;
+    uint8_t src2_needed;
+    uint8_t cc_read;
+    uint8_t cc_write;
+};
+
+struct codec_entry_t {
+    uint64_t inst_addr;
+    uint64_t br_target;
+    uint64_t last_mem;
+    uint64_t next_inst_addr;  // inst_addr that followed it last time
+    codec_static_t fields;
+};
+
+// predictor state that the encoder and the decoder keep in lockstep
+struct codec_state_t {
+    codec_state_t();
+    // prev_entry points into table
+    codec_state_t(const codec_state_t &other);
+    codec_state_t &operator=(const codec_state_t &other);
+
+    codec_entry_t &entry(uint64_t inst_addr) {
+        return table[(inst_addr ^ (inst_addr >> TRACE_CODEC_TABLE_BITS)) & ((1 << TRACE_CODEC_TABLE_BITS) - 1)];
+    }
+
+    uint64_t prev_inst_addr;
+    uint64_t prev_mem_addr;
+    codec_entry_t *prev_entry;
+    mem_vector_t<codec_entry_t, MEM_TRACE> table;
+};
+
+// returns true if the file starts with the codec magic
+bool is_codec_trace(const char *filename);
+
+class trace_codec_writer_t {
+public:
+    trace_codec_writer_t() : fp(NULL) { }
+    ~trace_codec_writer_t() { close(); }
+
+    bool open(const char *filename);
+    bool write(const Trace_Rec *rec);
+    bool close();
+
+    uint64_t bytes() const { return written + buf.size(); }
+
+private:
+    FILE *fp;
+    trace_codec_header_t header;
+    uint64_t written;
+    codec_state_t state;
+    std::vector<uint8_t> buf;
+};
+
+struct codec_trace_source_t : public trace_source_t {
+    codec_trace_source_t() : fp(NULL) { }
+    ~codec_trace_source_t();
+
+    bool open(const char *filename);
+    // decode from an already open stream, e.g. a pipe
+    bool open(FILE *fp);
+
+    bool read(Trace_Rec *rec);
+
+    // decode up to n records, returns the number decoded
+    size_t read_batch(Trace_Rec *recs, size_t n);
+
+    uint64_t record_count() const { return header.record_count; }
+
+private:
+    bool refill();
+
+    FILE *fp;
+    trace_codec_header_t header;
+    codec_state_t state;
+    mem_vector_t<uint8_t, MEM_TRACE> buf;
+    size_t pos;
+    size_t end;
+    bool eof;
+    uint64_t decoded;   // records so far, checked against the header at the end
+};
+
+#endif /* TRACE_CODEC_H */
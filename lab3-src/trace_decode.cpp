@@ -0,0 +1,128 @@
+#include <stddef.h>
+#include <string.h>
+#include "trace_decode.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// the vector decode loads the eight bytes from op_type to cc_read as one word
+static_assert(offsetof(Trace_Rec, dest) == offsetof(Trace_Rec, op_type) + 1 &&
+              offsetof(Trace_Rec, dest_needed) == offsetof(Trace_Rec, op_type) + 2 &&
+              offsetof(Trace_Rec, src1_reg) == offsetof(Trace_Rec, op_type) + 3 &&
+              offsetof(Trace_Rec, src2_reg) == offsetof(Trace_Rec, op_type) + 4 &&
+              offsetof(Trace_Rec, src1_needed) == offsetof(Trace_Rec, op_type) + 5 &&
+              offsetof(Trace_Rec, src2_needed) == offsetof(Trace_Rec, op_type) + 6,
+              "unexpected Trace_Rec layout");
+
+// register if needed is 1, -1 otherwise
+static inline int16_t masked_reg(uint8_t reg, uint8_t needed) {
+    int16_t keep = -(int16_t) (needed == 1);
+    return (reg & keep) | ~keep;
+}
+
+static void decode_scalar(const Trace_Rec *recs, size_t first, size_t n, decoded_batch_t *out) {
+    for (size_t i = first; i < n; i++) {
+        const Trace_Rec &tr = recs[i];
+        out->op_code[i] = (tr.op_type == OP_LD || tr.op_type == OP_ST) | ((tr.op_type == OP_CBR) << 1);
+        out->dest_reg[i] = masked_reg(tr.dest, tr.dest_needed);
+        out->src_reg[0][i] = masked_reg(tr.src1_reg, tr.src1_needed);
+        out->src_reg[1][i] = masked_reg(tr.src2_reg, tr.src2_needed);
+    }
+}
+
+#ifdef __SSE2__
+// store the registers where needed is 1 as 16 bit values, -1 elsewhere
+static inline void store_masked_regs(int16_t *out, __m128i reg, __m128i needed) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8(-1);
+    __m128i keep = _mm_cmpeq_epi8(needed, _mm_set1_epi8(1));
+
+    __m128i lo = _mm_unpacklo_epi8(reg, zero);
+    __m128i hi = _mm_unpackhi_epi8(reg, zero);
+    __m128i keep_lo = _mm_unpacklo_epi8(keep, keep);
+    __m128i keep_hi = _mm_unpackhi_epi8(keep, keep);
+
+    _mm_storeu_si128((__m128i *) out, _mm_or_si128(_mm_and_si128(lo, keep_lo), _mm_andnot_si128(keep_lo, ones)));
+    _mm_storeu_si128((__m128i *) (out + 8), _mm_or_si128(_mm_and_si128(hi, keep_hi), _mm_andnot_si128(keep_hi, ones)));
+}
+
+// decode sixteen records starting at first
+static void decode_sse2(const Trace_Rec *recs, size_t first, decoded_batch_t *out) {
+    __m128i t[8], u[8], v[8], field[8];
+
+    /* Transpose the op and register bytes of the records into one vector per field */
+    for (int k = 0; k < 8; k++) {
+        __m128i a = _mm_loadl_epi64((const __m128i *) &recs[first + 2 * k].op_type);
+        __m128i b = _mm_loadl_epi64((const __m128i *) &recs[first + 2 * k + 1].op_type);
+        t[k] = _mm_unpacklo_epi8(a, b);
+    }
+    for (int k = 0; k < 4; k++) {
+        u[k] = _mm_unpacklo_epi16(t[2 * k], t[2 * k + 1]);
+        u[k + 4] = _mm_unpackhi_epi16(t[2 * k], t[2 * k + 1]);
+    }
+    for (int k = 0; k < 4; k += 2) {
+        v[k] = _mm_unpacklo_epi32(u[k], u[k + 1]);
+        v[k + 1] = _mm_unpackhi_epi32(u[k], u[k + 1]);
+        v[k + 4] = _mm_unpacklo_epi32(u[k + 4], u[k + 5]);
+        v[k + 5] = _mm_unpackhi_epi32(u[k + 4], u[k + 5]);
+    }
+    for (int k = 0; k < 2; k++) {
+        field[2 * k] = _mm_unpacklo_epi64(v[k], v[k + 2]);
+        field[2 * k + 1] = _mm_unpackhi_epi64(v[k], v[k + 2]);
+        field[2 * k + 4] = _mm_unpacklo_epi64(v[k + 4], v[k + 6]);
+        field[2 * k + 5] = _mm_unpackhi_epi64(v[k + 4], v[k + 6]);
+    }
+
+    /* Op class: 1 for loads and stores, 2 for branches, 0 for the rest */
+    __m128i op = field[0];
+    __m128i is_mem = _mm_or_si128(_mm_cmpeq_epi8(op, _mm_set1_epi8(OP_LD)), _mm_cmpeq_epi8(op, _mm_set1_epi8(OP_ST)));
+    __m128i is_cbr = _mm_cmpeq_epi8(op, _mm_set1_epi8(OP_CBR));
+    __m128i code = _mm_or_si128(_mm_and_si128(is_mem, _mm_set1_epi8(1)), _mm_and_si128(is_cbr, _mm_set1_epi8(2)));
+    _mm_storeu_si128((__m128i *) &out->op_code[first], code);
+
+    /* Registers */
+    store_masked_regs(&out->dest_reg[first], field[1], field[2]);
+    store_masked_regs(&out->src_reg[0][first], field[3], field[5]);
+    store_masked_regs(&out->src_reg[1][first], field[4], field[6]);
+}
+#endif
+
+void decode_batch(const Trace_Rec *recs, size_t n, decoded_batch_t *out) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16)
+        decode_sse2(recs, i, out);
+#endif
+    decode_scalar(recs, i, n, out);
+
+    for (i = 0; i < n; i++) {
+        out->inst_addr[i] = recs[i].inst_addr;
+        out->mem_addr[i] = recs[i].mem_addr;
+        out->mem_read[i] = recs[i].mem_read != 0;
+        out->mem_write[i] = recs[i].mem_write != 0;
+        out->br_taken[i] = recs[i].br_dir != 0;
+    }
+    out->n = n;
+}
+
+trace_decoder_t::trace_decoder_t() : src(NULL), pos(0), raw(DECODE_BATCH), decoded(1) {
+    cur = &decoded[0];
+    cur->n = 0;
+}
+
+void trace_decoder_t::reset(trace_source_t *src) {
+    this->src = src;
+    pos = 0;
+    cur->n = 0;
+}
+
+bool trace_decoder_t::refill() {
+    if (src == NULL)
+        return false;
+
+    size_t n = src->read_batch(raw.data(), DECODE_BATCH);
+    decode_batch(raw.data(), n, cur);
+    pos = 0;
+    return n > 0;
+}
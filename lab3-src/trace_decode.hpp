@@ -0,0 +1,68 @@
+#ifndef TRACE_DECODE_H
+#define TRACE_DECODE_H
+
+#include "procsim.hpp"
+#include "trace_source.hpp"
+#include "mem_stats.hpp"
+
+/*
+ * Batch decoder
+ *
+ * Reads DECODE_BATCH raw records at a time and decodes them into one
+ * column per field, so fetch takes ready instructions out of a buffer
+ * instead of decoding one record per call. The decode has no branches on
+ * the record contents: the op class comes out of byte compares and the
+ * unused registers are masked to -1. With SSE2 sixteen records are
+ * decoded at once by transposing their op and register bytes into
+ * vectors, the rest of the batch goes through the scalar version of the
+ * same arithmetic.
+ */
+
+#define DECODE_BATCH 256
+
+// decoded instructions, one array per field
+struct decoded_batch_t {
+    size_t n;
+    uint32_t inst_addr[DECODE_BATCH];
+    int16_t dest_reg[DECODE_BATCH];
+    int16_t src_reg[2][DECODE_BATCH];
+    uint8_t op_code[DECODE_BATCH];
+    uint8_t mem_read[DECODE_BATCH];
+    uint8_t mem_write[DECODE_BATCH];
+    uint8_t br_taken[DECODE_BATCH];
+    uint64_t mem_addr[DECODE_BATCH];
+};
+
+// decode n <= DECODE_BATCH records into out
+void decode_batch(const Trace_Rec *recs, size_t n, decoded_batch_t *out);
+
+class trace_decoder_t {
+public:
+    trace_decoder_t();
+    trace_decoder_t(const trace_decoder_t &) = delete;
+    trace_decoder_t &operator=(const trace_decoder_t &) = delete;
+
+    // start over on src, dropping what was read ahead
+    void reset(trace_source_t *src);
+
+    // index of the next instruction in batch(), false at the end of the trace
+    bool next(size_t *i) {
+        if (pos == cur->n && !refill())
+            return false;
+        *i = pos++;
+        return true;
+    }
+
+    const decoded_batch_t &batch() const { return *cur; }
+
+private:
+    bool refill();
+
+    trace_source_t *src;
+    size_t pos;
+    mem_vector_t<Trace_Rec, MEM_TRACE> raw;
+    mem_vector_t<decoded_batch_t, MEM_TRACE> decoded;
+    decoded_batch_t *cur;
+};
+
+#endif /* TRACE_DECODE_H */
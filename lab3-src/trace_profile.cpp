@@ -0,0 +1,279 @@
+#include <cinttypes>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include "trace_profile.hpp"
+
+// records read and profiled at a time
+#define PROFILE_BATCH 4096
+// copies of the counting histograms, consecutive records go to different ones
+#define PROFILE_LANES 4
+#define PROFILE_SET_INITIAL 4096
+
+static const char *op_type_names[NUM_OP_TYPE + 1] = { "ALU", "LD", "ST", "CBR", "OTHER", "UNKNOWN" };
+
+// the distinct addresses (line or page numbers) seen, linear probing, kept at most half full
+class addr_set_t {
+public:
+    addr_set_t() : slots(PROFILE_SET_INITIAL), used(0) { }
+
+    // returns true if key is new
+    bool insert(uint64_t key) {
+        size_t mask = slots.size() - 1;
+        size_t i = hash(key) & mask;
+
+        while (slots[i] != key + 1) {
+            if (slots[i] == 0) {
+                if (2 * (used + 1) > slots.size()) {
+                    grow();
+                    return insert(key);
+                }
+                slots[i] = key + 1;
+                used++;
+                return true;
+            }
+            i = (i + 1) & mask;
+        }
+        return false;
+    }
+
+    size_t size() const { return used; }
+
+private:
+    static size_t hash(uint64_t key) {
+        key *= 0x9e3779b97f4a7c15ULL;
+        return key ^ (key >> 32);
+    }
+
+    void grow() {
+        mem_vector_t<uint64_t, MEM_TRACE> old(slots.size() * 2);
+        old.swap(slots);
+
+        size_t mask = slots.size() - 1;
+        for (uint64_t s : old) {
+            if (s == 0)
+                continue;
+            size_t i = hash(s - 1) & mask;
+            while (slots[i] != 0)
+                i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+    mem_vector_t<uint64_t, MEM_TRACE> slots;
+    size_t used;
+};
+
+// state carried from one batch to the next
+struct profile_state_t {
+    uint64_t op_types[PROFILE_LANES][NUM_OP_TYPE + 1];
+    uint64_t reg_reads[PROFILE_LANES][256];
+    uint64_t reg_writes[PROFILE_LANES][256];
+
+    uint64_t last_writer[256];      // instruction number (from 1) of the last writer, 0 if none
+
+    bool have_access;
+    uint64_t last_addr;
+    int64_t last_stride;
+    uint64_t last_line;
+    addr_set_t lines;
+    addr_set_t pages;
+};
+
+static inline uint32_t stride_bucket(uint64_t abs_stride) {
+    return (abs_stride > 0) + (abs_stride > 8) + (abs_stride > 64) + (abs_stride > 4096);
+}
+
+// counters that don't depend on the order of the records. Transposing the
+// records with SSE2 like trace_decode.cpp does costs more than it saves
+// here: the register histograms still take one increment per operand
+static void count_batch(const Trace_Rec *recs, size_t n, profile_state_t *s, trace_profile_t *p) {
+    uint64_t taken = 0;
+    uint64_t branches = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        const Trace_Rec &r = recs[i];
+        size_t lane = i & (PROFILE_LANES - 1);
+        uint8_t op = std::min<uint8_t>(r.op_type, NUM_OP_TYPE);
+
+        s->op_types[lane][op]++;
+        branches += (op == OP_CBR);
+        taken += (op == OP_CBR) & (r.br_dir != 0);
+        s->reg_reads[lane][r.src1_reg] += (r.src1_needed == 1);
+        s->reg_reads[lane][r.src2_reg] += (r.src2_needed == 1);
+        s->reg_writes[lane][r.dest] += (r.dest_needed == 1);
+    }
+
+    p->branches += branches;
+    p->taken += taken;
+}
+
+// how far back the producer of every source is, in program order
+static void count_distances(const Trace_Rec *recs, size_t n, uint64_t first, profile_state_t *s,
+                            trace_profile_t *p) {
+    for (size_t i = 0; i < n; i++) {
+        const Trace_Rec &r = recs[i];
+        uint64_t id = first + i + 1;
+        uint8_t regs[2] = { r.src1_reg, r.src2_reg };
+        uint8_t needed[2] = { r.src1_needed == 1, r.src2_needed == 1 };
+
+        for (int k = 0; k < 2; k++) {
+            uint64_t w = s->last_writer[regs[k]];
+            uint64_t dist = id - w;
+            uint32_t bucket = std::min<uint32_t>(63 - __builtin_clzll(dist), PROFILE_DIST_BUCKETS - 1);
+            p->dist[bucket] += needed[k] & (w != 0);
+            p->no_producer += needed[k] & (w == 0);
+        }
+        s->last_writer[r.dest] = (r.dest_needed == 1) ? id : s->last_writer[r.dest];
+    }
+}
+
+// strides and footprint of the loads and stores, in program order
+static void count_accesses(const Trace_Rec *recs, size_t n, profile_state_t *s, trace_profile_t *p) {
+    for (size_t i = 0; i < n; i++) {
+        const Trace_Rec &r = recs[i];
+        if (!r.mem_read && !r.mem_write)
+            continue;
+
+        p->loads += (r.mem_read != 0);
+        p->stores += (r.mem_write != 0);
+
+        if (s->have_access) {
+            int64_t stride = (int64_t) (r.mem_addr - s->last_addr);
+            p->strides[stride_bucket(stride < 0 ? -(uint64_t) stride : stride)]++;
+            p->repeated_strides += (stride == s->last_stride);
+            s->last_stride = stride;
+        }
+        s->have_access = true;
+        s->last_addr = r.mem_addr;
+
+        // a line seen just before needs no lookup, a page only when its line is new
+        uint64_t line = r.mem_addr >> PROFILE_LINE_BITS;
+        if (line + 1 != s->last_line && s->lines.insert(line))
+            s->pages.insert(r.mem_addr >> PROFILE_PAGE_BITS);
+        s->last_line = line + 1;
+    }
+}
+
+void profile_trace(trace_source_t *src, trace_profile_t *profile) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(profile, 0, sizeof(trace_profile_t));
+    profile_state_t *s = new profile_state_t();
+    memset(s->op_types, 0, sizeof(s->op_types));
+    memset(s->reg_reads, 0, sizeof(s->reg_reads));
+    memset(s->reg_writes, 0, sizeof(s->reg_writes));
+    memset(s->last_writer, 0, sizeof(s->last_writer));
+    s->have_access = false;
+    s->last_addr = 0;
+    s->last_stride = 0;
+    s->last_line = 0;
+
+    mem_vector_t<Trace_Rec, MEM_TRACE> recs(PROFILE_BATCH);
+    size_t n;
+    while ((n = src->read_batch(recs.data(), recs.size())) > 0) {
+        count_batch(recs.data(), n, s, profile);
+        count_distances(recs.data(), n, profile->insts, s, profile);
+        count_accesses(recs.data(), n, s, profile);
+        profile->insts += n;
+    }
+
+    /* Fold the lanes */
+    for (int lane = 0; lane < PROFILE_LANES; lane++) {
+        for (int op = 0; op <= NUM_OP_TYPE; op++)
+            profile->op_types[op] += s->op_types[lane][op];
+        for (int reg = 0; reg < 256; reg++) {
+            profile->reg_reads[reg] += s->reg_reads[lane][reg];
+            profile->reg_writes[reg] += s->reg_writes[lane][reg];
+        }
+    }
+    profile->lines = s->lines.size();
+    profile->pages = s->pages.size();
+    delete s;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    profile->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double share(uint64_t part, uint64_t total) {
+    return total ? part * 100.0 / total : 0.0;
+}
+
+void print_trace_profile(FILE *out, const trace_profile_t &p, unsigned top_regs) {
+    fprintf(out, "Instructions: %" PRIu64 "\n", p.insts);
+
+    fprintf(out, "Op mix:");
+    for (int op = 0; op <= NUM_OP_TYPE; op++) {
+        if (op < NUM_OP_TYPE || p.op_types[op])
+            fprintf(out, " %s %" PRIu64 " (%.1f%%)", op_type_names[op], p.op_types[op], share(p.op_types[op], p.insts));
+    }
+    fprintf(out, "\n");
+
+    fprintf(out, "Branches: %" PRIu64 ", taken %" PRIu64 " (%.1f%%)\n", p.branches, p.taken,
+            share(p.taken, p.branches));
+
+    /* Registers */
+    uint64_t reads = 0, writes = 0;
+    unsigned read_regs = 0, written_regs = 0;
+    std::vector<int> regs;
+    for (int reg = 0; reg < 256; reg++) {
+        reads += p.reg_reads[reg];
+        writes += p.reg_writes[reg];
+        read_regs += p.reg_reads[reg] != 0;
+        written_regs += p.reg_writes[reg] != 0;
+        if (p.reg_reads[reg] || p.reg_writes[reg])
+            regs.push_back(reg);
+    }
+    fprintf(out, "Register reads: %" PRIu64 " (%.2f per instruction, %u registers)\n", reads,
+            p.insts ? reads * 1.0 / p.insts : 0.0, read_regs);
+    fprintf(out, "Register writes: %" PRIu64 " (%.2f per instruction, %u registers)\n", writes,
+            p.insts ? writes * 1.0 / p.insts : 0.0, written_regs);
+
+    size_t top = std::min<size_t>(top_regs, regs.size());
+    std::partial_sort(regs.begin(), regs.begin() + top, regs.end(), [&](int a, int b) {
+        uint64_t ua = p.reg_reads[a] + p.reg_writes[a], ub = p.reg_reads[b] + p.reg_writes[b];
+        return ua != ub ? ua > ub : a < b;
+    });
+    fprintf(out, "REG\tREADS\tWRITES\n");
+    for (size_t i = 0; i < top; i++)
+        fprintf(out, "r%d\t%" PRIu64 "\t%" PRIu64 "\n", regs[i], p.reg_reads[regs[i]], p.reg_writes[regs[i]]);
+
+    /* Producer distances, up to the last bucket in use */
+    int last = 0;
+    for (int b = 0; b < PROFILE_DIST_BUCKETS; b++) {
+        if (p.dist[b])
+            last = b;
+    }
+    fprintf(out, "Producer distance of source reads (instructions):\n");
+    fprintf(out, "DIST\tREADS\tSHARE\tCUMULATIVE\n");
+    uint64_t cumulative = 0;
+    for (int b = 0; b <= last; b++) {
+        cumulative += p.dist[b];
+        if (b == PROFILE_DIST_BUCKETS - 1)
+            fprintf(out, "%" PRIu64 "+", (uint64_t) 1 << b);
+        else if (b == 0)
+            fprintf(out, "1");
+        else
+            fprintf(out, "%" PRIu64 "-%" PRIu64, (uint64_t) 1 << b, ((uint64_t) 2 << b) - 1);
+        fprintf(out, "\t%" PRIu64 "\t%.1f%%\t%.1f%%\n", p.dist[b], share(p.dist[b], reads), share(cumulative, reads));
+    }
+    fprintf(out, "none\t%" PRIu64 "\t%.1f%%\n", p.no_producer, share(p.no_producer, reads));
+
+    /* Memory */
+    static const char *stride_names[PROFILE_STRIDE_BUCKETS] = { "0", "1-8", "9-64", "65-4K", ">4K" };
+    uint64_t accesses = 0;
+    for (int b = 0; b < PROFILE_STRIDE_BUCKETS; b++)
+        accesses += p.strides[b];
+
+    fprintf(out, "Memory accesses: %" PRIu64 " loads, %" PRIu64 " stores\n", p.loads, p.stores);
+    fprintf(out, "Stride between accesses (bytes):");
+    for (int b = 0; b < PROFILE_STRIDE_BUCKETS; b++)
+        fprintf(out, " %s %.1f%%", stride_names[b], share(p.strides[b], accesses));
+    fprintf(out, ", repeated %.1f%%\n", share(p.repeated_strides, accesses));
+    fprintf(out, "Footprint: %" PRIu64 " lines (%" PRIu64 " KB), %" PRIu64 " pages (%" PRIu64 " KB)\n",
+            p.lines, (p.lines << PROFILE_LINE_BITS) >> 10, p.pages, (p.pages << PROFILE_PAGE_BITS) >> 10);
+
+    fprintf(out, "Profiled in %.2f s (%.1f M instructions/s)\n", p.seconds,
+            p.seconds > 0 ? p.insts / p.seconds / 1e6 : 0.0);
+}
@@ -0,0 +1,63 @@
+#ifndef TRACE_PROFILE_H
+#define TRACE_PROFILE_H
+
+#include <cstdio>
+#include "procsim.hpp"
+#include "trace_source.hpp"
+
+/*
+ * Whole-trace profile
+ *
+ * Characterizes a trace in one streaming pass over its raw records: the op
+ * type mix, how often every register is read and written, how many
+ * instructions back the producer of every source is, the branch taken
+ * rate, the stride between consecutive memory accesses and the number of
+ * cache lines and pages they touch. The records are read in large batches
+ * and every statistic is a separate loop over the batch: the counting
+ * loops have no branches on the record contents and keep several copies
+ * of each counter so consecutive records don't wait on each other's
+ * increments, only the producer distances and the footprint sets walk the
+ * batch in order. The gunzip pipe decompresses in its own process at the
+ * same time, so a trace profiles at about the speed it decompresses.
+ */
+
+#define PROFILE_DEFAULT_TOP_REGS 8
+// producer distances in power of two buckets: 1, 2-3, 4-7, ... and beyond the last
+#define PROFILE_DIST_BUCKETS 18
+// |stride| buckets in bytes: 0, 1-8, 9-64, 65-4096, larger
+#define PROFILE_STRIDE_BUCKETS 5
+#define PROFILE_LINE_BITS 6
+#define PROFILE_PAGE_BITS 12
+
+struct trace_profile_t {
+    uint64_t insts;
+    uint64_t op_types[NUM_OP_TYPE + 1];     // the last counts unknown op types
+
+    uint64_t branches;
+    uint64_t taken;
+
+    uint64_t reg_reads[256];
+    uint64_t reg_writes[256];
+
+    // source reads by how many instructions back their producer is, and
+    // those with no earlier writer in the trace
+    uint64_t dist[PROFILE_DIST_BUCKETS];
+    uint64_t no_producer;
+
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t strides[PROFILE_STRIDE_BUCKETS];
+    uint64_t repeated_strides;      // the same stride as the access before
+    uint64_t lines;                 // distinct PROFILE_LINE_BITS lines touched
+    uint64_t pages;
+
+    double seconds;
+};
+
+// profile what is left of src
+void profile_trace(trace_source_t *src, trace_profile_t *profile);
+
+// the report, with the top_regs most used registers
+void print_trace_profile(FILE *out, const trace_profile_t &profile, unsigned top_regs);
+
+#endif /* TRACE_PROFILE_H */
@@ -0,0 +1,274 @@
+#include <cinttypes>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <new>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace_shm.hpp"
+#include "mem_stats.hpp"
+
+// milliseconds an attaching process waits for the creator to size the header
+#define SHM_HEADER_TIMEOUT_MS 2000
+
+// one segment per trace contents: path, size and modification time
+static std::string shm_name_for(const char *filename, const struct stat &st) {
+    char path[PATH_MAX];
+    uint64_t hash = 14695981039346656037ULL;
+
+    if (realpath(filename, path) == NULL)
+        strncpy(path, filename, sizeof(path) - 1);
+    path[sizeof(path) - 1] = 0;
+
+    std::string key = std::string(path) + ":" + std::to_string((long long) st.st_size) +
+                      ":" + std::to_string((long long) st.st_mtime);
+    for (auto c : key)
+        hash = (hash ^ (uint8_t) c) * 1099511628211ULL;
+
+    char name[64];
+    snprintf(name, sizeof(name), "/procsim-trace-%016" PRIx64, hash);
+    return name;
+}
+
+static size_t page_size() {
+    return sysconf(_SC_PAGESIZE);
+}
+
+shm_trace_source_t::~shm_trace_source_t() {
+    if (records != NULL) {
+        munmap((void *) records, map_size);
+        mem_account_free(MEM_TRACE, map_size);
+    }
+
+    if (header != NULL) {
+        // failed segments were already unlinked by whoever failed them
+        if (header->refs.fetch_sub(1) == 1 && header->state.load() == SHM_READY)
+            shm_unlink(name.c_str());
+        munmap(header, page_size());
+    }
+}
+
+bool shm_trace_source_t::open(const char *filename) {
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        fprintf(stderr, "Unable to open %s\n", filename);
+        return false;
+    }
+    name = shm_name_for(filename, st);
+    created = false;
+
+    for (int tries = 0; tries < 1000; tries++) {
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            bool ok = create(filename, fd);
+            close(fd);
+            return ok;
+        }
+        if (errno != EEXIST) {
+            perror("shm_open");
+            return false;
+        }
+
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            // the last user unlinked it in the meantime
+            if (errno == ENOENT)
+                continue;
+            perror("shm_open");
+            return false;
+        }
+
+        int rc = attach(fd);
+        close(fd);
+        if (rc != 0)
+            return rc > 0;
+        usleep(1000);
+    }
+    return false;
+}
+
+bool shm_trace_source_t::create(const char *filename, int fd) {
+    size_t page = page_size();
+
+    // nobody can use a segment without a header, don't leave it behind
+    if (ftruncate(fd, page) != 0) {
+        perror("ftruncate");
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void *p = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    header = new (p) trace_shm_header_t();
+    memcpy(header->magic, TRACE_SHM_MAGIC, sizeof(header->magic));
+    header->state.store(SHM_DECODING);
+    header->owner = getpid();
+    header->record_count = 0;
+    header->refs.store(1);
+    created = true;
+
+    trace_source_t *src = open_trace_source(filename);
+    uint64_t cap = 0;
+    uint64_t count = 0;
+    Trace_Rec *data = NULL;
+    bool ok = (src != NULL);
+
+    // decode straight into the segment, doubling it as it fills up
+    while (ok) {
+        if (count == cap) {
+            if (data != NULL) {
+                munmap(data, cap * sizeof(Trace_Rec));
+                mem_account_free(MEM_TRACE, cap * sizeof(Trace_Rec));
+            }
+            cap = cap ? cap * 2 : 65536;
+
+            data = NULL;
+            ok = ftruncate(fd, page + cap * sizeof(Trace_Rec)) == 0;
+            if (ok) {
+                p = mmap(NULL, cap * sizeof(Trace_Rec), PROT_READ | PROT_WRITE, MAP_SHARED, fd, page);
+                ok = (p != MAP_FAILED);
+                data = ok ? (Trace_Rec *) p : NULL;
+                if (ok)
+                    mem_account_alloc(MEM_TRACE, cap * sizeof(Trace_Rec));
+            }
+            if (!ok)
+                break;
+        }
+
+        if (!src->read(&data[count]))
+            break;
+        count++;
+    }
+    // others would take a truncated trace for the whole one
+    if (src != NULL && src->failed())
+        ok = false;
+    delete src;
+
+    if (data != NULL) {
+        munmap(data, cap * sizeof(Trace_Rec));
+        mem_account_free(MEM_TRACE, cap * sizeof(Trace_Rec));
+    }
+
+    if (ok) {
+        ok = ftruncate(fd, page + count * sizeof(Trace_Rec)) == 0;
+        map_size = count * sizeof(Trace_Rec);
+        if (ok && map_size) {
+            p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, page);
+            ok = (p != MAP_FAILED);
+            records = ok ? (const Trace_Rec *) p : NULL;
+            if (ok)
+                mem_account_alloc(MEM_TRACE, map_size);
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Unable to publish %s in shared memory\n", filename);
+        header->state.store(SHM_FAILED);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    header->record_count = count;
+    header->state.store(SHM_READY, std::memory_order_release);
+    printf("Published shared trace: %s (%s, %" PRIu64 " instructions)\n", name.c_str(), filename, count);
+    return true;
+}
+
+// 1 - attached, 0 - segment is going away, retry, -1 - failed
+int shm_trace_source_t::attach(int fd) {
+    size_t page = page_size();
+    struct stat st;
+
+    // the creator sizes the header right after creating the segment, if it
+    // doesn't it died in between and the segment is never going to be usable
+    for (int waited = 0; fstat(fd, &st) == 0 && (size_t) st.st_size < page; waited++) {
+        if (waited == SHM_HEADER_TIMEOUT_MS) {
+            fprintf(stderr, "Shared trace %s was never set up, removing it\n", name.c_str());
+            shm_unlink(name.c_str());
+            return -1;
+        }
+        usleep(1000);
+    }
+
+    void *p = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return -1;
+    trace_shm_header_t *h = (trace_shm_header_t *) p;
+
+    // only join a segment that still has users
+    uint32_t refs = h->refs.load(std::memory_order_acquire);
+    do {
+        if (refs == 0) {
+            munmap(p, page);
+            return 0;
+        }
+    } while (!h->refs.compare_exchange_weak(refs, refs + 1));
+    header = h;
+
+    if (memcmp(header->magic, TRACE_SHM_MAGIC, sizeof(header->magic)) != 0)
+        return -1;
+
+    uint32_t state;
+    while ((state = header->state.load(std::memory_order_acquire)) == SHM_DECODING) {
+        // the decoding process died, start over with a fresh segment
+        if (kill(header->owner, 0) != 0 && errno == ESRCH) {
+            uint32_t expected = SHM_DECODING;
+            if (header->state.compare_exchange_strong(expected, SHM_FAILED)) {
+                shm_unlink(name.c_str());
+                header->refs.fetch_sub(1);
+                munmap(header, page);
+                header = NULL;
+                return 0;
+            }
+            continue;
+        }
+        usleep(1000);
+    }
+    if (state != SHM_READY)
+        return -1;
+
+    map_size = header->record_count * sizeof(Trace_Rec);
+    if (map_size) {
+        p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, page);
+        if (p == MAP_FAILED)
+            return -1;
+        records = (const Trace_Rec *) p;
+        mem_account_alloc(MEM_TRACE, map_size);
+    }
+
+    printf("Attached shared trace: %s (%" PRIu64 " instructions)\n", name.c_str(), header->record_count);
+    return 1;
+}
+
+bool shm_trace_source_t::read(Trace_Rec *rec) {
+    if (pos >= header->record_count)
+        return false;
+
+    *rec = records[pos++];
+    return true;
+}
+
+size_t shm_trace_source_t::read_batch(Trace_Rec *recs, size_t n) {
+    uint64_t left = header->record_count - pos;
+    if (n > left)
+        n = left;
+    memcpy(recs, records + pos, n * sizeof(Trace_Rec));
+    pos += n;
+    return n;
+}
+
+uint64_t shm_trace_source_t::skip(uint64_t n) {
+    uint64_t left = header->record_count - pos;
+    if (n > left)
+        n = left;
+    pos += n;
+    return n;
+}
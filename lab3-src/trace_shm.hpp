@@ -0,0 +1,54 @@
+#ifndef TRACE_SHM_H
+#define TRACE_SHM_H
+
+#include <atomic>
+#include <string>
+#include <sys/types.h>
+#include "trace_source.hpp"
+
+/*
+ * Decoded trace shared between concurrent procsim processes
+ *
+ * The first process to ask for a trace decodes it into a named POSIX
+ * shared memory segment and flips the ready state. Later processes attach
+ * to the segment, map the records read-only and fetch straight from it.
+ * The last process to detach unlinks the segment.
+ */
+
+#define TRACE_SHM_MAGIC "PTSHM001"
+
+enum trace_shm_state_t { SHM_DECODING, SHM_READY, SHM_FAILED };
+
+struct trace_shm_header_t {
+    char magic[8];
+    std::atomic<uint32_t> state;
+    std::atomic<uint32_t> refs;
+    pid_t owner;
+    uint64_t record_count;
+};
+
+struct shm_trace_source_t : public trace_source_t {
+    shm_trace_source_t() : header(NULL), records(NULL), map_size(0), pos(0) { }
+    ~shm_trace_source_t();
+
+    // attach to the shared copy of filename, decoding it first if needed
+    bool open(const char *filename);
+
+    bool read(Trace_Rec *rec);
+    size_t read_batch(Trace_Rec *recs, size_t n);
+    uint64_t skip(uint64_t n);
+
+    std::string name;
+    bool created;
+
+private:
+    bool create(const char *filename, int fd);
+    int attach(int fd);
+
+    trace_shm_header_t *header;
+    const Trace_Rec *records;
+    size_t map_size;
+    uint64_t pos;
+};
+
+#endif /* TRACE_SHM_H */
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include "trace_source.hpp"
+#include "trace_block.hpp"
+#include "trace_codec.hpp"
+
+uint64_t trace_source_t::skip(uint64_t n) {
+    Trace_Rec rec;
+    uint64_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!read(&rec))
+            break;
+    }
+    return i;
+}
+
+size_t trace_source_t::read_batch(Trace_Rec *recs, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!read(&recs[i]))
+            break;
+    }
+    return i;
+}
+
+// the buffer is ours rather than stdio's so --mem-stats counts it
+gz_trace_source_t::gz_trace_source_t(FILE *pipe) : pipe(pipe), pipe_buf(STREAM_BUFFER_SIZE) {
+    setvbuf(pipe, pipe_buf.data(), _IOFBF, pipe_buf.size());
+}
+
+gz_trace_source_t::~gz_trace_source_t() {
+    if (pipe != NULL)
+        pclose(pipe);
+}
+
+bool gz_trace_source_t::read(Trace_Rec *rec) {
+    return read_batch(rec, 1) == 1;
+}
+
+size_t gz_trace_source_t::read_batch(Trace_Rec *recs, size_t n) {
+    if (pipe == NULL)
+        return 0;
+
+    // fread only comes up short at the end, where a partial record is an error
+    size_t bytes = fread(recs, 1, n * sizeof(Trace_Rec), pipe);
+    if (bytes % sizeof(Trace_Rec) != 0) {
+        fprintf(stderr, "Trace ends in the middle of a record (%zu stray bytes)\n", bytes % sizeof(Trace_Rec));
+        error = true;
+    }
+    return bytes / sizeof(Trace_Rec);
+}
+
+// a truncated or corrupt file only shows in how gunzip exits
+bool gz_trace_source_t::failed() {
+    if (pipe != NULL && ferror(pipe))
+        error = true;
+    if (pipe != NULL && feof(pipe)) {
+        int status = pclose(pipe);
+        pipe = NULL;
+        if (status != 0) {
+            fprintf(stderr, "gunzip failed on the trace (exit status %d)\n",
+                    WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            error = true;
+        }
+    }
+    return error;
+}
+
+stream_trace_source_t::stream_trace_source_t()
+    : fd(-1), zs(NULL), in_pos(0), in_end(0), in_eof(false), pos(0), end(0), eof(false) {
+}
+
+stream_trace_source_t::~stream_trace_source_t() {
+    if (zs != NULL) {
+        inflateEnd(zs);
+        delete zs;
+    }
+    if (fd > 0)
+        close(fd);
+}
+
+bool stream_trace_source_t::open(const char *filename) {
+    fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : ::open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    out.assign(STREAM_BUFFER_SIZE, 0);
+
+    /* Tell the format from the first bytes */
+    while (end < 8 && !eof) {
+        size_t n = read_chunk(out.data() + end, out.size() - end);
+        eof = (n == 0);
+        end += n;
+    }
+
+    if (end >= 8 && (memcmp(out.data(), TRACE_CODEC_MAGIC, 8) == 0 || memcmp(out.data(), TRACE_BLOCK_MAGIC, 8) == 0)) {
+        fprintf(stderr, "%s: codec and block traces must be read from a file\n", filename);
+        return false;
+    }
+
+    if (end >= 2 && out[0] == 0x1f && out[1] == 0x8b) {
+        zs = new z_stream();
+        if (inflateInit2(zs, 16 + MAX_WBITS) != Z_OK) {
+            delete zs;
+            zs = NULL;
+            return false;
+        }
+        // what was read so far is compressed input
+        in.swap(out);
+        in_end = end;
+        in_eof = eof;
+        out.assign(STREAM_BUFFER_SIZE, 0);
+        end = 0;
+        eof = false;
+    }
+    return true;
+}
+
+// one read(2) of up to size bytes, 0 at the end of the stream
+size_t stream_trace_source_t::read_chunk(uint8_t *buf, size_t size) {
+    ssize_t n;
+
+    do {
+        n = ::read(fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        perror("Reading the trace stream");
+        error = true;
+        return 0;
+    }
+    return n;
+}
+
+// read more compressed input once the last chunk is used up
+void stream_trace_source_t::fill_input() {
+    if (in_pos == in_end && !in_eof) {
+        in_pos = 0;
+        in_end = read_chunk(in.data(), in.size());
+        in_eof = (in_end == 0);
+    }
+}
+
+// move the partial record to the front and wait for at least one whole record
+bool stream_trace_source_t::refill() {
+    size_t left = end - pos;
+    memmove(out.data(), out.data() + pos, left);
+    pos = 0;
+    end = left;
+
+    while (end - pos < sizeof(Trace_Rec) && !eof) {
+        if (zs == NULL) {
+            size_t n = read_chunk(out.data() + end, out.size() - end);
+            eof = (n == 0);
+            end += n;
+            continue;
+        }
+
+        fill_input();
+
+        zs->next_in = in.data() + in_pos;
+        zs->avail_in = in_end - in_pos;
+        zs->next_out = out.data() + end;
+        zs->avail_out = out.size() - end;
+        int ret = inflate(zs, Z_NO_FLUSH);
+        in_pos = in_end - zs->avail_in;
+        end = out.size() - zs->avail_out;
+
+        // like gunzip, concatenated gzip members make one stream
+        if (ret == Z_STREAM_END) {
+            fill_input();
+            if (in_pos == in_end)
+                eof = true;
+            else
+                inflateReset(zs);
+        } else if (ret == Z_BUF_ERROR && in_pos == in_end && in_eof) {
+            fprintf(stderr, "Trace stream ends in the middle of a gzip member\n");
+            error = true;
+            eof = true;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "Corrupt gzip trace stream: %s\n", zs->msg ? zs->msg : "inflate failed");
+            error = true;
+            eof = true;
+        }
+    }
+
+    // raw or inflated, the stream must end on a record boundary
+    if (eof && !error && end - pos > 0 && end - pos < sizeof(Trace_Rec)) {
+        fprintf(stderr, "Trace stream ends in the middle of a record (%zu stray bytes)\n", end - pos);
+        error = true;
+    }
+    return end - pos >= sizeof(Trace_Rec);
+}
+
+bool stream_trace_source_t::read(Trace_Rec *rec) {
+    return read_batch(rec, 1) == 1;
+}
+
+size_t stream_trace_source_t::read_batch(Trace_Rec *recs, size_t n) {
+    size_t done = 0;
+
+    while (done < n) {
+        size_t avail = (end - pos) / sizeof(Trace_Rec);
+        if (avail == 0) {
+            if (!refill())
+                break;
+            continue;
+        }
+
+        size_t k = std::min(n - done, avail);
+        memcpy(recs + done, out.data() + pos, k * sizeof(Trace_Rec));
+        pos += k * sizeof(Trace_Rec);
+        done += k;
+    }
+    return done;
+}
+
+bool limit_trace_source_t::read(Trace_Rec *rec) {
+    if (left == 0 || !src->read(rec))
+        return false;
+    left--;
+    return true;
+}
+
+size_t limit_trace_source_t::read_batch(Trace_Rec *recs, size_t n) {
+    n = src->read_batch(recs, std::min<uint64_t>(n, left));
+    left -= n;
+    return n;
+}
+
+bool memory_trace_source_t::read(Trace_Rec *rec) {
+    if (pos == n)
+        return false;
+    *rec = recs[pos++];
+    return true;
+}
+
+size_t memory_trace_source_t::read_batch(Trace_Rec *out, size_t count) {
+    count = std::min<uint64_t>(count, n - pos);
+    memcpy(out, recs + pos, count * sizeof(Trace_Rec));
+    pos += count;
+    return count;
+}
+
+uint64_t memory_trace_source_t::skip(uint64_t count) {
+    count = std::min(count, n - pos);
+    pos += count;
+    return count;
+}
+
+bool is_stream_trace(const char *filename) {
+    struct stat st;
+
+    if (strcmp(filename, "-") == 0)
+        return true;
+    return stat(filename, &st) == 0 && !S_ISREG(st.st_mode);
+}
+
+void print_trace_opened(const char *filename) {
+    if (is_block_trace(filename))
+        printf("Opened block trace: %s \n", filename);
+    else if (is_codec_trace(filename))
+        printf("Opened codec trace: %s \n", filename);
+    else
+        printf("Opened file with command: gunzip -c %s \n", filename);
+}
+
+trace_source_t *open_trace_source(const char *filename) {
+    if (is_stream_trace(filename)) {
+        stream_trace_source_t *src = new stream_trace_source_t();
+        if (!src->open(filename)) {
+            delete src;
+            printf("Unable to read a trace from %s \n", filename);
+            return NULL;
+        }
+        printf("Streaming trace: %s \n", filename);
+        return src;
+    }
+
+    if (is_block_trace(filename)) {
+        block_trace_source_t *src = new block_trace_source_t();
+        if (!src->open(filename)) {
+            delete src;
+            return NULL;
+        }
+        print_trace_opened(filename);
+        return src;
+    }
+
+    if (is_codec_trace(filename)) {
+        codec_trace_source_t *src = new codec_trace_source_t();
+        if (!src->open(filename)) {
+            delete src;
+            return NULL;
+        }
+        print_trace_opened(filename);
+        return src;
+    }
+
+    // popen succeeds whether or not gunzip can read the file
+    if (access(filename, R_OK) != 0) {
+        printf("Unable to read the trace file %s: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    std::string cmd_string = std::string("gunzip -c ") + filename;
+    FILE *pipe = popen(cmd_string.c_str(), "r");
+    if (pipe == NULL) {
+        printf("Command string is %s\n", cmd_string.c_str());
+        printf("Unable to open the trace file with gzip option \n");
+        return NULL;
+    }
+
+    print_trace_opened(filename);
+    return new gz_trace_source_t(pipe);
+}
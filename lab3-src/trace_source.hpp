@@ -0,0 +1,111 @@
+#ifndef TRACE_SOURCE_H
+#define TRACE_SOURCE_H
+
+#include "procsim.hpp"
+#include "mem_stats.hpp"
+
+// read size of streamed traces and of the gunzip pipe
+#define STREAM_BUFFER_SIZE (1 << 20)
+
+// a producer of raw trace records, one implementation per trace format
+struct trace_source_t {
+    trace_source_t() : error(false) { }
+    virtual ~trace_source_t() { }
+
+    // returns true if a record was read successfully
+    virtual bool read(Trace_Rec *rec) = 0;
+
+    // read up to n records, returns the number read
+    virtual size_t read_batch(Trace_Rec *recs, size_t n);
+
+    // skip the next n records, returns the number actually skipped
+    virtual uint64_t skip(uint64_t n);
+
+    // true if the records ended early on a read error or a truncated or
+    // corrupt trace, asked once the run is done with the source
+    virtual bool failed() { return error; }
+
+    bool error;
+};
+
+// gzip'ed trace decompressed through a gunzip pipe
+struct gz_trace_source_t : public trace_source_t {
+    // takes over the stdio buffering of pipe
+    gz_trace_source_t(FILE *pipe);
+    ~gz_trace_source_t();
+
+    bool read(Trace_Rec *rec);
+    size_t read_batch(Trace_Rec *recs, size_t n);
+
+    // gunzip's exit status once the pipe is drained
+    bool failed();
+
+    FILE *pipe;
+    mem_vector_t<char, MEM_TRACE> pipe_buf;
+};
+
+// raw or gzip'ed records streamed from standard input, a pipe or a FIFO
+// as a producer writes them, read in large chunks and inflated in process
+struct stream_trace_source_t : public trace_source_t {
+    stream_trace_source_t();
+    ~stream_trace_source_t();
+
+    // "-" reads standard input
+    bool open(const char *filename);
+
+    bool read(Trace_Rec *rec);
+    size_t read_batch(Trace_Rec *recs, size_t n);
+
+private:
+    bool refill();
+    void fill_input();
+    size_t read_chunk(uint8_t *buf, size_t size);
+
+    int fd;
+    struct z_stream_s *zs;      // NULL for raw records
+    mem_vector_t<uint8_t, MEM_TRACE> in;
+    size_t in_pos;
+    size_t in_end;
+    bool in_eof;
+    mem_vector_t<uint8_t, MEM_TRACE> out;
+    size_t pos;
+    size_t end;
+    bool eof;
+};
+
+// the next n records of another source
+struct limit_trace_source_t : public trace_source_t {
+    limit_trace_source_t(trace_source_t *src, uint64_t n) : src(src), left(n) { }
+
+    bool read(Trace_Rec *rec);
+    size_t read_batch(Trace_Rec *recs, size_t n);
+    bool failed() { return src->failed(); }
+
+    trace_source_t *src;
+    uint64_t left;
+};
+
+// records decoded once and replayed by many runs
+struct memory_trace_source_t : public trace_source_t {
+    memory_trace_source_t(const Trace_Rec *recs, uint64_t n) : recs(recs), n(n), pos(0) { }
+
+    bool read(Trace_Rec *rec);
+    size_t read_batch(Trace_Rec *recs, size_t n);
+    uint64_t skip(uint64_t n);
+
+    const Trace_Rec *recs;
+    uint64_t n;
+    uint64_t pos;
+};
+
+// true for "-" and anything that isn't a regular file, which can only be read once
+bool is_stream_trace(const char *filename);
+
+// the line open_trace_source reports opening the trace file with
+void print_trace_opened(const char *filename);
+
+// opens a trace, picking the reader from the file contents
+// returns NULL if the trace can't be opened
+trace_source_t *open_trace_source(const char *filename);
+
+#endif /* TRACE_SOURCE_H */
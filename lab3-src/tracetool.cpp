@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <cinttypes>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include "procsim.hpp"
+#include "trace_source.hpp"
+#include "trace_block.hpp"
+#include "trace_codec.hpp"
+#include "simpoint.hpp"
+#include "trace_profile.hpp"
+
+void print_help_and_exit(void) {
+    printf("tracetool COMMAND [OPTIONS]\n");
+    printf("  pack in.gz out.ptb [-n N]\tConvert a trace into a seekable block trace\n");
+    printf("\t\t\t\twith N records per block\n");
+    printf("  unpack in.ptb out [-t T]\tWrite the raw records of a block trace, decoding\n");
+    printf("\t\t\t\tT blocks at a time (out may be - for stdout)\n");
+    printf("  info in.ptb\t\t\tPrint the block index\n");
+    printf("  encode in out.ptc\t\tConvert a trace into the compact codec format\n");
+    printf("  decode in.ptc out\t\tWrite the raw records of a codec trace, gzip'ed\n");
+    printf("\t\t\t\tif out ends in .gz (out may be - for stdout)\n");
+    printf("  simpoint in out [-n N] [-k K] [-d D] [-s SEED]\n");
+    printf("\t\t\t\tPick simulation points among N instruction intervals\n");
+    printf("\t\t\t\t(default: %d) with up to K clusters (default: %d) of\n",
+           SIMPOINT_DEFAULT_INTERVAL, SIMPOINT_DEFAULT_MAX_K);
+    printf("\t\t\t\tbasic block vectors projected to D dimensions (default: %d)\n",
+           SIMPOINT_DEFAULT_DIMS);
+    printf("  profile in [-n N]\t\tPrint the op mix, register use, producer distances,\n");
+    printf("\t\t\t\tbranch and memory access statistics of a trace with\n");
+    printf("\t\t\t\tits N most used registers (default: %d)\n", PROFILE_DEFAULT_TOP_REGS);
+    exit(0);
+}
+
+// true if src stopped on a read error or a truncated trace rather than at its end
+static bool source_failed(trace_source_t *src, const char *filename) {
+    if (!src->failed())
+        return false;
+    fprintf(stderr, "%s is truncated or unreadable\n", filename);
+    return true;
+}
+
+int do_pack(int argc, char *argv[]) {
+    int opt;
+    uint32_t block_records = TRACE_BLOCK_DEFAULT_RECORDS;
+
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+        case 'n':
+            block_records = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_help_and_exit();
+        }
+    }
+    if (argc - optind != 2)
+        print_help_and_exit();
+
+    trace_source_t *src = open_trace_source(argv[optind]);
+    if (src == NULL)
+        return 1;
+
+    trace_block_writer_t writer;
+    if (!writer.open(argv[optind + 1], block_records)) {
+        fprintf(stderr, "Unable to create %s\n", argv[optind + 1]);
+        delete src;
+        return 1;
+    }
+
+    Trace_Rec rec;
+    uint64_t n = 0;
+    while (src->read(&rec)) {
+        if (!writer.write(&rec)) {
+            fprintf(stderr, "Write to %s failed\n", argv[optind + 1]);
+            delete src;
+            return 1;
+        }
+        n++;
+    }
+    bool failed = source_failed(src, argv[optind]);
+    delete src;
+
+    if (!writer.close()) {
+        fprintf(stderr, "Write to %s failed\n", argv[optind + 1]);
+        return 1;
+    }
+    // a block trace of what was read would look complete
+    if (failed) {
+        remove(argv[optind + 1]);
+        return 1;
+    }
+
+    printf("Packed %" PRIu64 " instructions into %s\n", n, argv[optind + 1]);
+    return 0;
+}
+
+int do_unpack(int argc, char *argv[]) {
+    int opt;
+    unsigned n_threads = std::thread::hardware_concurrency();
+
+    while (-1 != (opt = getopt(argc, argv, "t:"))) {
+        switch (opt) {
+        case 't':
+            n_threads = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_help_and_exit();
+        }
+    }
+    if (argc - optind != 2)
+        print_help_and_exit();
+    if (n_threads == 0)
+        n_threads = 1;
+
+    trace_block_reader_t reader;
+    if (!reader.open(argv[optind]))
+        return 1;
+
+    FILE *out = stdout;
+    if (strcmp(argv[optind + 1], "-") != 0 && (out = fopen(argv[optind + 1], "wb")) == NULL) {
+        fprintf(stderr, "Unable to create %s\n", argv[optind + 1]);
+        return 1;
+    }
+
+    // decode n_threads blocks concurrently, then write them out in order
+    std::vector<Trace_Rec> buf((size_t) n_threads * reader.block_records());
+    for (uint64_t b = 0; b < reader.block_count(); b += n_threads) {
+        uint64_t count = reader.block_count() - b;
+        if (count > n_threads)
+            count = n_threads;
+
+        if (!read_blocks_parallel(reader, b, count, n_threads, buf.data())) {
+            fprintf(stderr, "Unable to decompress blocks %" PRIu64 "..%" PRIu64 "\n", b, b + count - 1);
+            return 1;
+        }
+
+        const trace_block_index_t &last = reader.block_info(b + count - 1);
+        size_t records = last.first_record + last.records - reader.block_info(b).first_record;
+        if (fwrite(buf.data(), sizeof(Trace_Rec), records, out) != records) {
+            fprintf(stderr, "Write failed\n");
+            return 1;
+        }
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
+
+int do_info(int argc, char *argv[]) {
+    if (argc != 2)
+        print_help_and_exit();
+
+    trace_block_reader_t reader;
+    if (!reader.open(argv[1]))
+        return 1;
+
+    printf("Instructions: %" PRIu64 "\n", reader.record_count());
+    printf("Blocks: %" PRIu64 " x %u records\n", reader.block_count(), reader.block_records());
+    printf("BLOCK\tFIRST\tOFFSET\tBYTES\tRECORDS\n");
+    for (uint64_t b = 0; b < reader.block_count(); b++) {
+        const trace_block_index_t &entry = reader.block_info(b);
+        printf("%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%u\t%u\n",
+               b, entry.first_record + 1, entry.offset, entry.comp_size, entry.records);
+    }
+    return 0;
+}
+
+int do_encode(int argc, char *argv[]) {
+    if (argc != 3)
+        print_help_and_exit();
+
+    trace_source_t *src = open_trace_source(argv[1]);
+    if (src == NULL)
+        return 1;
+
+    trace_codec_writer_t writer;
+    if (!writer.open(argv[2])) {
+        fprintf(stderr, "Unable to create %s\n", argv[2]);
+        delete src;
+        return 1;
+    }
+
+    Trace_Rec rec;
+    uint64_t n = 0;
+    while (src->read(&rec)) {
+        if (!writer.write(&rec)) {
+            fprintf(stderr, "Write to %s failed\n", argv[2]);
+            delete src;
+            return 1;
+        }
+        n++;
+    }
+    bool failed = source_failed(src, argv[1]);
+    delete src;
+
+    uint64_t bytes = writer.bytes();
+    if (!writer.close()) {
+        fprintf(stderr, "Write to %s failed\n", argv[2]);
+        return 1;
+    }
+    if (failed || n == 0) {
+        if (!failed)
+            fprintf(stderr, "%s holds no instructions\n", argv[1]);
+        remove(argv[2]);
+        return 1;
+    }
+
+    printf("Encoded %" PRIu64 " instructions into %s (%" PRIu64 " bytes, %.2f per instruction)\n",
+           n, argv[2], bytes, n ? bytes * 1.0 / n : 0.0);
+    return 0;
+}
+
+int do_decode(int argc, char *argv[]) {
+    if (argc != 3)
+        print_help_and_exit();
+
+    codec_trace_source_t src;
+    if (!src.open(argv[1]))
+        return 1;
+
+    const char *name = argv[2];
+    size_t len = strlen(name);
+    bool gz = len > 3 && strcmp(name + len - 3, ".gz") == 0;
+    FILE *out = stdout;
+
+    if (gz) {
+        std::string cmd_string = std::string("gzip -c > ") + name;
+        out = popen(cmd_string.c_str(), "w");
+    } else if (strcmp(name, "-") != 0) {
+        out = fopen(name, "wb");
+    }
+    if (out == NULL) {
+        fprintf(stderr, "Unable to create %s\n", name);
+        return 1;
+    }
+
+    std::vector<Trace_Rec> buf(65536);
+    size_t n;
+    bool ok = true;
+    while (ok && (n = src.read_batch(buf.data(), buf.size())) > 0)
+        ok = fwrite(buf.data(), sizeof(Trace_Rec), n, out) == n;
+
+    if (gz)
+        ok = (pclose(out) == 0) && ok;
+    else if (out != stdout)
+        ok = (fclose(out) == 0) && ok;
+
+    if (!ok) {
+        fprintf(stderr, "Write to %s failed\n", name);
+        return 1;
+    }
+    return source_failed(&src, argv[1]) ? 1 : 0;
+}
+
+int do_simpoint(int argc, char *argv[]) {
+    int opt;
+    simpoint_options_t opts;
+
+    opts.interval_size = SIMPOINT_DEFAULT_INTERVAL;
+    opts.max_k = SIMPOINT_DEFAULT_MAX_K;
+    opts.dims = SIMPOINT_DEFAULT_DIMS;
+    opts.seed = 1;
+
+    while (-1 != (opt = getopt(argc, argv, "n:k:d:s:"))) {
+        switch (opt) {
+        case 'n':
+            opts.interval_size = strtoull(optarg, NULL, 10);
+            break;
+        case 'k':
+            opts.max_k = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            opts.dims = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            opts.seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            print_help_and_exit();
+        }
+    }
+    if (argc - optind != 2 || opts.interval_size == 0 || opts.max_k == 0 || opts.dims == 0)
+        print_help_and_exit();
+
+    trace_source_t *src = open_trace_source(argv[optind]);
+    if (src == NULL)
+        return 1;
+
+    simpoint_result_t result;
+    bool found = find_simpoints(src, opts, &result);
+    bool failed = source_failed(src, argv[optind]);
+    delete src;
+
+    // points of part of the trace would be weighted as if they were all of it
+    if (failed)
+        return 1;
+
+    if (!found) {
+        fprintf(stderr, "The trace is shorter than one %" PRIu64 " instruction interval\n", opts.interval_size);
+        return 1;
+    }
+    if (!write_simpoints(argv[optind + 1], result)) {
+        fprintf(stderr, "Unable to write %s\n", argv[optind + 1]);
+        return 1;
+    }
+
+    printf("Instructions: %" PRIu64 "\n", result.instructions);
+    printf("Intervals: %" PRIu64 " x %" PRIu64 " instructions\n", result.intervals, result.interval_size);
+    printf("K\tBIC\n");
+    for (size_t k = 0; k < result.bic.size(); k++)
+        printf("%zu\t%f\n", k + 1, result.bic[k]);
+    printf("Clusters: %zu\n", result.points.size());
+    printf("INTERVAL\tFIRST\tWEIGHT\n");
+    for (auto &p : result.points)
+        printf("%" PRIu64 "\t%" PRIu64 "\t%f\n", p.interval, p.interval * result.interval_size + 1, p.weight);
+    return 0;
+}
+
+int do_profile(int argc, char *argv[]) {
+    int opt;
+    unsigned top_regs = PROFILE_DEFAULT_TOP_REGS;
+
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+        case 'n':
+            top_regs = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_help_and_exit();
+        }
+    }
+    if (argc - optind != 1)
+        print_help_and_exit();
+
+    trace_source_t *src = open_trace_source(argv[optind]);
+    if (src == NULL)
+        return 1;
+
+    trace_profile_t profile;
+    profile_trace(src, &profile);
+    bool failed = source_failed(src, argv[optind]);
+    delete src;
+
+    if (failed)
+        return 1;
+
+    print_trace_profile(stdout, profile, top_regs);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2)
+        print_help_and_exit();
+
+    // the sub command parses the remaining arguments
+    if (strcmp(argv[1], "pack") == 0)
+        return do_pack(argc - 1, argv + 1);
+    if (strcmp(argv[1], "unpack") == 0)
+        return do_unpack(argc - 1, argv + 1);
+    if (strcmp(argv[1], "info") == 0)
+        return do_info(argc - 1, argv + 1);
+    if (strcmp(argv[1], "encode") == 0)
+        return do_encode(argc - 1, argv + 1);
+    if (strcmp(argv[1], "decode") == 0)
+        return do_decode(argc - 1, argv + 1);
+    if (strcmp(argv[1], "simpoint") == 0)
+        return do_simpoint(argc - 1, argv + 1);
+    if (strcmp(argv[1], "profile") == 0)
+        return do_profile(argc - 1, argv + 1);
+
+    print_help_and_exit();
+    return 0;
+}